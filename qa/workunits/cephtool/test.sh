@@ -20,6 +20,11 @@ ceph osd reweight 0 0.9
 ! ceph osd reweight 0 -1
 ceph osd reweight 0 1
 
+! ceph osd reweight-by-pg foo
+! ceph osd reweight-by-pg 0.1x
+! ceph osd reweight-by-pg 0
+! ceph osd reweight-by-pg 0.1 nosuchpool
+
 for s in pg_num pgp_num size min_size crash_replay_interval crush_ruleset; do
 	ceph osd pool get data $s
 done
@@ -253,7 +253,7 @@ void CryptoAES::encrypt(const bufferptr& secret, const bufferlist& in, bufferlis
     CryptoPP::StringSink *sink = new CryptoPP::StringSink(ciphertext);
     CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, sink);
 
-    for (std::list<bufferptr>::const_iterator it = in.buffers().begin();
+    for (bufferlist::buffers_t::const_iterator it = in.buffers().begin();
 	 it != in.buffers().end(); it++) {
       in_buf = (const unsigned char *)it->c_str();
 
@@ -288,7 +288,7 @@ void CryptoAES::decrypt(const bufferptr& secret, const bufferlist& in,
   string decryptedtext;
   CryptoPP::StringSink *sink = new CryptoPP::StringSink(decryptedtext);
   CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, sink);
-  for (std::list<bufferptr>::const_iterator it = in.buffers().begin(); 
+  for (bufferlist::buffers_t::const_iterator it = in.buffers().begin(); 
        it != in.buffers().end(); it++) {
       const unsigned char *in_buf = (const unsigned char *)it->c_str();
       stfDecryptor.Put(in_buf, it->length());
@@ -86,3 +86,37 @@ void *Finisher::finisher_thread_entry()
   return 0;
 }
 
+
+MultiFinisher::MultiFinisher(CephContext *cct, string name, unsigned n)
+{
+  assert(n > 0);
+  for (unsigned i = 0; i < n; i++) {
+    ostringstream ss;
+    ss << name << "-" << i;
+    lanes.push_back(new Finisher(cct, ss.str()));
+  }
+}
+
+MultiFinisher::~MultiFinisher()
+{
+  for (unsigned i = 0; i < lanes.size(); i++)
+    delete lanes[i];
+}
+
+void MultiFinisher::start()
+{
+  for (unsigned i = 0; i < lanes.size(); i++)
+    lanes[i]->start();
+}
+
+void MultiFinisher::stop()
+{
+  for (unsigned i = 0; i < lanes.size(); i++)
+    lanes[i]->stop();
+}
+
+void MultiFinisher::wait_for_empty()
+{
+  for (unsigned i = 0; i < lanes.size(); i++)
+    lanes[i]->wait_for_empty();
+}
@@ -20,6 +20,7 @@
 #include "common/Cond.h"
 #include "common/Thread.h"
 #include "common/perf_counters.h"
+#include "include/hash.h"
 
 class CephContext;
 
@@ -54,28 +55,28 @@ class Finisher {
       finisher_queue.push_back(NULL);
     } else
       finisher_queue.push_back(c);
-    finisher_cond.Signal();
-    finisher_lock.Unlock();
     if (logger)
       logger->inc(l_finisher_queue_len);
+    finisher_cond.Signal();
+    finisher_lock.Unlock();
   }
   void queue(vector<Context*>& ls) {
     finisher_lock.Lock();
     finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
+    if (logger)
+      logger->inc(l_finisher_queue_len, ls.size());
     finisher_cond.Signal();
     finisher_lock.Unlock();
     ls.clear();
-    if (logger)
-      logger->inc(l_finisher_queue_len);
   }
   void queue(deque<Context*>& ls) {
     finisher_lock.Lock();
     finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
+    if (logger)
+      logger->inc(l_finisher_queue_len, ls.size());
     finisher_cond.Signal();
     finisher_lock.Unlock();
     ls.clear();
-    if (logger)
-      logger->inc(l_finisher_queue_len);
   }
   
   void start();
@@ -95,7 +96,7 @@ class Finisher {
     finisher_thread(this) {
     PerfCountersBuilder b(cct, string("finisher-") + name,
 			  l_finisher_first, l_finisher_last);
-    b.add_time_avg(l_finisher_queue_len, "queue_len");
+    b.add_u64(l_finisher_queue_len, "queue_len");
     logger = b.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
     logger->set(l_finisher_queue_len, 0);
@@ -109,6 +110,48 @@ class Finisher {
   }
 };
 
+/*
+ * A Finisher with several threads ("lanes"), each a Finisher of its
+ * own with its own queue_len counters (finisher-<name>-<lane>).
+ *
+ * Completions queued with the same key run on the same lane, in the
+ * order they were queued; use e.g. the OpSequencer or object as the
+ * key.  Unkeyed completions are spread round-robin, so they are only
+ * ordered with respect to each other when there is a single lane.
+ */
+class MultiFinisher {
+  vector<Finisher*> lanes;
+  atomic_t next;
+
+  Finisher *lane_for(uint64_t key) {
+    return lanes[rjhash64(key) % lanes.size()];
+  }
+
+ public:
+  void queue(Context *c, int r = 0) {
+    lanes[next.inc() % lanes.size()]->queue(c, r);
+  }
+  void queue(uint64_t key, Context *c, int r = 0) {
+    lane_for(key)->queue(c, r);
+  }
+  void queue(const void *key, Context *c, int r = 0) {
+    lane_for((uint64_t)(uintptr_t)key)->queue(c, r);
+  }
+
+  unsigned get_num_lanes() const {
+    return lanes.size();
+  }
+
+  void start();
+  void stop();
+
+  /// wait until every lane is idle
+  void wait_for_empty();
+
+  MultiFinisher(CephContext *cct, string name, unsigned n);
+  ~MultiFinisher();
+};
+
 class C_OnFinisher : public Context {
   Context *con;
   Finisher *fin;
@@ -29,6 +29,9 @@ class PrebufferedStreambuf
 public:
   PrebufferedStreambuf(char *buf, size_t len);
 
+  /// discard what has been written, so the streambuf can be reused
+  void reset();
+
   // called when the buffer fills up
   int_type overflow(int_type c);
 
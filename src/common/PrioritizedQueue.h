@@ -18,352 +18,416 @@
 #include "common/Mutex.h"
 #include "common/Formatter.h"
 
-#include <map>
-#include <utility>
+#include <ext/hash_map>
 #include <list>
 #include <algorithm>
 
 /**
  * Manages queue for normal and strict priority items
  *
- * On dequeue, the queue will select the lowest priority queue
- * such that the q has bucket > cost of front queue item.
- *
- * If there is no such queue, we choose the next queue item for
- * the highest priority queue.
- *
- * Before returning a dequeued item, we place into each bucket
- * cost * (priority/total_priority) tokens.
- *
  * enqueue_strict and enqueue_strict_front queue items into queues
  * which are serviced in strict priority order before items queued
- * with enqueue and enqueue_front
+ * with enqueue and enqueue_front.
+ *
+ * Normal priorities share the remaining service by deficit round
+ * robin on cost: each visit to a priority adds priority * min_cost to
+ * its deficit, and it is served while the deficit is positive.  Over
+ * time each priority with work gets a share of the cost served in
+ * proportion to its priority.
  *
  * Within a priority class, we schedule round robin based on the class
  * of type K used to enqueue items.  e.g. you could use entity_inst_t
- * to provide fairness for different clients.
+ * to provide fairness for different clients.  With cost_fair, that is
+ * deficit round robin too, with max_tokens_per_subqueue of cost per
+ * turn, so a client sending large items gets no more than one sending
+ * small ones; otherwise each turn is a single item.
+ *
+ * Priorities are clamped to [0, 255].  Enqueue and dequeue are O(1)
+ * (amortized, for items costing more than a turn's worth): each class
+ * keeps an intrusive FIFO, classes with work form a ring per priority,
+ * normal priorities with work form a ring, and strict priorities with
+ * work are found through a bitmap.
  */
 template <typename T, typename K>
 class PrioritizedQueue {
+  static const unsigned NUM_PRIORITIES = 256;
+
   int64_t total_priority;
   int64_t max_tokens_per_subqueue;
   int64_t min_cost;
+  bool cost_fair;
+  unsigned size;
 
-  template <class F>
-  static unsigned filter_list_pairs(
-    list<pair<unsigned, T> > *l, F f,
-    list<T> *out) {
-    unsigned ret = 0;
-    if (out) {
-      for (typename list<pair<unsigned, T> >::reverse_iterator i = l->rbegin();
-	   i != l->rend();
-	   ++i) {
-	if (f(i->second)) {
-	  out->push_front(i->second);
-	}
-      }
+  struct Item {
+    T item;
+    unsigned cost;
+    Item *next;
+    Item(T t, unsigned c) : item(t), cost(c), next(NULL) {}
+  };
+
+  struct Client {
+    K key;
+    Item *head, *tail;
+    int64_t deficit;
+    Client *prev, *next;    ///< ring of classes with queued items
+    Client(K k)
+      : key(k), head(NULL), tail(NULL), deficit(0), prev(NULL), next(NULL) {}
+  };
+
+  template <class N>
+  static void ring_insert(N *&cur, N *n) {
+    // at the end of the round, i.e. just before cur
+    if (!cur) {
+      n->prev = n->next = n;
+      cur = n;
+    } else {
+      n->next = cur;
+      n->prev = cur->prev;
+      cur->prev->next = n;
+      cur->prev = n;
     }
-    for (typename list<pair<unsigned, T> >::iterator i = l->begin();
-	 i != l->end();
-      ) {
-      if (f(i->second)) {
-	l->erase(i++);
-	++ret;
-      } else {
-	++i;
-      }
+  }
+  template <class N>
+  static void ring_remove(N *&cur, N *n) {
+    if (n->next == n) {
+      cur = NULL;
+    } else {
+      n->prev->next = n->next;
+      n->next->prev = n->prev;
+      if (cur == n)
+	cur = n->next;
     }
-    return ret;
+    n->prev = n->next = NULL;
   }
 
   struct SubQueue {
   private:
-    map<K, list<pair<unsigned, T> > > q;
-    unsigned tokens, max_tokens;
-    int64_t size;
-    typename map<K, list<pair<unsigned, T> > >::iterator cur;
-  public:
-    SubQueue(const SubQueue &other)
-      : q(other.q),
-	tokens(other.tokens),
-	max_tokens(other.max_tokens),
-	size(other.size),
-	cur(q.begin()) {}
-    SubQueue()
-      : tokens(0),
-	max_tokens(0),
-	size(0) {}
-    void set_max_tokens(unsigned mt) {
-      max_tokens = mt;
-    }
-    unsigned get_max_tokens() const {
-      return max_tokens;
-    }
-    unsigned num_tokens() const {
-      return tokens;
+    typedef __gnu_cxx::hash_map<K, Client*> client_map_t;
+    client_map_t clients;
+    Client *cur;
+    unsigned size;
+
+    void remove_client(Client *c) {
+      ring_remove(cur, c);
+      clients.erase(c->key);
+      delete c;
     }
-    void put_tokens(unsigned t) {
-      tokens += t;
-      if (tokens > max_tokens)
-	tokens = max_tokens;
+
+    // move the items of c that match f to the front of out, in order
+    template <class F>
+    unsigned filter_client(Client *c, F f, list<T> *out) {
+      unsigned ret = 0;
+      list<T> removed;
+      Item **p = &c->head;
+      Item *last = NULL;
+      while (*p) {
+	Item *i = *p;
+	if (f(i->item)) {
+	  *p = i->next;
+	  if (out)
+	    removed.push_back(i->item);
+	  delete i;
+	  ++ret;
+	} else {
+	  last = i;
+	  p = &i->next;
+	}
+      }
+      c->tail = last;
+      if (out)
+	out->splice(out->begin(), removed);
+      return ret;
     }
-    void take_tokens(unsigned t) {
-      if (tokens > t)
-	tokens -= t;
-      else
-	tokens = 0;
+
+  public:
+    unsigned priority;
+    int64_t deficit;
+    SubQueue *prev, *next;  ///< ring of normal priorities with queued items
+
+    SubQueue(unsigned p)
+      : cur(NULL), size(0), priority(p), deficit(0), prev(NULL), next(NULL) {}
+    ~SubQueue() {
+      while (cur) {
+	Client *c = cur;
+	while (c->head) {
+	  Item *i = c->head;
+	  c->head = i->next;
+	  delete i;
+	}
+	remove_client(c);
+      }
     }
+
     void enqueue(K cl, unsigned cost, T item) {
-      q[cl].push_back(make_pair(cost, item));
-      if (cur == q.end())
-	cur = q.begin();
+      Item *i = new Item(item, cost);
+      Client *c = get_client(cl);
+      if (c->tail)
+	c->tail->next = i;
+      else
+	c->head = i;
+      c->tail = i;
       size++;
     }
     void enqueue_front(K cl, unsigned cost, T item) {
-      q[cl].push_front(make_pair(cost, item));
-      if (cur == q.end())
-	cur = q.begin();
+      Item *i = new Item(item, cost);
+      Client *c = get_client(cl);
+      i->next = c->head;
+      c->head = i;
+      if (!c->tail)
+	c->tail = i;
       size++;
     }
-    pair<unsigned, T> front() const {
-      assert(!(q.empty()));
-      assert(cur != q.end());
-      return cur->second.front();
+    Client *get_client(K cl) {
+      typename client_map_t::iterator p = clients.find(cl);
+      if (p != clients.end())
+	return p->second;
+      Client *c = new Client(cl);
+      clients[cl] = c;
+      ring_insert(cur, c);
+      return c;
     }
-    void pop_front() {
-      assert(!(q.empty()));
-      assert(cur != q.end());
-      cur->second.pop_front();
-      if (cur->second.empty())
-	q.erase(cur++);
-      else
-	++cur;
-      if (cur == q.end())
-	cur = q.begin();
+
+    /// the class to serve next; with a quantum, by deficit round robin
+    Client *pick(int64_t quantum) {
+      assert(cur);
+      if (quantum) {
+	while (cur->deficit <= 0) {
+	  cur->deficit += quantum;
+	  if (cur->deficit <= 0)
+	    cur = cur->next;
+	}
+      }
+      return cur;
+    }
+    /// pop the front of c, as returned by pick()
+    T pop_front(Client *c, unsigned *cost, bool charge) {
+      Item *i = c->head;
+      T ret = i->item;
+      *cost = i->cost;
+      c->head = i->next;
+      if (!c->head)
+	c->tail = NULL;
+      delete i;
       size--;
+      if (charge)
+	c->deficit -= *cost;
+      if (!c->head)
+	remove_client(c);
+      else if (!charge || c->deficit <= 0)
+	cur = c->next;
+      return ret;
     }
+
     unsigned length() const {
-      assert(size >= 0);
-      return (unsigned)size;
+      return size;
     }
     bool empty() const {
-      return q.empty();
+      return size == 0;
     }
     template <class F>
-    void remove_by_filter(F f, list<T> *out) {
-      for (typename map<K, list<pair<unsigned, T> > >::iterator i = q.begin();
-	   i != q.end();
+    unsigned remove_by_filter(F f, list<T> *out) {
+      unsigned ret = 0;
+      for (typename client_map_t::iterator p = clients.begin();
+	   p != clients.end();
 	   ) {
-	size -= filter_list_pairs(&(i->second), f, out);
-	if (i->second.empty()) {
-	  if (cur == i)
-	    ++cur;
-	  q.erase(i++);
-	} else {
-	  ++i;
-	}
+	Client *c = p->second;
+	++p;
+	ret += filter_client(c, f, out);
+	if (!c->head)
+	  remove_client(c);
       }
-      if (cur == q.end())
-	cur = q.begin();
+      size -= ret;
+      return ret;
     }
-    void remove_by_class(K k, list<T> *out) {
-      typename map<K, list<pair<unsigned, T> > >::iterator i = q.find(k);
-      if (i == q.end())
-	return;
-      size -= i->second.size();
-      if (i == cur) {
-	++cur;
-	if (cur == q.end())
-	  cur = q.begin();
-      }
-      if (out) {
-	for (typename list<pair<unsigned, T> >::reverse_iterator j =
-	       i->second.rbegin();
-	     j != i->second.rend();
-	     ++j) {
-	  out->push_front(j->second);
-	}
-      }
-      q.erase(i);
+    struct AllPred {
+      bool operator()(const T &) const { return true; }
+    };
+    unsigned remove_by_class(K k, list<T> *out) {
+      typename client_map_t::iterator p = clients.find(k);
+      if (p == clients.end())
+	return 0;
+      Client *c = p->second;
+      unsigned ret = filter_client(c, AllPred(), out);
+      remove_client(c);
+      size -= ret;
+      return ret;
     }
 
     void dump(Formatter *f) const {
-      f->dump_int("tokens", tokens);
-      f->dump_int("max_tokens", max_tokens);
+      f->dump_int("deficit", deficit);
       f->dump_int("size", size);
-      f->dump_int("num_keys", q.size());
+      f->dump_int("num_keys", clients.size());
     }
   };
-  map<unsigned, SubQueue> high_queue;
-  map<unsigned, SubQueue> queue;
+
+  SubQueue *high_queue[NUM_PRIORITIES];
+  uint64_t high_bits[NUM_PRIORITIES / 64];  ///< non-empty high_queues
+  SubQueue *queue[NUM_PRIORITIES];
+  SubQueue *cur_queue;  ///< ring of non-empty queues
+
+  static unsigned clamp(unsigned priority) {
+    return priority < NUM_PRIORITIES ? priority : NUM_PRIORITIES - 1;
+  }
+
+  SubQueue *create_high_queue(unsigned priority) {
+    if (!high_queue[priority])
+      high_queue[priority] = new SubQueue(priority);
+    high_bits[priority / 64] |= 1ull << (priority % 64);
+    return high_queue[priority];
+  }
 
   SubQueue *create_queue(unsigned priority) {
-    typename map<unsigned, SubQueue>::iterator p = queue.find(priority);
-    if (p != queue.end())
-      return &p->second;
-    total_priority += priority;
-    SubQueue *sq = &queue[priority];
-    sq->set_max_tokens(max_tokens_per_subqueue);
+    SubQueue *sq = queue[priority];
+    if (!sq)
+      sq = queue[priority] = new SubQueue(priority);
+    if (sq->empty()) {
+      total_priority += priority;
+      ring_insert(cur_queue, sq);
+    }
     return sq;
   }
 
-  void remove_queue(unsigned priority) {
-    assert(queue.count(priority));
-    queue.erase(priority);
-    total_priority -= priority;
+  void remove_queue(SubQueue *sq) {
+    ring_remove(cur_queue, sq);
+    sq->deficit = 0;
+    total_priority -= sq->priority;
     assert(total_priority >= 0);
   }
 
-  void distribute_tokens(unsigned cost) {
-    if (total_priority == 0)
-      return;
-    for (typename map<unsigned, SubQueue>::iterator i = queue.begin();
-	 i != queue.end();
-	 ++i) {
-      i->second.put_tokens(((i->first * cost) / total_priority) + 1);
-    }
+  void remove_high_queue(unsigned priority) {
+    high_bits[priority / 64] &= ~(1ull << (priority % 64));
+  }
+
+  int64_t queue_quantum(unsigned priority) const {
+    return std::max<int64_t>(priority, 1) * std::max<int64_t>(min_cost, 1);
+  }
+
+  int64_t client_quantum() const {
+    return cost_fair ? std::max<int64_t>(max_tokens_per_subqueue, 1) : 0;
   }
 
 public:
-  PrioritizedQueue(unsigned max_per, unsigned min_c)
+  PrioritizedQueue(unsigned max_per, unsigned min_c, bool cost_fair = true)
     : total_priority(0),
       max_tokens_per_subqueue(max_per),
-      min_cost(min_c)
-  {}
+      min_cost(min_c),
+      cost_fair(cost_fair),
+      size(0),
+      cur_queue(NULL)
+  {
+    memset(high_queue, 0, sizeof(high_queue));
+    memset(high_bits, 0, sizeof(high_bits));
+    memset(queue, 0, sizeof(queue));
+  }
+  ~PrioritizedQueue() {
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      delete high_queue[i];
+      delete queue[i];
+    }
+  }
 
   unsigned length() {
-    unsigned total = 0;
-    for (typename map<unsigned, SubQueue>::iterator i = queue.begin();
-	 i != queue.end();
-	 ++i) {
-      assert(i->second.length());
-      total += i->second.length();
-    }
-    for (typename map<unsigned, SubQueue>::iterator i = high_queue.begin();
-	 i != high_queue.end();
-	 ++i) {
-      assert(i->second.length());
-      total += i->second.length();
-    }
-    return total;
+    return size;
   }
 
   template <class F>
   void remove_by_filter(F f, list<T> *removed = 0) {
-    for (typename map<unsigned, SubQueue>::iterator i = queue.begin();
-	 i != queue.end();
-	 ) {
-      unsigned priority = i->first;
-      
-      i->second.remove_by_filter(f, removed);
-      if (i->second.empty()) {
-	++i;
-	remove_queue(priority);
-      } else {
-	++i;
-      }
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      SubQueue *sq = queue[i];
+      if (!sq || sq->empty())
+	continue;
+      size -= sq->remove_by_filter(f, removed);
+      if (sq->empty())
+	remove_queue(sq);
     }
-    for (typename map<unsigned, SubQueue>::iterator i = high_queue.begin();
-	 i != high_queue.end();
-	 ) {
-      i->second.remove_by_filter(f, removed);
-      if (i->second.empty()) {
-	high_queue.erase(i++);
-      } else {
-	++i;
-      }
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      SubQueue *sq = high_queue[i];
+      if (!sq || sq->empty())
+	continue;
+      size -= sq->remove_by_filter(f, removed);
+      if (sq->empty())
+	remove_high_queue(i);
     }
   }
 
   void remove_by_class(K k, list<T> *out = 0) {
-    for (typename map<unsigned, SubQueue>::iterator i = queue.begin();
-	 i != queue.end();
-	 ) {
-      i->second.remove_by_class(k, out);
-      if (i->second.empty()) {
-	unsigned priority = i->first;
-	++i;
-	remove_queue(priority);
-      } else {
-	++i;
-      }
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      SubQueue *sq = queue[i];
+      if (!sq || sq->empty())
+	continue;
+      size -= sq->remove_by_class(k, out);
+      if (sq->empty())
+	remove_queue(sq);
     }
-    for (typename map<unsigned, SubQueue>::iterator i = high_queue.begin();
-	 i != high_queue.end();
-	 ) {
-      i->second.remove_by_class(k, out);
-      if (i->second.empty()) {
-	high_queue.erase(i++);
-      } else {
-	++i;
-      }
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      SubQueue *sq = high_queue[i];
+      if (!sq || sq->empty())
+	continue;
+      size -= sq->remove_by_class(k, out);
+      if (sq->empty())
+	remove_high_queue(i);
     }
   }
 
   void enqueue_strict(K cl, unsigned priority, T item) {
-    high_queue[priority].enqueue(cl, 0, item);
+    create_high_queue(clamp(priority))->enqueue(cl, 0, item);
+    size++;
   }
 
   void enqueue_strict_front(K cl, unsigned priority, T item) {
-    high_queue[priority].enqueue_front(cl, 0, item);
+    create_high_queue(clamp(priority))->enqueue_front(cl, 0, item);
+    size++;
   }
 
   void enqueue(K cl, unsigned priority, unsigned cost, T item) {
     if (cost < min_cost)
       cost = min_cost;
-    create_queue(priority)->enqueue(cl, cost, item);
+    create_queue(clamp(priority))->enqueue(cl, cost, item);
+    size++;
   }
 
   void enqueue_front(K cl, unsigned priority, unsigned cost, T item) {
     if (cost < min_cost)
       cost = min_cost;
-    create_queue(priority)->enqueue_front(cl, cost, item);
+    create_queue(clamp(priority))->enqueue_front(cl, cost, item);
+    size++;
   }
 
   bool empty() {
     assert(total_priority >= 0);
-    assert((total_priority == 0) || !(queue.empty()));
-    return queue.empty() && high_queue.empty();
+    assert((total_priority == 0) || cur_queue);
+    return size == 0;
   }
 
   T dequeue() {
     assert(!empty());
+    size--;
+    unsigned cost;
 
-    if (!(high_queue.empty())) {
-      T ret = high_queue.rbegin()->second.front().second;
-      high_queue.rbegin()->second.pop_front();
-      if (high_queue.rbegin()->second.empty())
-	high_queue.erase(high_queue.rbegin()->first);
+    for (int w = NUM_PRIORITIES / 64 - 1; w >= 0; --w) {
+      if (!high_bits[w])
+	continue;
+      unsigned priority = w * 64 + 63 - __builtin_clzll(high_bits[w]);
+      SubQueue *sq = high_queue[priority];
+      T ret = sq->pop_front(sq->pick(0), &cost, false);
+      if (sq->empty())
+	remove_high_queue(priority);
       return ret;
     }
 
-    // if there are multiple buckets/subqueues with sufficient tokens,
-    // we behave like a strict priority queue among all subqueues that
-    // are eligible to run.
-    for (typename map<unsigned, SubQueue>::iterator i = queue.begin();
-	 i != queue.end();
-	 ++i) {
-      assert(!(i->second.empty()));
-      if (i->second.front().first < i->second.num_tokens()) {
-	T ret = i->second.front().second;
-	unsigned cost = i->second.front().first;
-	i->second.take_tokens(cost);
-	i->second.pop_front();
-	if (i->second.empty())
-	  remove_queue(i->first);
-	distribute_tokens(cost);
-	return ret;
-      }
+    assert(cur_queue);
+    while (cur_queue->deficit <= 0) {
+      cur_queue->deficit += queue_quantum(cur_queue->priority);
+      if (cur_queue->deficit <= 0)
+	cur_queue = cur_queue->next;
     }
-
-    // if no subqueues have sufficient tokens, we behave like a strict
-    // priority queue.
-    T ret = queue.rbegin()->second.front().second;
-    unsigned cost = queue.rbegin()->second.front().first;
-    queue.rbegin()->second.pop_front();
-    if (queue.rbegin()->second.empty())
-      remove_queue(queue.rbegin()->first);
-    distribute_tokens(cost);
+    SubQueue *sq = cur_queue;
+    T ret = sq->pop_front(sq->pick(client_quantum()), &cost, cost_fair);
+    sq->deficit -= cost;
+    if (sq->empty())
+      remove_queue(sq);
+    else if (sq->deficit <= 0)
+      cur_queue = sq->next;
     return ret;
   }
 
@@ -371,23 +435,24 @@ public:
     f->dump_int("total_priority", total_priority);
     f->dump_int("max_tokens_per_subqueue", max_tokens_per_subqueue);
     f->dump_int("min_cost", min_cost);
+    f->dump_int("cost_fair", cost_fair);
     f->open_array_section("high_queues");
-    for (typename map<unsigned, SubQueue>::const_iterator p = high_queue.begin();
-	 p != high_queue.end();
-	 ++p) {
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      if (!high_queue[i] || high_queue[i]->empty())
+	continue;
       f->open_object_section("subqueue");
-      f->dump_int("priority", p->first);
-      p->second.dump(f);
+      f->dump_int("priority", i);
+      high_queue[i]->dump(f);
       f->close_section();
     }
     f->close_section();
     f->open_array_section("queues");
-    for (typename map<unsigned, SubQueue>::const_iterator p = queue.begin();
-	 p != queue.end();
-	 ++p) {
+    for (unsigned i = 0; i < NUM_PRIORITIES; ++i) {
+      if (!queue[i] || queue[i]->empty())
+	continue;
       f->open_object_section("subqueue");
-      f->dump_int("priority", p->first);
-      p->second.dump(f);
+      f->dump_int("priority", i);
+      queue[i]->dump(f);
       f->close_section();
     }
     f->close_section();
@@ -0,0 +1,303 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "Cond.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "WheelTimer.h"
+
+#include "common/config.h"
+#include "include/Context.h"
+
+#define dout_subsys ceph_subsys_timer
+#undef dout_prefix
+#define dout_prefix *_dout << "wheeltimer(" << this << ")."
+
+
+class WheelTimerThread : public Thread {
+  WheelTimer *parent;
+public:
+  WheelTimerThread(WheelTimer *s) : parent(s) {}
+  void *entry() {
+    parent->timer_thread();
+    return NULL;
+  }
+};
+
+
+WheelTimer::WheelTimer(CephContext *cct_, Mutex &l, bool safe_callbacks,
+		       double tick)
+  : cct(cct_), lock(l),
+    safe_callbacks(safe_callbacks),
+    thread(NULL),
+    base(ceph_clock_now(cct)),
+    tick_ns(MAX((uint64_t)(tick * 1000000000.0), 1)),
+    cur_tick(0),
+    wakeup_tick((uint64_t)-1),
+    stopping(false)
+{
+  memset(level0_bits, 0, sizeof(level0_bits));
+}
+
+WheelTimer::~WheelTimer()
+{
+  assert(thread == NULL);
+}
+
+void WheelTimer::init()
+{
+  ldout(cct,10) << "init" << dendl;
+  thread = new WheelTimerThread(this);
+  thread->create();
+}
+
+void WheelTimer::shutdown()
+{
+  ldout(cct,10) << "shutdown" << dendl;
+  if (thread) {
+    assert(lock.is_locked());
+    cancel_all_events();
+    stopping = true;
+    cond.Signal();
+    lock.Unlock();
+    thread->join();
+    lock.Lock();
+    delete thread;
+    thread = NULL;
+  }
+}
+
+uint64_t WheelTimer::time_to_tick(utime_t t, bool round_up) const
+{
+  if (t <= base)
+    return 0;
+  utime_t d = t;
+  d -= base;
+  uint64_t ns = d.to_nsec();
+  if (round_up)
+    ns += tick_ns - 1;
+  return ns / tick_ns;
+}
+
+utime_t WheelTimer::tick_to_time(uint64_t tick) const
+{
+  uint64_t ns = tick * tick_ns;
+  utime_t t = base;
+  t += utime_t(ns / 1000000000ull, ns % 1000000000ull);
+  return t;
+}
+
+void WheelTimer::_link(Event *e)
+{
+  if (e->expire < cur_tick)
+    e->expire = cur_tick;
+  uint64_t delta = e->expire - cur_tick;
+  uint64_t t = e->expire;
+  unsigned level = 0;
+  while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1))))
+    level++;
+  if (delta >= (1ull << (SLOT_BITS * LEVELS))) {
+    // beyond the top level; park it in its last slot, and cascading will
+    // find it a place again
+    t = cur_tick + (1ull << (SLOT_BITS * LEVELS)) - 1;
+  }
+  e->level = level;
+  e->slot = (t >> (SLOT_BITS * level)) & SLOT_MASK;
+
+  Slot& s = wheel[level][e->slot];
+  e->next = NULL;
+  e->prev = s.tail;
+  if (s.tail)
+    s.tail->next = e;
+  else
+    s.head = e;
+  s.tail = e;
+  if (level == 0)
+    level0_bits[e->slot / 64] |= 1ull << (e->slot % 64);
+}
+
+void WheelTimer::_unlink(Event *e)
+{
+  Slot& s = wheel[e->level][e->slot];
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    s.head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    s.tail = e->prev;
+  if (e->level == 0 && !s.head)
+    level0_bits[e->slot / 64] &= ~(1ull << (e->slot % 64));
+}
+
+void WheelTimer::_cascade(unsigned level)
+{
+  Slot& s = wheel[level][(cur_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+  Event *e = s.head;
+  s.head = s.tail = NULL;
+  while (e) {
+    Event *next = e->next;
+    _link(e);
+    e = next;
+  }
+}
+
+void WheelTimer::_run_tick()
+{
+  unsigned idx = cur_tick & SLOT_MASK;
+  if (idx == 0) {
+    // level 0 wrapped; pull the next span down from the levels above
+    for (unsigned l = 1; l < LEVELS; ++l) {
+      _cascade(l);
+      if ((cur_tick >> (SLOT_BITS * l)) & SLOT_MASK)
+	break;
+    }
+  }
+
+  Slot& s = wheel[0][idx];
+  while (s.head) {
+    Event *e = s.head;
+    _unlink(e);
+    events.erase(e->callback);
+    Context *callback = e->callback;
+    delete e;
+    ldout(cct,10) << "timer_thread executing " << callback << dendl;
+
+    if (!safe_callbacks)
+      lock.Unlock();
+    callback->finish(0);
+    delete callback;
+    if (!safe_callbacks)
+      lock.Lock();
+  }
+  cur_tick++;
+}
+
+uint64_t WheelTimer::_next_wakeup() const
+{
+  if (events.empty())
+    return (uint64_t)-1;
+
+  // at a wrap we have to cascade before we know what's in level 0
+  unsigned idx = cur_tick & SLOT_MASK;
+  if (idx == 0)
+    return cur_tick;
+
+  // the first non-empty level 0 slot before the wheel wraps
+  uint64_t wrap = (cur_tick | SLOT_MASK) + 1;
+  while (idx < SLOTS) {
+    uint64_t word = level0_bits[idx / 64] >> (idx % 64);
+    if (word)
+      return (cur_tick - (cur_tick & SLOT_MASK)) + idx + __builtin_ctzll(word);
+    idx = (idx / 64 + 1) * 64;
+  }
+  return wrap;
+}
+
+void WheelTimer::timer_thread()
+{
+  lock.Lock();
+  ldout(cct,10) << "timer_thread starting" << dendl;
+  while (!stopping) {
+    uint64_t now_tick = time_to_tick(ceph_clock_now(cct), false);
+    if (events.empty() && cur_tick <= now_tick) {
+      // nothing to run; skip ahead
+      cur_tick = now_tick + 1;
+    }
+    while (cur_tick <= now_tick && !stopping)
+      _run_tick();
+
+    wakeup_tick = _next_wakeup();
+    ldout(cct,20) << "timer_thread going to sleep" << dendl;
+    if (wakeup_tick == (uint64_t)-1)
+      cond.Wait(lock);
+    else
+      cond.WaitUntil(lock, tick_to_time(wakeup_tick));
+    wakeup_tick = (uint64_t)-1;
+    ldout(cct,20) << "timer_thread awake" << dendl;
+  }
+  ldout(cct,10) << "timer_thread exiting" << dendl;
+  lock.Unlock();
+}
+
+void WheelTimer::add_event_after(double seconds, Context *callback)
+{
+  assert(lock.is_locked());
+
+  utime_t when = ceph_clock_now(cct);
+  when += seconds;
+  add_event_at(when, callback);
+}
+
+void WheelTimer::add_event_at(utime_t when, Context *callback)
+{
+  assert(lock.is_locked());
+  ldout(cct,10) << "add_event_at " << when << " -> " << callback << dendl;
+
+  Event *e = new Event;
+  e->expire = time_to_tick(when, true);
+  e->callback = callback;
+
+  /* If you hit this, you tried to insert the same Context* twice. */
+  /* An idle thread stops advancing cur_tick; move it up to now so the
+   * thread doesn't have to run every tick it slept through. */
+  if (events.empty()) {
+    uint64_t now_tick = time_to_tick(ceph_clock_now(cct), false);
+    if (cur_tick < now_tick)
+      cur_tick = now_tick;
+  }
+
+  bool inserted = events.insert(make_pair(callback, e)).second;
+  assert(inserted);
+
+  _link(e);
+
+  /* If the event comes before the thread means to wake, wake it now. */
+  if (e->expire < wakeup_tick)
+    cond.Signal();
+}
+
+bool WheelTimer::cancel_event(Context *callback)
+{
+  assert(lock.is_locked());
+
+  __gnu_cxx::hash_map<Context*, Event*, ptr_hash>::iterator p = events.find(callback);
+  if (p == events.end()) {
+    ldout(cct,10) << "cancel_event " << callback << " not found" << dendl;
+    return false;
+  }
+
+  Event *e = p->second;
+  ldout(cct,10) << "cancel_event " << tick_to_time(e->expire) << " -> " << callback << dendl;
+  delete callback;
+  _unlink(e);
+  delete e;
+  events.erase(p);
+  return true;
+}
+
+void WheelTimer::cancel_all_events()
+{
+  ldout(cct,10) << "cancel_all_events" << dendl;
+  assert(lock.is_locked());
+
+  while (!events.empty()) {
+    __gnu_cxx::hash_map<Context*, Event*, ptr_hash>::iterator p = events.begin();
+    Event *e = p->second;
+    ldout(cct,10) << " cancelled " << tick_to_time(e->expire) << " -> " << p->first << dendl;
+    delete p->first;
+    _unlink(e);
+    delete e;
+    events.erase(p);
+  }
+}
@@ -0,0 +1,122 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_WHEELTIMER_H
+#define CEPH_WHEELTIMER_H
+
+#include "Cond.h"
+#include "Mutex.h"
+#include "include/hash.h"
+
+#include <ext/hash_map>
+
+class CephContext;
+class Context;
+class WheelTimerThread;
+
+/*
+ * A hierarchical timing wheel with the same interface (and locking
+ * rules) as SafeTimer, for users that add and cancel many timeouts.
+ *
+ * Time is divided into ticks (1ms by default).  Level 0 has a slot
+ * for each of the next 256 ticks; each higher level has 256 slots
+ * that each cover 256 times the span of a slot on the level below,
+ * and its events are cascaded down when the lower level wraps.  Adding
+ * and cancelling an event are O(1); events fire in the first tick at
+ * or after their deadline, so never early but up to one tick late.
+ */
+class WheelTimer
+{
+  // This class isn't supposed to be copied
+  WheelTimer(const WheelTimer &rhs);
+  WheelTimer& operator=(const WheelTimer &rhs);
+
+  static const unsigned LEVELS = 4;
+  static const unsigned SLOT_BITS = 8;
+  static const unsigned SLOTS = 1 << SLOT_BITS;
+  static const unsigned SLOT_MASK = SLOTS - 1;
+
+  struct Event {
+    uint64_t expire;        ///< tick this fires in
+    Context *callback;
+    Event *prev, *next;     ///< slot list
+    unsigned level, slot;
+  };
+
+  struct Slot {
+    Event *head, *tail;
+    Slot() : head(NULL), tail(NULL) {}
+  };
+
+  struct ptr_hash {
+    size_t operator()(const Context *p) const {
+      return rjhash64((uint64_t)(uintptr_t)p);
+    }
+  };
+
+  CephContext *cct;
+  Mutex& lock;
+  Cond cond;
+  bool safe_callbacks;
+
+  friend class WheelTimerThread;
+  WheelTimerThread *thread;
+
+  utime_t base;             ///< time of tick 0
+  uint64_t tick_ns;
+  uint64_t cur_tick;        ///< next tick to run
+  uint64_t wakeup_tick;     ///< tick the thread is sleeping until
+  Slot wheel[LEVELS][SLOTS];
+  uint64_t level0_bits[SLOTS / 64];  ///< non-empty level 0 slots
+  __gnu_cxx::hash_map<Context*, Event*, ptr_hash> events;
+  bool stopping;
+
+  uint64_t time_to_tick(utime_t t, bool round_up) const;
+  utime_t tick_to_time(uint64_t tick) const;
+
+  void _link(Event *e);
+  void _unlink(Event *e);
+  void _cascade(unsigned level);
+  void _run_tick();
+  uint64_t _next_wakeup() const;
+
+  void timer_thread();
+
+public:
+  /* safe_callbacks works as it does for SafeTimer.  tick is the
+   * resolution in seconds. */
+  WheelTimer(CephContext *cct, Mutex &l, bool safe_callbacks=true,
+	     double tick=0.001);
+  ~WheelTimer();
+
+  /* Call with the event_lock UNLOCKED.  See SafeTimer. */
+  void init();
+  void shutdown();
+
+  /* Schedule an event in the future
+   * Call with the event_lock LOCKED */
+  void add_event_after(double seconds, Context *callback);
+  void add_event_at(utime_t when, Context *callback);
+
+  /* Cancel an event.
+   * Call with the event_lock LOCKED
+   *
+   * Returns true if the callback was cancelled.
+   * Returns false if you never addded the callback in the first place.
+   */
+  bool cancel_event(Context *callback);
+
+  /* Cancel all events.
+   * Call with the event_lock LOCKED */
+  void cancel_all_events();
+};
+#endif
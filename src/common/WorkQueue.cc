@@ -248,3 +248,252 @@ void ThreadPool::drain(WorkQueue_* wq)
   _lock.Unlock();
 }
 
+
+
+WorkStealingThreadPool::WorkStealingThreadPool(CephContext *cct_, string nm, int n)
+  : cct(cct_), name(nm),
+    lockname(nm + "::lock"),
+    _lock(lockname.c_str()),  // this should be safe due to declaration order
+    _stop(false),
+    _pause(0),
+    _draining(0),
+    _idle_lock("WorkStealingThreadPool::_idle_lock")
+{
+  assert(n > 0);
+  // create the deques now so that we can queue before start()
+  for (int i = 0; i < n; i++)
+    _threads.push_back(new WorkThread(this, i));
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool()
+{
+  for (unsigned i = 0; i < _threads.size(); i++) {
+    assert(_threads[i]->q.empty());
+    delete _threads[i];
+  }
+}
+
+// the worker index of the calling thread, if it is one of our workers
+static __thread WorkStealingThreadPool *tls_ws_pool = NULL;
+static __thread unsigned tls_ws_index = 0;
+
+void WorkStealingThreadPool::_queue(WorkQueue_ *wq, void *item)
+{
+  WorkThread *wt;
+  if (tls_ws_pool == this)
+    wt = _threads[tls_ws_index];
+  else
+    wt = _threads[_next.inc() % _threads.size()];
+
+  wt->lock.Lock();
+  wt->q.push_back(Item(wq, item));
+  wt->len.inc();
+  wq->queued.inc();
+  _queued.inc();
+  wt->lock.Unlock();
+
+  // pairs with the barrier in worker() before it goes to sleep: either
+  // it sees the item, or we see it in _num_idle.
+  __sync_synchronize();
+  if (_num_idle.read())
+    _wake_idle(wt, false);
+}
+
+bool WorkStealingThreadPool::_pop(WorkThread *wt, Item *out)
+{
+  // our own work, oldest first
+  if (wt->len.read()) {
+    Mutex::Locker l(wt->lock);
+    if (!wt->q.empty()) {
+      *out = wt->q.front();
+      wt->q.pop_front();
+      wt->len.dec();
+      return true;
+    }
+  }
+
+  // steal the newest item of the next worker that has any
+  unsigned n = _threads.size();
+  for (unsigned i = 1; i < n; i++) {
+    WorkThread *victim = _threads[(wt->index + i) % n];
+    if (!victim->len.read())
+      continue;
+    Mutex::Locker l(victim->lock);
+    if (!victim->q.empty()) {
+      *out = victim->q.back();
+      victim->q.pop_back();
+      victim->len.dec();
+      ldout(cct,20) << "worker " << wt->index << " stole " << out->item
+		    << " from worker " << victim->index << dendl;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingThreadPool::_wake_idle(WorkThread *preferred, bool all)
+{
+  Mutex::Locker l(_idle_lock);
+  while (!_idle.empty()) {
+    WorkThread *wt;
+    if (preferred && preferred->idle) {
+      wt = preferred;
+      _idle.remove(wt);
+    } else {
+      wt = _idle.front();
+      _idle.pop_front();
+    }
+    wt->idle = false;
+    wt->cond.Signal();
+    if (!all)
+      break;
+  }
+}
+
+void WorkStealingThreadPool::_signal_waiters()
+{
+  Mutex::Locker l(_lock);
+  _wait_cond.SignalAll();
+}
+
+void WorkStealingThreadPool::worker(WorkThread *wt)
+{
+  ldout(cct,10) << "worker " << wt->index << " start" << dendl;
+  tls_ws_pool = this;
+  tls_ws_index = wt->index;
+
+  std::stringstream ss;
+  ss << name << " thread " << (void*)pthread_self();
+  heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
+
+  while (!_stop) {
+    // count ourselves as processing before looking at _pause, so that
+    // pause() either sees us or we see it.
+    _processing.inc();
+    __sync_synchronize();
+    Item it;
+    if (!_pause && _pop(wt, &it)) {
+      _queued.dec();
+      it.wq->queued.dec();
+      ldout(cct,12) << "worker " << wt->index << " wq " << it.wq->name
+		    << " start processing " << it.item << dendl;
+      ThreadPool::TPHandle tp_handle(cct, hb, it.wq->timeout_interval,
+				     it.wq->suicide_interval);
+      tp_handle.reset_tp_timeout();
+      it.wq->_void_process(it.item, tp_handle);
+      it.wq->_void_process_finish(it.item);
+      ldout(cct,15) << "worker " << wt->index << " wq " << it.wq->name
+		    << " done processing " << it.item << dendl;
+      _processing.dec();
+      __sync_synchronize();
+      if (_pause || _draining)
+	_signal_waiters();
+      continue;
+    }
+    _processing.dec();
+    __sync_synchronize();
+    if (_pause || _draining)
+      _signal_waiters();
+
+    _idle_lock.Lock();
+    if (_stop) {
+      _idle_lock.Unlock();
+      break;
+    }
+    _num_idle.inc();
+    // pairs with the barrier in _queue()
+    __sync_synchronize();
+    if (_pause || _queued.read() == 0) {
+      ldout(cct,20) << "worker " << wt->index << " waiting" << dendl;
+      wt->idle = true;
+      _idle.push_back(wt);
+      cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
+      wt->cond.WaitInterval(cct, _idle_lock, utime_t(2, 0));
+      if (wt->idle) {
+	// timed out
+	_idle.remove(wt);
+	wt->idle = false;
+      }
+    }
+    _num_idle.dec();
+    _idle_lock.Unlock();
+  }
+  ldout(cct,1) << "worker " << wt->index << " finish" << dendl;
+
+  cct->get_heartbeat_map()->remove_worker(hb);
+  tls_ws_pool = NULL;
+}
+
+void WorkStealingThreadPool::start()
+{
+  ldout(cct,10) << "start" << dendl;
+  for (unsigned i = 0; i < _threads.size(); i++)
+    _threads[i]->create();
+  ldout(cct,15) << "started" << dendl;
+}
+
+void WorkStealingThreadPool::stop()
+{
+  ldout(cct,10) << "stop" << dendl;
+  _idle_lock.Lock();
+  _stop = true;
+  _idle_lock.Unlock();
+  _wake_idle(NULL, true);
+  for (unsigned i = 0; i < _threads.size(); i++)
+    _threads[i]->join();
+
+  for (unsigned i = 0; i < _threads.size(); i++) {
+    WorkThread *wt = _threads[i];
+    while (!wt->q.empty()) {
+      Item it = wt->q.front();
+      wt->q.pop_front();
+      wt->len.dec();
+      _queued.dec();
+      it.wq->queued.dec();
+      it.wq->_void_discard(it.item);
+    }
+  }
+  ldout(cct,15) << "stopped" << dendl;
+}
+
+void WorkStealingThreadPool::pause()
+{
+  ldout(cct,10) << "pause" << dendl;
+  _lock.Lock();
+  _pause++;
+  __sync_synchronize();
+  while (_processing.read())
+    _wait_cond.WaitInterval(cct, _lock, utime_t(1, 0));
+  _lock.Unlock();
+  ldout(cct,15) << "paused" << dendl;
+}
+
+void WorkStealingThreadPool::pause_new()
+{
+  ldout(cct,10) << "pause_new" << dendl;
+  _lock.Lock();
+  _pause++;
+  _lock.Unlock();
+}
+
+void WorkStealingThreadPool::unpause()
+{
+  ldout(cct,10) << "unpause" << dendl;
+  _lock.Lock();
+  assert(_pause > 0);
+  _pause--;
+  _lock.Unlock();
+  _wake_idle(NULL, true);
+}
+
+void WorkStealingThreadPool::drain(WorkQueue_* wq)
+{
+  ldout(cct,10) << "drain" << dendl;
+  _lock.Lock();
+  _draining++;
+  __sync_synchronize();
+  while (_processing.read() || (wq ? wq->queued.read() : _queued.read()))
+    _wait_cond.WaitInterval(cct, _lock, utime_t(1, 0));
+  _draining--;
+  _lock.Unlock();
+}
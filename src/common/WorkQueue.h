@@ -20,6 +20,9 @@
 #include "Thread.h"
 #include "common/config_obs.h"
 #include "common/HeartbeatMap.h"
+#include "include/atomic.h"
+
+#include <deque>
 
 class CephContext;
 
@@ -37,6 +40,7 @@ class ThreadPool : public md_config_obs_t {
 public:
   class TPHandle {
     friend class ThreadPool;
+    friend class WorkStealingThreadPool;
     CephContext *cct;
     heartbeat_handle_d *hb;
     time_t grace;
@@ -389,6 +393,136 @@ public:
   void drain(WorkQueue_* wq = 0);
 };
 
+/*
+ * A thread pool for work queues that don't need a global order, e.g.
+ * because items serialize themselves (OpSequencers) or are independent.
+ *
+ * Each worker has its own deque.  queue() from one of our workers goes
+ * onto that worker's deque, other callers spread items round-robin, and
+ * a worker that runs dry steals from the back of another's deque.  The
+ * queue/dequeue path takes only per-worker locks; the shared idle list
+ * is only touched when some worker is idle.
+ *
+ * Unlike ThreadPool, the pool owns the queued items: work queues just
+ * process them, and anything still queued at stop() is discarded.
+ */
+class WorkStealingThreadPool {
+  CephContext *cct;
+  string name;
+  string lockname;
+  Mutex _lock;        ///< protects _pause and _draining
+  Cond _wait_cond;
+  bool _stop;
+  int _pause;
+  int _draining;
+
+public:
+  struct WorkQueue_ {
+    string name;
+    time_t timeout_interval, suicide_interval;
+    atomic_t queued;  ///< items of ours sitting on worker deques
+    WorkQueue_(string n, time_t ti, time_t sti)
+      : name(n), timeout_interval(ti), suicide_interval(sti)
+    { }
+    virtual ~WorkQueue_() {}
+    virtual void _void_process(void *item, ThreadPool::TPHandle &handle) = 0;
+    virtual void _void_process_finish(void *item) = 0;
+    virtual void _void_discard(void *item) = 0;
+  };
+
+  template<class T>
+  class WorkQueue : public WorkQueue_ {
+    WorkStealingThreadPool *pool;
+
+    virtual void _process(T *t, ThreadPool::TPHandle &handle) = 0;
+    virtual void _process_finish(T *) {}
+    /// called for items still queued when the pool stops
+    virtual void _discard(T *) {}
+
+    void _void_process(void *p, ThreadPool::TPHandle &handle) {
+      _process((T *)p, handle);
+    }
+    void _void_process_finish(void *p) {
+      _process_finish((T *)p);
+    }
+    void _void_discard(void *p) {
+      _discard((T *)p);
+    }
+
+  public:
+    WorkQueue(string n, time_t ti, time_t sti, WorkStealingThreadPool *p)
+      : WorkQueue_(n, ti, sti), pool(p) {}
+
+    void queue(T *item) {
+      pool->_queue(this, item);
+    }
+    void drain() {
+      pool->drain(this);
+    }
+  };
+
+private:
+  struct Item {
+    WorkQueue_ *wq;
+    void *item;
+    Item() : wq(NULL), item(NULL) {}
+    Item(WorkQueue_ *w, void *i) : wq(w), item(i) {}
+  };
+
+  struct WorkThread : public Thread {
+    WorkStealingThreadPool *pool;
+    unsigned index;
+    Mutex lock;          ///< protects q
+    std::deque<Item> q;
+    atomic_t len;        ///< q.size(), for thieves to peek at
+    Cond cond;           ///< idle wait, under pool->_idle_lock
+    bool idle;           ///< on pool->_idle
+    WorkThread(WorkStealingThreadPool *p, unsigned i)
+      : pool(p), index(i), lock("WorkStealingThreadPool::WorkThread::lock"),
+	idle(false) {}
+    void *entry() {
+      pool->worker(this);
+      return 0;
+    }
+  };
+
+  vector<WorkThread*> _threads;
+  atomic_t _next;        ///< round-robin target for callers outside the pool
+  atomic_t _queued;      ///< items on all deques
+  atomic_t _processing;  ///< workers holding (or about to take) an item
+  Mutex _idle_lock;      ///< protects _idle and WorkThread::idle
+  list<WorkThread*> _idle;
+  atomic_t _num_idle;
+
+  void _queue(WorkQueue_ *wq, void *item);
+  bool _pop(WorkThread *wt, Item *out);
+  void _wake_idle(WorkThread *preferred, bool all);
+  void _signal_waiters();
+  void worker(WorkThread *wt);
+
+public:
+  WorkStealingThreadPool(CephContext *cct_, string nm, int n);
+  ~WorkStealingThreadPool();
+
+  /// return number of threads
+  int get_num_threads() const {
+    return _threads.size();
+  }
+
+  /// start thread pool threads
+  void start();
+  /// stop thread pool threads, discarding anything still queued
+  void stop();
+  /// pause thread pool (if it not already paused)
+  void pause();
+  /// pause initiation of new work
+  void pause_new();
+  /// resume work in thread pool.  must match each pause() call 1:1 to resume.
+  void unpause();
+  /// wait for everything queued (to wq, or to any queue) to complete
+  void drain(WorkQueue_* wq = 0);
+};
+
 
 
 #endif
@@ -18,6 +18,7 @@
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/simple_spin.h"
+#include "common/mempool.h"
 #include "include/atomic.h"
 #include "include/types.h"
 #include "include/compat.h"
@@ -27,6 +28,7 @@
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
+#include <new>
 
 namespace ceph {
 
@@ -66,6 +68,8 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     { }
     virtual ~raw() {};
 
+    MEMPOOL_CLASS_HELPERS()
+
     // no copying.
     raw(const raw &other);
     const raw& operator=(const raw &other);
@@ -85,6 +89,8 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     }
   };
 
+  MEMPOOL_DEFINE_OBJECT_FACTORY(buffer::raw, buffer_meta)
+
   class buffer::raw_malloc : public buffer::raw {
   public:
     raw_malloc(unsigned l) : raw(l) {
@@ -96,15 +102,18 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 	data = 0;
       }
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, len, 1);
       bdout << "raw_malloc " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     raw_malloc(unsigned l, char *b) : raw(b, l) {
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, len, 1);
       bdout << "raw_malloc " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_malloc() {
       free(data);
       dec_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, -(int64_t)len, -1);
       bdout << "raw_malloc " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
     raw* clone_empty() {
@@ -120,11 +129,13 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
       if (!data)
 	throw bad_alloc();
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_aligned, len, 1);
       bdout << "raw_mmap " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_mmap_pages() {
       ::munmap(data, len);
       dec_total_alloc(len);
+      mempool::adjust(mempool::buffer_aligned, -(int64_t)len, -1);
       bdout << "raw_mmap " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
     raw* clone_empty() {
@@ -146,11 +157,13 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
       if (!data)
 	throw bad_alloc();
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_aligned, len, 1);
       bdout << "raw_posix_aligned " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_posix_aligned() {
       ::free((void*)data);
       dec_total_alloc(len);
+      mempool::adjust(mempool::buffer_aligned, -(int64_t)len, -1);
       bdout << "raw_posix_aligned " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
     raw* clone_empty() {
@@ -171,6 +184,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
       else
 	data = realdata;
       inc_total_alloc(len+CEPH_PAGE_SIZE-1);
+      mempool::adjust(mempool::buffer_aligned, len+CEPH_PAGE_SIZE-1, 1);
       //cout << "hack aligned " << (unsigned)data
       //<< " in raw " << (unsigned)realdata
       //<< " off " << off << std::endl;
@@ -179,6 +193,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     ~raw_hack_aligned() {
       delete[] realdata;
       dec_total_alloc(len+CEPH_PAGE_SIZE-1);
+      mempool::adjust(mempool::buffer_aligned, -(int64_t)(len+CEPH_PAGE_SIZE-1), -1);
     }
     raw* clone_empty() {
       return new raw_hack_aligned(len);
@@ -197,15 +212,18 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
       else
 	data = 0;
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, len, 1);
       bdout << "raw_char " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     raw_char(unsigned l, char *b) : raw(b, l) {
       inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, len, 1);
       bdout << "raw_char " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
     }
     ~raw_char() {
       delete[] data;
       dec_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, -(int64_t)len, -1);
       bdout << "raw_char " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
     }
     raw* clone_empty() {
@@ -213,6 +231,37 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     }
   };
 
+  /*
+   * data allocated along with the raw itself, so a buffer takes one
+   * allocation instead of two.
+   */
+  class buffer::raw_combined : public buffer::raw {
+    raw_combined(unsigned l) : raw((char *)this + header_len(), l) {
+      inc_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, len, 1);
+      bdout << "raw_combined " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
+    }
+  public:
+    // keep data as aligned as malloc would
+    static size_t header_len() {
+      return (sizeof(raw_combined) + 15) & ~15;
+    }
+    static raw_combined *create(unsigned len) {
+      void *p = ::operator new(header_len() + len);
+      // raw::operator delete un-accounts us when we're deleted
+      mempool::adjust(mempool::buffer_meta, sizeof(raw_combined), 1);
+      return ::new (p) raw_combined(len);
+    }
+    ~raw_combined() {
+      dec_total_alloc(len);
+      mempool::adjust(mempool::buffer_anon, -(int64_t)len, -1);
+      bdout << "raw_combined " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    raw* clone_empty() {
+      return create(len);
+    }
+  };
+
   class buffer::raw_static : public buffer::raw {
   public:
     raw_static(const char *d, unsigned l) : raw((char*)d, l) { }
@@ -223,12 +272,12 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   };
 
   buffer::raw* buffer::copy(const char *c, unsigned len) {
-    raw* r = new raw_char(len);
+    raw* r = raw_combined::create(len);
     memcpy(r->data, c, len);
     return r;
   }
   buffer::raw* buffer::create(unsigned len) {
-    return new raw_char(len);
+    return raw_combined::create(len);
   }
   buffer::raw* buffer::claim_char(unsigned len, char *buf) {
     return new raw_char(len, buf);
@@ -618,7 +667,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     if (p == ls->end())
       seek(off);
     unsigned left = len;
-    for (std::list<ptr>::const_iterator i = otherl._buffers.begin();
+    for (buffers_t::const_iterator i = otherl._buffers.begin();
 	 i != otherl._buffers.end();
 	 i++) {
       unsigned l = (*i).length();
@@ -651,8 +700,8 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
     // buffer-wise comparison
     if (true) {
-      std::list<ptr>::const_iterator a = _buffers.begin();
-      std::list<ptr>::const_iterator b = other._buffers.begin();
+      buffers_t::const_iterator a = _buffers.begin();
+      buffers_t::const_iterator b = other._buffers.begin();
       unsigned aoff = 0, boff = 0;
       while (a != _buffers.end()) {
 	unsigned len = a->length() - aoff;
@@ -691,7 +740,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
   bool buffer::list::is_page_aligned() const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++) 
       if (!it->is_page_aligned())
@@ -701,7 +750,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
   bool buffer::list::is_n_page_sized() const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++) 
       if (!it->is_n_page_sized())
@@ -710,7 +759,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   }
 
   bool buffer::list::is_zero() const {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++) {
       if (!it->is_zero()) {
@@ -722,7 +771,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
   void buffer::list::zero()
   {
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++)
       it->zero();
@@ -732,7 +781,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(o+l <= _len);
     unsigned p = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++) {
       if (p + it->length() > o) {
@@ -751,7 +800,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   
   bool buffer::list::is_contiguous()
   {
-    return &(*_buffers.begin()) == &(*_buffers.rbegin());
+    return _buffers.size() <= 1;
   }
 
   void buffer::list::rebuild()
@@ -762,7 +811,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     else
       nb = buffer::create(_len);
     unsigned pos = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 it++) {
       nb.copy_in(pos, it->length(), it->c_str());
@@ -774,7 +823,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
 void buffer::list::rebuild_page_aligned()
 {
-  std::list<ptr>::iterator p = _buffers.begin();
+  buffers_t::iterator p = _buffers.begin();
   while (p != _buffers.end()) {
     // keep anything that's already page sized+aligned
     if (p->is_page_aligned() && p->is_n_page_sized()) {
@@ -877,16 +926,25 @@ void buffer::list::rebuild_page_aligned()
     last_p.copy_in(len, src);
   }
 
+  void buffer::list::_new_append_buffer(unsigned len)
+  {
+    if (_len + len <= CEPH_BUFFER_APPEND_SMALL) {
+      // a small list (a message front, an encoded key): don't tie up a
+      // page, or pay for a separate raw
+      append_buffer = create(CEPH_BUFFER_APPEND_SMALL);
+    } else {
+      unsigned alen = CEPH_PAGE_SIZE * (((len-1) / CEPH_PAGE_SIZE) + 1);
+      append_buffer = create_page_aligned(alen);
+    }
+    append_buffer.set_length(0);   // unused, so far.
+  }
+
   void buffer::list::append(char c)
   {
     // put what we can into the existing append_buffer.
     unsigned gap = append_buffer.unused_tail_length();
-    if (!gap) {
-      // make a new append_buffer!
-      unsigned alen = CEPH_PAGE_SIZE;
-      append_buffer = create_page_aligned(alen);
-      append_buffer.set_length(0);   // unused, so far.
-    }
+    if (!gap)
+      _new_append_buffer(1);
     append_buffer.append(c);
     append(append_buffer, append_buffer.end() - 1, 1);	// add segment to the list
   }
@@ -907,10 +965,7 @@ void buffer::list::rebuild_page_aligned()
       if (len == 0)
 	break;  // done!
       
-      // make a new append_buffer!
-      unsigned alen = CEPH_PAGE_SIZE * (((len-1) / CEPH_PAGE_SIZE) + 1);
-      append_buffer = create_page_aligned(alen);
-      append_buffer.set_length(0);   // unused, so far.
+      _new_append_buffer(len);
     }
   }
 
@@ -941,7 +996,7 @@ void buffer::list::rebuild_page_aligned()
   void buffer::list::append(const list& bl)
   {
     _len += bl._len;
-    for (std::list<ptr>::const_iterator p = bl._buffers.begin();
+    for (buffers_t::const_iterator p = bl._buffers.begin();
 	 p != bl._buffers.end();
 	 ++p) 
       _buffers.push_back(*p);
@@ -973,7 +1028,7 @@ void buffer::list::rebuild_page_aligned()
     if (n >= _len)
       throw end_of_buffer();
     
-    for (std::list<ptr>::const_iterator p = _buffers.begin();
+    for (buffers_t::const_iterator p = _buffers.begin();
 	 p != _buffers.end();
 	 p++) {
       if (n >= p->length()) {
@@ -1006,7 +1061,7 @@ void buffer::list::rebuild_page_aligned()
     clear();
       
     // skip off
-    std::list<ptr>::const_iterator curbuf = other._buffers.begin();
+    buffers_t::const_iterator curbuf = other._buffers.begin();
     while (off > 0 &&
 	   off >= curbuf->length()) {
       // skip this buffer
@@ -1046,7 +1101,7 @@ void buffer::list::rebuild_page_aligned()
     //cout << "splice off " << off << " len " << len << " ... mylen = " << length() << std::endl;
       
     // skip off
-    std::list<ptr>::iterator curbuf = _buffers.begin();
+    buffers_t::iterator curbuf = _buffers.begin();
     while (off > 0) {
       assert(curbuf != _buffers.end());
       if (off >= (*curbuf).length()) {
@@ -1102,7 +1157,7 @@ void buffer::list::rebuild_page_aligned()
   {
     list s;
     s.substr_of(*this, off, len);
-    for (std::list<ptr>::const_iterator it = s._buffers.begin(); 
+    for (buffers_t::const_iterator it = s._buffers.begin(); 
 	 it != s._buffers.end(); 
 	 it++)
       if (it->length())
@@ -1222,7 +1277,7 @@ int buffer::list::write_fd(int fd) const
   int iovlen = 0;
   ssize_t bytes = 0;
 
-  std::list<ptr>::const_iterator p = _buffers.begin(); 
+  buffers_t::const_iterator p = _buffers.begin(); 
   while (p != _buffers.end()) {
     if (p->length() > 0) {
       iov[iovlen].iov_base = (void *)p->c_str();
@@ -24,6 +24,7 @@
 #include "common/errno.h"
 #include "common/lockdep.h"
 #include "common/Formatter.h"
+#include "common/mempool.h"
 #include "log/Log.h"
 #include "auth/Crypto.h"
 
@@ -207,6 +208,9 @@ void CephContext::do_command(std::string command, std::string args, bufferlist *
     else if (command == "log reopen") {
       _log->reopen_log_file();
     }
+    else if (command == "dump_mempools") {
+      mempool::dump(&jf);
+    }
     else {
       assert(0 == "registered under wrong command?");    
     }
@@ -257,6 +261,7 @@ CephContext::CephContext(uint32_t module_type_)
   _admin_socket->register_command("log flush", _admin_hook, "flush log entries to log file");
   _admin_socket->register_command("log dump", _admin_hook, "dump recent log entries to log file");
   _admin_socket->register_command("log reopen", _admin_hook, "reopen log file");
+  _admin_socket->register_command("dump_mempools", _admin_hook, "dump memory pool usage");
 
   _crypto_none = new CryptoNone;
   _crypto_aes = new CryptoAES;
@@ -281,6 +286,7 @@ CephContext::~CephContext()
   _admin_socket->unregister_command("log flush");
   _admin_socket->unregister_command("log dump");
   _admin_socket->unregister_command("log reopen");
+  _admin_socket->unregister_command("dump_mempools");
   delete _admin_hook;
   delete _admin_socket;
 
@@ -108,11 +108,14 @@ OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_pq_max_tokens_per_priority, OPT_U64, 4194304)
 OPTION(ms_pq_min_cost, OPT_U64, 65536)
+OPTION(ms_pq_cost_fair, OPT_BOOL, true)   // share each priority among senders by cost, not message count
+OPTION(ms_writer_batch_bytes, OPT_U64, 65536) // coalesce queued messages up to this many bytes into one sendmsg (0 = one message per sendmsg)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
 OPTION(ms_inject_delay_type, OPT_STR, "")          // "osd mds mon client" allowed
 OPTION(ms_inject_delay_max, OPT_DOUBLE, 1)         // seconds
 OPTION(ms_inject_delay_probability, OPT_DOUBLE, 0) // range [0, 1]
 OPTION(ms_inject_internal_delays, OPT_DOUBLE, 0)   // seconds
+OPTION(ms_inprocess_delivery, OPT_BOOL, false)   // hand Messages to other SimpleMessengers in this process without encoding them
 
 OPTION(mon_data, OPT_STR, "/var/lib/ceph/mon/$cluster-$id")
 OPTION(mon_initial_members, OPT_STR, "")    // list of initial cluster mon ids; if specified, need majority to form initial quorum and create new cluster
@@ -146,9 +149,13 @@ OPTION(mon_globalid_prealloc, OPT_INT, 100)   // how many globalids to prealloc
 OPTION(mon_osd_report_timeout, OPT_INT, 900)    // grace period before declaring unresponsive OSDs dead
 OPTION(mon_force_standby_active, OPT_BOOL, true) // should mons force standby-replay mds to be active
 OPTION(mon_min_osdmap_epochs, OPT_INT, 500)
+OPTION(mon_osdmap_full_interval, OPT_INT, 1)  // store a full osdmap every N epochs; rebuild the others from incrementals
 OPTION(mon_max_pgmap_epochs, OPT_INT, 500)
 OPTION(mon_max_log_epochs, OPT_INT, 500)
 OPTION(mon_max_osd, OPT_INT, 10000)
+OPTION(mon_reweight_max_deviation, OPT_DOUBLE, .05) // reweight-by-pg: reweight osds whose pg count is off by more than this fraction
+OPTION(mon_reweight_max_change, OPT_DOUBLE, .05)    // reweight-by-pg: most an osd's weight changes in one round
+OPTION(mon_reweight_max_pgs, OPT_INT, 256)          // reweight-by-pg: most pgs to move in one round (0 = no limit)
 OPTION(mon_probe_timeout, OPT_DOUBLE, 2.0)
 OPTION(mon_slurp_timeout, OPT_DOUBLE, 10.0)
 OPTION(mon_slurp_bytes, OPT_INT, 256*1024)    // limit size of slurp messages
@@ -319,9 +326,11 @@ OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_map_full_interval, OPT_INT, 1)  // store a full map every N epochs; rebuild the others from incrementals
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
 OPTION(osd_op_pq_max_tokens_per_priority, OPT_U64, 4194304)
 OPTION(osd_op_pq_min_cost, OPT_U64, 65536)
+OPTION(osd_op_pq_cost_fair, OPT_BOOL, true)  // share each priority among clients by cost, not op count
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
@@ -423,6 +432,7 @@ OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
+OPTION(filestore_finisher_threads, OPT_INT, 1)  // ondisk/apply completion threads; ordered per OpSequencer
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
@@ -39,12 +39,20 @@ inline std::ostream& operator<<(std::ostream& out, _bad_endl_use_dendl_t) {
   return out;
 }
 
+// Levels above CEPH_DOUT_MAX_LEVEL are compiled out: the level is a
+// constant at nearly every call site, so the whole statement folds
+// away.  Set it with ./configure --with-debug-level-max=N.
+#ifndef CEPH_DOUT_MAX_LEVEL
+# define CEPH_DOUT_MAX_LEVEL 200
+#endif
+
 // generic macros
 #define dout_prefix *_dout
 
 #define dout_impl(cct, sub, v)						\
   do {									\
-  if (cct->_conf->subsys.should_gather(sub, v)) {			\
+  if ((v) <= CEPH_DOUT_MAX_LEVEL &&					\
+      cct->_conf->subsys.should_gather(sub, v)) {			\
     if (0) {								\
       char __array[((v >= -1) && (v <= 200)) ? 0 : -1] __attribute__((unused)); \
     }									\
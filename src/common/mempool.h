@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MEMPOOL_H
+#define CEPH_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Memory pools: per-process counters of the items and bytes held by
+ * the big consumers, so that 'dump_mempools' on the admin socket can
+ * say where the memory went.
+ *
+ * Accounting is two atomic adds to one of a few cache-line sized
+ * shards, picked by thread, so concurrent threads rarely share a line.
+ * Bytes are those the accounted object itself occupies, not memory it
+ * points to (a pg_log entry's snaps, an OSDMap's maps), except for
+ * buffers, where they are the data bytes.
+ *
+ * A class is accounted by declaring MEMPOOL_CLASS_HELPERS() in it and
+ * putting MEMPOOL_DEFINE_OBJECT_FACTORY(Class, pool) in its .cc file,
+ * which counts instances allocated with new; mempool::counter<> does
+ * the same for objects held by value, e.g. in a std::list.
+ */
+namespace mempool {
+
+enum pool_index_t {
+  buffer_anon,       ///< heap bufferptr data (buffer::create, claim_malloc, ...)
+  buffer_aligned,    ///< page aligned bufferptr data
+  buffer_meta,       ///< buffer::raw objects
+  osd_pglog,         ///< pg_log_entry_t
+  osdmap,            ///< OSDMap instances and their cached pg mappings
+  mds_co,            ///< MDS cache objects: CInode, CDentry, CDir
+  objectcacher_bh,   ///< ObjectCacher::BufferHead
+  num_pools
+};
+
+const char *get_pool_name(pool_index_t ix);
+
+static const unsigned num_shards = 32;
+
+struct shard_t {
+  int64_t bytes;
+  int64_t items;
+  char __pad[64 - 2 * sizeof(int64_t)];
+} __attribute__ ((aligned (64)));
+
+struct pool_t {
+  shard_t shard[num_shards];
+
+  int64_t allocated_bytes() const;
+  int64_t allocated_items() const;
+};
+
+extern pool_t pools[num_pools];
+
+inline void adjust(pool_index_t ix, int64_t bytes, int64_t items) {
+  shard_t &s = pools[ix].shard[((size_t)pthread_self() >> 12) % num_shards];
+  __sync_fetch_and_add(&s.bytes, bytes);
+  __sync_fetch_and_add(&s.items, items);
+}
+
+/// dump items and bytes for each pool, and the total
+void dump(ceph::Formatter *f);
+
+/*
+ * A member that counts its containing object (of type T) in pool ix
+ * for as long as it exists, wherever it is stored.
+ */
+template <pool_index_t ix, typename T>
+struct counter {
+  counter() {
+    adjust(ix, sizeof(T), 1);
+  }
+  counter(const counter &) {
+    adjust(ix, sizeof(T), 1);
+  }
+  counter& operator=(const counter &) {
+    return *this;
+  }
+  ~counter() {
+    adjust(ix, -(int64_t)sizeof(T), -1);
+  }
+};
+
+}
+
+#define MEMPOOL_CLASS_HELPERS()				\
+  void *operator new(size_t size);			\
+  void operator delete(void *p, size_t size);
+
+#define MEMPOOL_DEFINE_OBJECT_FACTORY(obj, pool)			\
+  void *obj::operator new(size_t size) {				\
+    mempool::adjust(mempool::pool, size, 1);				\
+    return ::operator new(size);					\
+  }									\
+  void obj::operator delete(void *p, size_t size) {			\
+    mempool::adjust(mempool::pool, -(int64_t)size, -1);			\
+    ::operator delete(p);						\
+  }
+
+#endif
@@ -95,20 +95,35 @@ PerfCounters::~PerfCounters()
 {
 }
 
+static inline uint64_t atomic_read64(const uint64_t *p)
+{
+  return __sync_fetch_and_add(const_cast<uint64_t*>(p), 0);
+}
+
+/// log2 histogram bucket for v: 0 for 0, else 1 + floor(log2(v)), capped
+static inline unsigned histogram_bucket(uint64_t v, unsigned nbuckets)
+{
+  unsigned b = v ? 64 - __builtin_clzll(v) : 0;
+  return b < nbuckets ? b : nbuckets - 1;
+}
+
 void PerfCounters::inc(int idx, uint64_t amt)
 {
   if (!m_cct->_conf->perf)
     return;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u64 += amt;
-  if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+  if (data.type & PERFCOUNTER_LONGRUNAVG) {
+    __sync_fetch_and_add(&data.avgcount, 1);
+    __sync_fetch_and_add(&data.u64, amt);
+    __sync_fetch_and_add(&data.avgcount2, 1);
+  } else {
+    __sync_fetch_and_add(&data.u64, amt);
+  }
 }
 
 void PerfCounters::dec(int idx, uint64_t amt)
@@ -116,15 +131,14 @@ void PerfCounters::dec(int idx, uint64_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   assert(!(data.type & PERFCOUNTER_LONGRUNAVG));
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  assert(data.u64 >= amt);
-  data.u64 -= amt;
+  uint64_t old = __sync_fetch_and_sub(&data.u64, amt);
+  assert(old >= amt);
 }
 
 void PerfCounters::set(int idx, uint64_t amt)
@@ -132,15 +146,18 @@ void PerfCounters::set(int idx, uint64_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u64 = amt;
-  if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+  if (data.type & PERFCOUNTER_LONGRUNAVG) {
+    __sync_fetch_and_add(&data.avgcount, 1);
+    __sync_lock_test_and_set(&data.u64, amt);
+    __sync_fetch_and_add(&data.avgcount2, 1);
+  } else {
+    __sync_lock_test_and_set(&data.u64, amt);
+  }
 }
 
 uint64_t PerfCounters::get(int idx) const
@@ -148,13 +165,12 @@ uint64_t PerfCounters::get(int idx) const
   if (!m_cct->_conf->perf)
     return 0;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return 0;
-  return data.u64;
+  return atomic_read64(&data.u64);
 }
 
 void PerfCounters::tinc(int idx, utime_t amt)
@@ -162,15 +178,18 @@ void PerfCounters::tinc(int idx, utime_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  data.u64 += amt.to_nsec();
-  if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+  if (data.type & PERFCOUNTER_LONGRUNAVG) {
+    __sync_fetch_and_add(&data.avgcount, 1);
+    __sync_fetch_and_add(&data.u64, amt.to_nsec());
+    __sync_fetch_and_add(&data.avgcount2, 1);
+  } else {
+    __sync_fetch_and_add(&data.u64, amt.to_nsec());
+  }
 }
 
 void PerfCounters::tset(int idx, utime_t amt)
@@ -178,13 +197,12 @@ void PerfCounters::tset(int idx, utime_t amt)
   if (!m_cct->_conf->perf)
     return;
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  data.u64 = amt.to_nsec();
+  __sync_lock_test_and_set(&data.u64, amt.to_nsec());
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     assert(0);
 }
@@ -194,13 +212,43 @@ utime_t PerfCounters::tget(int idx) const
   if (!m_cct->_conf->perf)
     return utime_t();
 
-  Mutex::Locker lck(m_lock);
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return utime_t();
-  return utime_t(data.u64 / 1000000000ull, data.u64 % 1000000000ull);
+  uint64_t v = atomic_read64(&data.u64);
+  return utime_t(v / 1000000000ull, v % 1000000000ull);
+}
+
+void PerfCounters::hinc(int idx, uint64_t x, uint64_t y)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (!(data.type & PERFCOUNTER_HISTOGRAM) || !(data.type & PERFCOUNTER_U64))
+    return;
+  unsigned xb = histogram_bucket(x, data.x_buckets);
+  unsigned yb = histogram_bucket(y, data.y_buckets);
+  __sync_fetch_and_add(&data.buckets[xb * data.y_buckets + yb], 1);
+}
+
+void PerfCounters::htinc(int idx, utime_t x, uint64_t y)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (!(data.type & PERFCOUNTER_HISTOGRAM) || !(data.type & PERFCOUNTER_TIME))
+    return;
+  unsigned xb = histogram_bucket(x.to_nsec() / 1000, data.x_buckets);
+  unsigned yb = histogram_bucket(y, data.y_buckets);
+  __sync_fetch_and_add(&data.buckets[xb * data.y_buckets + yb], 1);
 }
 
 void PerfCounters::write_json_to_buf(bufferlist& bl, bool schema)
@@ -219,13 +267,16 @@ void PerfCounters::write_json_to_buf(bufferlist& bl, bool schema)
   }
   while (true) {
     const perf_counter_data_any_d &data(*d);
-    buf[0] = '\0';
-    if (schema)
-      data.write_schema_json(buf, sizeof(buf));
-    else
-      data.write_json(buf, sizeof(buf));
-
-    bl.append(buf);
+    if (data.type & PERFCOUNTER_HISTOGRAM) {
+      data.write_histogram_json(bl, schema);
+    } else {
+      buf[0] = '\0';
+      if (schema)
+	data.write_schema_json(buf, sizeof(buf));
+      else
+	data.write_json(buf, sizeof(buf));
+      bl.append(buf);
+    }
     if (++d == d_end)
       break;
     bl.append(',');
@@ -254,10 +305,30 @@ PerfCounters::perf_counter_data_any_d::perf_counter_data_any_d()
   : name(NULL),
     type(PERFCOUNTER_NONE),
     u64(0),
-    avgcount(0)
+    avgcount(0),
+    avgcount2(0),
+    x_name(NULL),
+    y_name(NULL),
+    x_buckets(0),
+    y_buckets(0)
 {
 }
 
+void PerfCounters::perf_counter_data_any_d::read_avg(uint64_t *sum, uint64_t *count) const
+{
+  // a counter that is bumped nonstop could keep us from ever seeing a
+  // matched pair; after this many tries, settle for the last read,
+  // which is off by at most the updates in flight during it
+  static const unsigned max_tries = 100;
+  uint64_t c2;
+  unsigned tries = 0;
+  do {
+    c2 = atomic_read64(&avgcount2);
+    *sum = atomic_read64(&u64);
+    *count = atomic_read64(&avgcount);
+  } while (*count != c2 && ++tries < max_tries);
+}
+
 void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t buf_sz) const
 {
   snprintf(buf, buf_sz, "\"%s\":{\"type\":%d}", name, type);
@@ -265,6 +336,12 @@ void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t
 
 void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz) const
 {
+  uint64_t u64, avgcount = 0;
+  if (type & PERFCOUNTER_LONGRUNAVG)
+    read_avg(&u64, &avgcount);
+  else
+    u64 = atomic_read64(&this->u64);
+
   if (type & PERFCOUNTER_LONGRUNAVG) {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
@@ -294,6 +371,42 @@ void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz
   }
 }
 
+void PerfCounters::perf_counter_data_any_d::write_histogram_json(bufferlist& bl, bool schema) const
+{
+  char buf[256];
+  if (schema) {
+    snprintf(buf, sizeof(buf), "\"%s\":{\"type\":%d,"
+	     "\"x_axis\":{\"name\":\"%s\",\"scale\":\"log2\",\"buckets\":%u}",
+	     name, type, x_name, x_buckets);
+    bl.append(buf);
+    if (y_buckets > 1) {
+      snprintf(buf, sizeof(buf), ",\"y_axis\":{\"name\":\"%s\",\"scale\":\"log2\",\"buckets\":%u}",
+	       y_name, y_buckets);
+      bl.append(buf);
+    }
+    bl.append('}');
+    return;
+  }
+
+  // 1D: "name":{"buckets":[...]}; 2D: one row of y buckets per x bucket
+  snprintf(buf, sizeof(buf), "\"%s\":{\"buckets\":[", name);
+  bl.append(buf);
+  for (unsigned x = 0; x < x_buckets; ++x) {
+    if (x)
+      bl.append(',');
+    if (y_buckets > 1)
+      bl.append('[');
+    for (unsigned y = 0; y < y_buckets; ++y) {
+      snprintf(buf, sizeof(buf), y ? ",%" PRId64 : "%" PRId64,
+	       atomic_read64(&buckets[x * y_buckets + y]));
+      bl.append(buf);
+    }
+    if (y_buckets > 1)
+      bl.append(']');
+  }
+  bl.append("]}");
+}
+
 PerfCountersBuilder::PerfCountersBuilder(CephContext *cct, const std::string &name,
                   int first, int last)
   : m_perf_counters(new PerfCounters(cct, name, first, last))
@@ -332,6 +445,39 @@ void PerfCountersBuilder::add_time_avg(int idx, const char *name)
   add_impl(idx, name, PERFCOUNTER_TIME | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_u64_histogram(int idx, const char *name,
+					    const char *x_name, unsigned x_buckets,
+					    const char *y_name, unsigned y_buckets)
+{
+  add_histogram_impl(idx, name, PERFCOUNTER_U64 | PERFCOUNTER_HISTOGRAM,
+		     x_name, x_buckets, y_name, y_buckets);
+}
+
+void PerfCountersBuilder::add_time_histogram(int idx, const char *name,
+					     const char *x_name, unsigned x_buckets,
+					     const char *y_name, unsigned y_buckets)
+{
+  add_histogram_impl(idx, name, PERFCOUNTER_TIME | PERFCOUNTER_HISTOGRAM,
+		     x_name, x_buckets, y_name, y_buckets);
+}
+
+void PerfCountersBuilder::add_histogram_impl(int idx, const char *name, int ty,
+					     const char *x_name, unsigned x_buckets,
+					     const char *y_name, unsigned y_buckets)
+{
+  assert(x_buckets > 0 && x_buckets <= 65);
+  assert(y_buckets > 0 && y_buckets <= 65);
+  assert(y_buckets == 1 || y_name);
+  add_impl(idx, name, ty);
+  PerfCounters::perf_counter_data_any_d
+    &data(m_perf_counters->m_data[idx - m_perf_counters->m_lower_bound - 1]);
+  data.x_name = x_name;
+  data.y_name = y_name;
+  data.x_buckets = x_buckets;
+  data.y_buckets = y_buckets;
+  data.buckets.resize(x_buckets * y_buckets);
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name, int ty)
 {
   assert(idx > m_perf_counters->m_lower_bound);
@@ -36,6 +36,7 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
 /*
@@ -47,6 +48,7 @@ enum perfcounter_type_d
  * 1) integer values & counters
  * 2) floating-point values & counters
  * 3) floating-point averages
+ * 4) histograms of integer or time values, optionally 2D
  *
  * The difference between values and counters is in how they are initialized
  * and accessed. For a counter, use the inc(counter, amount) function (note
@@ -61,6 +63,16 @@ enum perfcounter_type_d
  * For the time average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * tinc. Calling tset on an average is an error and will assert out.
+ *
+ * Histograms have log2-scale buckets: bucket 0 counts zeros, bucket i
+ * counts values in [2^(i-1), 2^i), and the last bucket is open-ended.
+ * Use hinc(idx, x, y) for integers, htinc(idx, t, y) for times (bucketed
+ * in microseconds); y selects the row of a 2D histogram (e.g. request
+ * size) and is ignored for 1D ones.
+ *
+ * Updates are lock-free (atomic adds on the 64-bit values), so hot
+ * counters can be bumped from many threads at once; only dumping the
+ * counters takes m_lock.
  */
 class PerfCounters
 {
@@ -76,6 +88,9 @@ public:
   void tinc(int idx, utime_t v);
   utime_t tget(int idx) const;
 
+  void hinc(int idx, uint64_t x, uint64_t y = 0);
+  void htinc(int idx, utime_t x, uint64_t y = 0);
+
   void write_json_to_buf(ceph::bufferlist& bl, bool schema);
 
   const std::string& get_name() const;
@@ -94,11 +109,26 @@ private:
     perf_counter_data_any_d();
     void write_schema_json(char *buf, size_t buf_sz) const;
     void  write_json(char *buf, size_t buf_sz) const;
+    void write_histogram_json(ceph::bufferlist& bl, bool schema) const;
+
+    /// read u64 and avgcount as a consistent pair, or close to one if
+    /// writers keep racing with us
+    void read_avg(uint64_t *sum, uint64_t *count) const;
 
     const char *name;
     enum perfcounter_type_d type;
     uint64_t u64;
+    /// averages bump avgcount, then u64, then avgcount2; a reader that
+    /// sees avgcount == avgcount2 around its read of u64 got a matched pair
     uint64_t avgcount;
+    uint64_t avgcount2;
+
+    /// histogram geometry and its x_buckets * y_buckets counts
+    const char *x_name;
+    const char *y_name;
+    unsigned x_buckets;
+    unsigned y_buckets;
+    std::vector<uint64_t> buckets;
   };
   typedef std::vector<perf_counter_data_any_d> perf_counter_data_vec_t;
 
@@ -108,7 +138,7 @@ private:
   std::string m_name;
   const std::string m_lock_name;
 
-  /** Protects m_data */
+  /** Serializes dumps of m_data; updates are atomic and don't take it */
   mutable Mutex m_lock;
 
   perf_counter_data_vec_t m_data;
@@ -167,11 +197,20 @@ public:
   void add_u64_avg(int key, const char *name);
   void add_time(int key, const char *name);
   void add_time_avg(int key, const char *name);
+  void add_u64_histogram(int key, const char *name,
+			 const char *x_name, unsigned x_buckets,
+			 const char *y_name = NULL, unsigned y_buckets = 1);
+  void add_time_histogram(int key, const char *name,
+			  const char *x_name, unsigned x_buckets,
+			  const char *y_name = NULL, unsigned y_buckets = 1);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
   PerfCountersBuilder& operator=(const PerfCountersBuilder &rhs);
   void add_impl(int idx, const char *name, int ty);
+  void add_histogram_impl(int idx, const char *name, int ty,
+			  const char *x_name, unsigned x_buckets,
+			  const char *y_name, unsigned y_buckets);
 
   PerfCounters *m_perf_counters;
 };
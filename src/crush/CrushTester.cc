@@ -1,7 +1,10 @@
 
 #include "CrushTester.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
 
 #include <stdlib.h>
+#include <algorithm>
 
 
 void CrushTester::set_device_weight(int dev, float f)
@@ -349,6 +352,127 @@ void CrushTester::write_integer_indexed_scalar_data_string(vector<string> &dst,
   dst.push_back( data_buffer.str() );
 }
 
+void CrushTester::get_initial_weights(CrushWrapper& c, vector<__u32>& weight)
+{
+  for (int o = 0; o < c.get_max_devices(); o++) {
+    if (device_weight.count(o)) {
+      weight.push_back(device_weight[o]);
+    } else if (c.check_item_present(o)) {
+      weight.push_back(0x10000);
+    } else {
+      weight.push_back(0);
+    }
+  }
+}
+
+/*
+ * maps inputs [first, last] into numrep slots per input of out
+ */
+class CrushTesterThread : public Thread {
+  const CrushWrapper& crush;
+  int ruleno, numrep;
+  const vector<__u32>& weight;
+  int first, last;
+  int *out, *out_size;
+public:
+  CrushTesterThread(const CrushWrapper& c, int r, int n,
+		    const vector<__u32>& w, int f, int l, int *o, int *os)
+    : crush(c), ruleno(r), numrep(n), weight(w), first(f), last(l),
+      out(o), out_size(os) {}
+  void *entry() {
+    vector<int> v;
+    for (int x = first; x <= last; x++) {
+      crush.do_rule(ruleno, x, v, numrep, weight);
+      int i = x - first;
+      out_size[i] = v.size();
+      for (unsigned j = 0; j < v.size(); j++)
+	out[i * numrep + j] = v[j];
+    }
+    return 0;
+  }
+};
+
+// inputs each thread maps per chunk
+static const int CRUSH_TESTER_CHUNK_PER_THREAD = 16384;
+
+void CrushTester::map_chunk(int ruleno, int x, int numrep,
+			    const vector<__u32>& weight)
+{
+  if (num_threads > 1 && thread_maps.empty()) {
+    bufferlist bl;
+    crush.encode(bl);
+    for (int i = 0; i < num_threads; i++) {
+      CrushWrapper *c = new CrushWrapper;
+      bufferlist::iterator p = bl.begin();
+      c->decode(p);
+      if (output_choose_tries)
+	c->start_choose_profile();
+      thread_maps.push_back(c);
+    }
+  }
+
+  int n = (int)min<int64_t>((int64_t)max_x - x + 1,
+			    (int64_t)CRUSH_TESTER_CHUNK_PER_THREAD * num_threads);
+  chunk_rule = ruleno;
+  chunk_num_rep = numrep;
+  chunk_min_x = x;
+  chunk_max_x = x + n - 1;
+  chunk_out.resize(n * numrep);
+  chunk_out_size.resize(n);
+
+  utime_t start = ceph_clock_now(NULL);
+  if (num_threads == 1) {
+    CrushTesterThread t(crush, ruleno, numrep, weight, chunk_min_x, chunk_max_x,
+			&chunk_out[0], &chunk_out_size[0]);
+    t.entry();
+  } else {
+    vector<CrushTesterThread*> threads;
+    int per = (n + num_threads - 1) / num_threads;
+    for (int i = 0; i * per < n; i++) {
+      int first = i * per;
+      int last = min(first + per, n) - 1;
+      threads.push_back(new CrushTesterThread(*thread_maps[i], ruleno, numrep,
+					      weight, x + first, x + last,
+					      &chunk_out[first * numrep],
+					      &chunk_out_size[first]));
+      threads.back()->create();
+    }
+    for (unsigned i = 0; i < threads.size(); i++) {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  mapping_time += (double)(ceph_clock_now(NULL) - start);
+}
+
+void CrushTester::get_mapping(int ruleno, int x, int numrep,
+			      const vector<__u32>& weight, vector<int>& out)
+{
+  if (ruleno != chunk_rule || numrep != chunk_num_rep ||
+      x < chunk_min_x || x > chunk_max_x)
+    map_chunk(ruleno, x, numrep, weight);
+  int i = x - chunk_min_x;
+  out.assign(chunk_out.begin() + i * numrep,
+	     chunk_out.begin() + i * numrep + chunk_out_size[i]);
+}
+
+void CrushTester::put_thread_maps()
+{
+  for (unsigned i = 0; i < thread_maps.size(); i++) {
+    if (output_choose_tries) {
+      // fold the threads' choose tries into ours
+      __u32 *v = 0, *sum = 0;
+      int n = thread_maps[i]->get_choose_profile(&v);
+      crush.get_choose_profile(&sum);
+      for (int j = 0; j < n && sum; j++)
+	sum[j] += v[j];
+    }
+    delete thread_maps[i];
+  }
+  thread_maps.clear();
+  chunk_rule = -1;
+}
+
 int CrushTester::test()
 {
   if (min_rule < 0 || max_rule < 0) {
@@ -367,15 +491,7 @@ int CrushTester::test()
    * note device weight is set by crushtool
    * (likely due to a given a command line option)
    */
-  for (int o = 0; o < crush.get_max_devices(); o++) {
-    if (device_weight.count(o)) {
-      weight.push_back(device_weight[o]);
-    } else if (crush.check_item_present(o)) {
-      weight.push_back(0x10000);
-    } else {
-      weight.push_back(0);
-    }
-  }
+  get_initial_weights(crush, weight);
 
   if (output_utilization_all)
     err << "devices weights (hex): " << hex << weight << dec << std::endl;
@@ -413,6 +529,7 @@ int CrushTester::test()
     for (int nr = minr; nr <= maxr; nr++) {
       vector<int> per(crush.get_max_devices());
       map<int,int> sizes;
+      mapping_time = 0;
 
       int num_objects = ((max_x - min_x) + 1);
       float num_devices = (float) per.size(); // get the total number of devices, better to cast as a float here 
@@ -488,7 +605,7 @@ int CrushTester::test()
           if (use_crush) {
             if (output_statistics)
               err << "CRUSH"; // prepend CRUSH to placement output
-            crush.do_rule(r, x, out, nr, weight);
+            get_mapping(r, x, nr, weight, out);
           } else {
             if (output_statistics)
               err << "RNG"; // prepend RNG to placement output to denote simulation
@@ -507,13 +624,13 @@ int CrushTester::test()
             temporary_per[out[i]]++;
           }
 
-          batch_per[current_batch] = temporary_per;
           sizes[out.size()]++;
           if (output_bad_mappings && out.size() != (unsigned)nr) {
             cout << "bad mapping rule " << r << " x " << x << " num_rep " << nr << " result " << out << std::endl;
           }
         }
 
+        batch_per[current_batch] = temporary_per;
         batch_min = batch_max + 1;
         batch_max = batch_min + objects_per_batch - 1;
       }
@@ -566,6 +683,12 @@ int CrushTester::test()
         }
       }
 
+      if (output_mapping_rate && use_crush)
+        err << "rule " << r << " (" << crush.get_rule_name(r) << ") num_rep " << nr
+            << ": " << num_objects << " mappings in " << mapping_time << " s, "
+            << (mapping_time > 0 ? (uint64_t)(num_objects / mapping_time) : 0)
+            << " mappings/s, " << num_threads << " threads" << std::endl;
+
       string rule_tag = crush.get_rule_name(r);
 
       if (output_csv)
@@ -573,6 +696,8 @@ int CrushTester::test()
     }
   }
 
+  put_thread_maps();
+
   if (output_choose_tries) {
     __u32 *v = 0;
     int n = crush.get_choose_profile(&v);
@@ -589,3 +714,81 @@ int CrushTester::test()
 
   return 0;
 }
+
+int CrushTester::compare(CrushWrapper& other)
+{
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  if (min_x < 0 || max_x < 0) {
+    min_x = 0;
+    max_x = 1023;
+  }
+
+  vector<__u32> weight, other_weight;
+  get_initial_weights(crush, weight);
+  get_initial_weights(other, other_weight);
+
+  int num_x = max_x - min_x + 1;
+  uint64_t total_mappings = 0;
+  double elapsed = 0, other_elapsed = 0;
+  int ret = 0;
+
+  for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+    if (!crush.rule_exists(r))
+      continue;
+    if (!other.rule_exists(r)) {
+      err << "rule " << r << " (" << crush.get_rule_name(r)
+	  << ") dne in the compared map" << std::endl;
+      ret = -ENOENT;
+      continue;
+    }
+    int minr = min_rep, maxr = max_rep;
+    if (min_rep < 0 || max_rep < 0) {
+      minr = crush.get_rule_mask_min_size(r);
+      maxr = crush.get_rule_mask_max_size(r);
+    }
+
+    for (int nr = minr; nr <= maxr; nr++) {
+      vector<vector<int> > out(num_x), other_out(num_x);
+
+      // map all inputs through one map, then the other, so each is timed
+      // on its own
+      utime_t start = ceph_clock_now(NULL);
+      for (int x = min_x; x <= max_x; x++)
+	crush.do_rule(r, x, out[x - min_x], nr, weight);
+      utime_t mid = ceph_clock_now(NULL);
+      for (int x = min_x; x <= max_x; x++)
+	other.do_rule(r, x, other_out[x - min_x], nr, other_weight);
+      utime_t end = ceph_clock_now(NULL);
+      elapsed += (double)(mid - start);
+      other_elapsed += (double)(end - mid);
+      total_mappings += num_x;
+
+      int changed = 0, replicas = 0, moved = 0;
+      for (int i = 0; i < num_x; i++) {
+	if (out[i] != other_out[i])
+	  changed++;
+	replicas += other_out[i].size();
+	for (unsigned j = 0; j < other_out[i].size(); j++)
+	  if (find(out[i].begin(), out[i].end(), other_out[i][j]) == out[i].end())
+	    moved++;
+      }
+      err << "rule " << r << " (" << crush.get_rule_name(r) << ") num_rep " << nr
+	  << ": " << changed << "/" << num_x << " mappings changed ("
+	  << (float)changed * 100.0 / (float)num_x << "%), "
+	  << moved << "/" << replicas << " replicas moved ("
+	  << (replicas ? (float)moved * 100.0 / (float)replicas : 0.0) << "%)"
+	  << std::endl;
+    }
+  }
+
+  if (total_mappings)
+    err << "mapped " << total_mappings << " inputs: "
+	<< (elapsed > 0 ? (uint64_t)(total_mappings / elapsed) : 0)
+	<< " mappings/s, compared map "
+	<< (other_elapsed > 0 ? (uint64_t)(total_mappings / other_elapsed) : 0)
+	<< " mappings/s" << std::endl;
+  return ret;
+}
@@ -30,6 +30,9 @@ class CrushTester {
   bool output_statistics;
   bool output_bad_mappings;
   bool output_choose_tries;
+  bool output_mapping_rate;
+
+  int num_threads;
 
   bool output_data_file;
   bool output_csv;
@@ -42,6 +45,30 @@ class CrushTester {
  */
   void adjust_weights(vector<__u32>& weight);
 
+  /*
+   * initial device weights for map c: those set with set_device_weight,
+   * otherwise 1.0 for devices present in the hierarchy and 0 for the rest
+   */
+  void get_initial_weights(CrushWrapper& c, vector<__u32>& weight);
+
+  /*
+   * test() maps inputs ahead of its sequential loop, a chunk at a time,
+   * with the chunk split across num_threads threads.  Each thread
+   * works on its own copy of the map, since do_rule serializes callers
+   * of one map.  Results are consumed in input order, so the output
+   * doesn't depend on the number of threads.
+   */
+  vector<CrushWrapper*> thread_maps;
+  vector<int> chunk_out, chunk_out_size;   // num_rep slots per input
+  int chunk_rule, chunk_num_rep;
+  int chunk_min_x, chunk_max_x;
+  double mapping_time;
+
+  void map_chunk(int ruleno, int x, int numrep, const vector<__u32>& weight);
+  void get_mapping(int ruleno, int x, int numrep, const vector<__u32>& weight,
+		   vector<int>& out);
+  void put_thread_maps();
+
   /*
    * Get the maximum number of devices that could be selected to satisfy ruleno.
    */
@@ -179,11 +206,19 @@ public:
       output_statistics(false),
       output_bad_mappings(false),
       output_choose_tries(false),
+      output_mapping_rate(false),
+      num_threads(1),
       output_data_file(false),
       output_csv(false),
-      output_data_file_name("")
+      output_data_file_name(""),
+      chunk_rule(-1), chunk_num_rep(0),
+      chunk_min_x(0), chunk_max_x(-1),
+      mapping_time(0)
 
   { }
+  ~CrushTester() {
+    put_thread_maps();
+  }
 
   void set_output_data_file_name(string name) {
     output_data_file_name = name;
@@ -206,6 +241,12 @@ public:
   void set_output_bad_mappings(bool b) {
     output_bad_mappings = b;
   }
+  void set_output_mapping_rate(bool b) {
+    output_mapping_rate = b;
+  }
+  void set_num_threads(int n) {
+    num_threads = n > 0 ? n : 1;
+  }
   void set_output_choose_tries(bool b) {
     output_choose_tries = b;
   }
@@ -255,6 +296,12 @@ public:
   }
 
   int test();
+
+  /*
+   * map the same inputs through our map and other, and report how many
+   * mappings and replicas changed and how fast each map maps
+   */
+  int compare(CrushWrapper& other);
 };
 
 #endif
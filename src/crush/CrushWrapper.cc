@@ -1,12 +1,73 @@
 
 #include "common/debug.h"
 #include "common/Formatter.h"
+#include "common/Thread.h"
 
 #include "CrushWrapper.h"
 
 #define dout_subsys ceph_subsys_crush
 
 
+/*
+ * maps a range of the inputs for do_rule_many(), with its own workspace
+ */
+class CrushMappingThread : public Thread {
+  const crush_map *map;
+  int rule;
+  const int *x;
+  int nx;
+  int *out, *outlen;
+  int maxout;
+  const vector<__u32>& weight;
+public:
+  CrushMappingThread(const crush_map *m, int r, const int *x, int nx,
+		     int *o, int *ol, int mo, const vector<__u32>& w)
+    : map(m), rule(r), x(x), nx(nx), out(o), outlen(ol), maxout(mo),
+      weight(w) {}
+  void *entry() {
+    vector<char> work(crush_work_size(map));
+    crush_init_work(map, &work[0]);
+    crush_do_rule_many(map, rule, x, nx, out, maxout, outlen,
+		       &weight[0], weight.size(), (crush_work *)&work[0]);
+    return 0;
+  }
+};
+
+void CrushWrapper::do_rule_many(int rule, const int *x, int nx,
+				int *out, int *outlen, int maxout,
+				const vector<__u32>& weight,
+				unsigned num_threads) const
+{
+  if (nx <= 0)
+    return;
+  if (crush->choose_tries) {
+    // profiling writes to the map
+    Mutex::Locker l(mapper_lock);
+    CrushMappingThread(crush, rule, x, nx, out, outlen, maxout, weight).entry();
+    return;
+  }
+  if (num_threads > (unsigned)nx)
+    num_threads = nx;
+  if (num_threads <= 1) {
+    CrushMappingThread(crush, rule, x, nx, out, outlen, maxout, weight).entry();
+    return;
+  }
+
+  vector<CrushMappingThread*> threads;
+  int per = (nx + num_threads - 1) / num_threads;
+  for (int first = 0; first < nx; first += per) {
+    int n = MIN(per, nx - first);
+    threads.push_back(new CrushMappingThread(crush, rule, x + first, n,
+					     out + first * maxout,
+					     outlen + first, maxout, weight));
+    threads.back()->create();
+  }
+  for (unsigned i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+}
+
 void CrushWrapper::find_roots(set<int>& roots) const
 {
   for (unsigned i=0; i<crush->max_rules; i++) {
@@ -596,6 +657,11 @@ void CrushWrapper::encode(bufferlist& bl, bool lean) const
       }
       break;
 
+    case CRUSH_BUCKET_STRAW2:
+      for (unsigned j=0; j<crush->buckets[i]->size; j++)
+	::encode(((crush_bucket_straw2*)crush->buckets[i])->item_weights[j], bl);
+      break;
+
     default:
       assert(0);
       break;
@@ -734,6 +800,9 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
   case CRUSH_BUCKET_STRAW:
     size = sizeof(crush_bucket_straw);
     break;
+  case CRUSH_BUCKET_STRAW2:
+    size = sizeof(crush_bucket_straw2);
+    break;
   default:
     {
       char str[128];
@@ -797,6 +866,14 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
     break;
   }
 
+  case CRUSH_BUCKET_STRAW2: {
+    crush_bucket_straw2* cbs = (crush_bucket_straw2*)bucket;
+    cbs->item_weights = (__u32*)calloc(1, bucket->size * sizeof(__u32));
+    for (unsigned j = 0; j < bucket->size; ++j)
+      ::decode(cbs->item_weights[j], blp);
+    break;
+  }
+
   default:
     // We should have handled this case in the first switch statement
     assert(0);
@@ -157,6 +157,13 @@ public:
     return
       crush->chooseleaf_descend_once != 0;
   }
+  bool has_straw2_buckets() const {
+    for (int i=0; i<crush->max_buckets; i++)
+      if (crush->buckets[i] &&
+	  crush->buckets[i]->alg == CRUSH_BUCKET_STRAW2)
+	return true;
+    return false;
+  }
 
   // bucket types
   int get_num_type_names() const {
@@ -722,6 +729,20 @@ public:
       out[i] = rawout[i];
   }
 
+  /**
+   * map nx inputs with one rule
+   *
+   * Input i's mapping goes in out[i*maxout...], and its length in
+   * outlen[i].  Each call (and each thread) maps with its own
+   * workspace, so unlike do_rule() this doesn't serialize on
+   * mapper_lock, except while choose_tries is being profiled.
+   *
+   * @param num_threads split the inputs over this many threads
+   */
+  void do_rule_many(int rule, const int *x, int nx, int *out, int *outlen,
+		    int maxout, const vector<__u32>& weight,
+		    unsigned num_threads = 1) const;
+
   int read_from_file(const char *fn) {
     bufferlist bl;
     std::string error;
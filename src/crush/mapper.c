@@ -20,6 +20,7 @@
 
 #include "crush.h"
 #include "hash.h"
+#include "mapper.h"
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -66,59 +67,73 @@ int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size
  * captures the vast majority of calls.
  */
 static int bucket_perm_choose(struct crush_bucket *bucket,
+			      struct crush_work_bucket *work,
 			      int x, int r)
 {
+	struct crush_work_bucket own;
 	unsigned pr = r % bucket->size;
 	unsigned i, s;
 
+	if (!work) {
+		/* no workspace: the permutation lives in the bucket */
+		own.perm_x = bucket->perm_x;
+		own.perm_n = bucket->perm_n;
+		own.perm = bucket->perm;
+		work = &own;
+	}
+
 	/* start a new permutation if @x has changed */
-	if (bucket->perm_x != (__u32)x || bucket->perm_n == 0) {
+	if (work->perm_x != (__u32)x || work->perm_n == 0) {
 		dprintk("bucket %d new x=%d\n", bucket->id, x);
-		bucket->perm_x = x;
+		work->perm_x = x;
 
 		/* optimize common r=0 case */
 		if (pr == 0) {
 			s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
 				bucket->size;
-			bucket->perm[0] = s;
-			bucket->perm_n = 0xffff;   /* magic value, see below */
+			work->perm[0] = s;
+			work->perm_n = 0xffff;   /* magic value, see below */
 			goto out;
 		}
 
 		for (i = 0; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm_n = 0;
-	} else if (bucket->perm_n == 0xffff) {
+			work->perm[i] = i;
+		work->perm_n = 0;
+	} else if (work->perm_n == 0xffff) {
 		/* clean up after the r=0 case above */
 		for (i = 1; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm[bucket->perm[0]] = 0;
-		bucket->perm_n = 1;
+			work->perm[i] = i;
+		work->perm[work->perm[0]] = 0;
+		work->perm_n = 1;
 	}
 
 	/* calculate permutation up to pr */
-	for (i = 0; i < bucket->perm_n; i++)
-		dprintk(" perm_choose have %d: %d\n", i, bucket->perm[i]);
-	while (bucket->perm_n <= pr) {
-		unsigned p = bucket->perm_n;
+	for (i = 0; i < work->perm_n; i++)
+		dprintk(" perm_choose have %d: %d\n", i, work->perm[i]);
+	while (work->perm_n <= pr) {
+		unsigned p = work->perm_n;
 		/* no point in swapping the final entry */
 		if (p < bucket->size - 1) {
 			i = crush_hash32_3(bucket->hash, x, bucket->id, p) %
 				(bucket->size - p);
 			if (i) {
-				unsigned t = bucket->perm[p + i];
-				bucket->perm[p + i] = bucket->perm[p];
-				bucket->perm[p] = t;
+				unsigned t = work->perm[p + i];
+				work->perm[p + i] = work->perm[p];
+				work->perm[p] = t;
 			}
 			dprintk(" perm_choose swap %d with %d\n", p, p+i);
 		}
-		bucket->perm_n++;
+		work->perm_n++;
 	}
 	for (i = 0; i < bucket->size; i++)
-		dprintk(" perm_choose  %d: %d\n", i, bucket->perm[i]);
+		dprintk(" perm_choose  %d: %d\n", i, work->perm[i]);
 
-	s = bucket->perm[pr];
+	s = work->perm[pr];
 out:
+	if (work == &own) {
+		bucket->perm_x = own.perm_x;
+		bucket->perm_n = own.perm_n;
+	}
 	dprintk(" perm_choose %d sz=%d x=%d r=%d (%d) s=%d\n", bucket->id,
 		bucket->size, x, r, pr, s);
 	return bucket->items[s];
@@ -126,9 +141,10 @@ out:
 
 /* uniform */
 static int bucket_uniform_choose(struct crush_bucket_uniform *bucket,
+				 struct crush_work_bucket *work,
 				 int x, int r)
 {
-	return bucket_perm_choose(&bucket->h, x, r);
+	return bucket_perm_choose(&bucket->h, work, x, r);
 }
 
 /* list */
@@ -216,34 +232,189 @@ static int bucket_tree_choose(struct crush_bucket_tree *bucket,
 
 /* straw */
 
+/*
+ * straw buckets hash every item with the same x and r, so we hash
+ * this many items at a time with crush_hash32_3_many
+ */
+#define CRUSH_STRAW_HASH_BATCH 16
+
 static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 			       int x, int r)
 {
-	__u32 i;
+	__u32 i, j, n;
 	int high = 0;
 	__u64 high_draw = 0;
 	__u64 draw;
+	__u32 hashes[CRUSH_STRAW_HASH_BATCH];
+
+	for (i = 0; i < bucket->h.size; i += n) {
+		n = bucket->h.size - i;
+		if (n > CRUSH_STRAW_HASH_BATCH)
+			n = CRUSH_STRAW_HASH_BATCH;
+		crush_hash32_3_many(bucket->h.hash, x, bucket->h.items + i, r,
+				    hashes, n);
+		for (j = 0; j < n; j++) {
+			draw = hashes[j] & 0xffff;
+			draw *= bucket->straws[i + j];
+			if (i + j == 0 || draw > high_draw) {
+				high = i + j;
+				high_draw = draw;
+			}
+		}
+	}
+	return bucket->h.items[high];
+}
+
+/* straw2 */
+
+/*
+ * 2^44 * log2(1 + i/256), for i in [0, 256]
+ */
+static const __u64 __crush_log2_tbl[257] = {
+	0x00000000000ull, 0x01709c46d7bull, 0x02dfca16ddeull, 0x044d8c45ea6ull,
+	0x05b9e5a170bull, 0x0724d8eea14ull, 0x088e68ea89aull, 0x09f6984a343ull,
+	0x0b5d69bac78ull, 0x0cc2dfe1a4bull, 0x0e26fd5c855ull, 0x0f89c4c1993ull,
+	0x10eb389fa2aull, 0x124b5b7e136ull, 0x13aa2fdd27full, 0x1507b836034ull,
+	0x1663f6fac91ull, 0x17beee96b8aull, 0x1918a16e463ull, 0x1a7111df348ull,
+	0x1bc84240adbull, 0x1d1e34e35b8ull, 0x1e72ec117faull, 0x1fc66a0f0b0ull,
+	0x2118b119b4full, 0x2269c369121ull, 0x23b9a32eaa5ull, 0x250852960f5ull,
+	0x2655d3c4f16ull, 0x27a228db351ull, 0x28ed53f307full, 0x2a375720f4cull,
+	0x2b803473f7bull, 0x2cc7edf5922ull, 0x2e0e85a9de0ull, 0x2f53fd8fa0cull,
+	0x309857a05e0ull, 0x31db95d06a5ull, 0x331dba0efceull, 0x345ec646417ull,
+	0x359ebc5b69eull, 0x36dd9e2ebf3ull, 0x381b6d9bb2aull, 0x39582c78ee2ull,
+	0x3a93dc9864bull, 0x3bce7fc7629ull, 0x3d0817ce9cdull, 0x3e40a672412ull,
+	0x3f782d7204dull, 0x40aeae89342ull, 0x41e42b6ec0cull, 0x4318a5d550bull,
+	0x444c1f6b4c3ull, 0x457e99daec2ull, 0x46b016ca47cull, 0x47e097db624ull,
+	0x49101eac382ull, 0x4a3eacd6ccaull, 0x4b6c43f1367ull, 0x4c98e58dacaull,
+	0x4dc4933a933ull, 0x4eef4e82877ull, 0x501918ec6c1ull, 0x5141f3fb754ull,
+	0x5269e12f347ull, 0x5390e203a3full, 0x54b6f7f1326ull, 0x55dc246ccdeull,
+	0x570068e7ef6ull, 0x5823c6d0a52ull, 0x59463f919dfull, 0x5a67d492335ull,
+	0x5b888736743ull, 0x5ca858df2f0ull, 0x5dc74ae9fbfull, 0x5ee55eb146bull,
+	0x6002958c587ull, 0x611ef0cf618ull, 0x623a71cb82dull, 0x635519ced71ull,
+	0x646eea247c6ull, 0x6587e4149d0ull, 0x66a008e4789ull, 0x67b759d66c9ull,
+	0x68cdd829fd8ull, 0x69e3851bdf0ull, 0x6af861e5fc8ull, 0x6c0c6fbf819ull,
+	0x6d1fafdce21ull, 0x6e32236fe22ull, 0x6f43cba79e4ull, 0x7054a9b0933ull,
+	0x7164beb4a57ull, 0x72740bdb292ull, 0x73829248e96ull, 0x749053202fdull,
+	0x759d4f80cbbull, 0x76a98888194ull, 0x77b4ff5108eull, 0x78bfb4f425dull,
+	0x79c9aa879d5ull, 0x7ad2e11f457ull, 0x7bdb59cca39ull, 0x7ce3159ef31ull,
+	0x7dea15a32c2ull, 0x7ef05ae409aull, 0x7ff5e66a100ull, 0x80fab93b932ull,
+	0x81fed45cbcdull, 0x830238cf927ull, 0x8404e793fb8ull, 0x8506e1a7c71ull,
+	0x86082806b1dull, 0x8708bbaa6beull, 0x88089d8a9e4ull, 0x8907ce9cf0cull,
+	0x8a064fd50f3ull, 0x8b042224af0ull, 0x8c01467b94cull, 0x8cfdbdc7992ull,
+	0x8df988f4ae8ull, 0x8ef4a8ece5eull, 0x8fef1e98741ull, 0x90e8eaddb6bull,
+	0x91e20ea1394ull, 0x92da8ac5b9full, 0x93d2602c2e6ull, 0x94c98fb3c8bull,
+	0x95c01a39fbdull, 0x96b6009a80aull, 0x97ab43af5a0ull, 0x989fe450d9bull,
+	0x9993e355a4eull, 0x9a874192b84ull, 0x9b79ffdb6c9ull, 0x9c6c1f017afull,
+	0x9d5d9fd5011ull, 0x9e4e8324857ull, 0x9f3ec9bcfb8ull, 0xa02e7469c7aull,
+	0xa11d83f4c35ull, 0xa20bf926411ull, 0xa2f9d4c5104ull, 0xa3e71796813ull,
+	0xa4d3c25e68eull, 0xa5bfd5df24cull, 0xa6ab52d99e7ull, 0xa7963a0d4faull,
+	0xa8808c38454ull, 0xa96a4a1723dull, 0xaa5374652a2ull, 0xab3c0bdc358ull,
+	0xac241134c4full, 0xad0b8525fc7ull, 0xadf26865a8aull, 0xaed8bba8421ull,
+	0xafbe7fa0f05ull, 0xb0a3b5018d9ull, 0xb1885c7aa98ull, 0xb26c76bb8ceull,
+	0xb35004723c4ull, 0xb433064b7b8ull, 0xb5157cf2d08ull, 0xb5f76912867ull,
+	0xb6d8cb53b0dull, 0xb7b9a45e2e3ull, 0xb899f4d8ab6ull, 0xb979bd68a63ull,
+	0xba58feb2704ull, 0xbb37b95931full, 0xbc15edfeed3ull, 0xbcf39d44803ull,
+	0xbdd0c7c9a81ull, 0xbead6e2d03cull, 0xbf89910c168ull, 0xc06531034a7ull,
+	0xc1404eadf38ull, 0xc21aeaa651cull, 0xc2f5058593eull, 0xc3ce9fe3d9eull,
+	0xc4a7ba58378ull, 0xc5805578b6aull, 0xc65871da59eull, 0xc73010111ebull,
+	0xc80730b0001ull, 0xc8ddd448f8cull, 0xc9b3fb6d056ull, 0xca89a6ac271ull,
+	0xcb5ed69565bull, 0xcc338bb6d1cull, 0xcd07c69d870ull, 0xcddb87d5ae7ull,
+	0xceaecfea808ull, 0xcf819f66475ull, 0xd053f6d2609ull, 0xd125d6b73feull,
+	0xd1f73f9c70cull, 0xd2c8320898bull, 0xd398ae81790ull, 0xd468b58bf14ull,
+	0xd53847ac00aull, 0xd6076564c8aull, 0xd6d60f388e4ull, 0xd7a445a8bc9ull,
+	0xd8720935e64ull, 0xd93f5a5fc78ull, 0xda0c39a5480ull, 0xdad8a7847cbull,
+	0xdba4a47aa99ull, 0xdc70310443aull, 0xdd3b4d9cf25ull, 0xde05fabf91bull,
+	0xded038e633full, 0xdf9a088a232ull, 0xe0636a23e2full, 0xe12c5e2b324ull,
+	0xe1f4e5170d0ull, 0xe2bcff5dadbull, 0xe384ad748f1ull, 0xe44befd06dbull,
+	0xe512c6e549aull, 0xe5d9332667eull, 0xe69f3506545ull, 0xe764ccf6e29ull,
+	0xe829fb69304ull, 0xe8eec0cda62ull, 0xe9b31d93f99ull, 0xea77122b2e3ull,
+	0xeb3a9f01975ull, 0xebfdc484d95ull, 0xecc08321eb3ull, 0xed82db4517eull,
+	0xee44cd59ffbull, 0xef0659cb99cull, 0xefc78104358ull, 0xf088436d7baull,
+	0xf148a170701ull, 0xf2089b7572bull, 0xf2c831e4411ull, 0xf3876523f7cull,
+	0xf446359b135ull, 0xf504a3af71eull, 0xf5c2afc6544ull, 0xf6805a445f6ull,
+	0xf73da38d9d5ull, 0xf7fa8c057eaull, 0xf8b7140edbbull, 0xf9733c0bf5cull,
+	0xfa2f045e783ull, 0xfaea6d6779bull, 0xfba577877d8ull, 0xfc60231e746ull,
+	0xfd1a708bbe1ull, 0xfdd4602e2a2ull, 0xfe8df263f95ull, 0xff47278ade9ull,
+	0x100000000000ull
+};
 
-	for (i = 0; i < bucket->h.size; i++) {
-		draw = crush_hash32_3(bucket->h.hash, x, bucket->h.items[i], r);
-		draw &= 0xffff;
-		draw *= bucket->straws[i];
-		if (i == 0 || draw > high_draw) {
-			high = i;
-			high_draw = draw;
+/*
+ * crush_ln - compute 2^44 * log2(x + 1) for x in [0, 0xffff]
+ *
+ * Normalize x + 1 to [2^16, 2^17), look up the top 8 fraction bits and
+ * interpolate linearly on the next 8.  Integer only, so every client
+ * gets the same answer.
+ */
+static __u64 crush_ln(unsigned int xin)
+{
+	unsigned int x = xin + 1;
+	unsigned int bits = 16;
+	unsigned int idx, rem;
+	__u64 lo, hi;
+
+	while (x < 0x10000) {
+		x <<= 1;
+		bits--;
+	}
+	/* x is now in [2^16, 2^17) */
+	idx = (x >> 8) & 0xff;
+	rem = x & 0xff;
+	lo = __crush_log2_tbl[idx];
+	hi = __crush_log2_tbl[idx + 1];
+	return ((__u64)bits << 44) + lo + (((hi - lo) * rem) >> 8);
+}
+
+/*
+ * Each item draws u uniformly from (0, 1] and gets the straw
+ * ln(u) / weight; the longest straw wins.  That picks item i with
+ * probability weight_i / sum(weights), and since an item's straw
+ * depends only on its own weight, changing one weight only moves
+ * inputs to or from that item.  (We use log2 scaled by 2^44; the
+ * constant factor doesn't change which straw is longest.)
+ */
+static int bucket_straw2_choose(struct crush_bucket_straw2 *bucket,
+				int x, int r)
+{
+	__u32 i, j, n;
+	int high = 0;
+	__s64 high_draw = 0;
+	__s64 draw;
+	__u32 hashes[CRUSH_STRAW_HASH_BATCH];
+
+	for (i = 0; i < bucket->h.size; i += n) {
+		n = bucket->h.size - i;
+		if (n > CRUSH_STRAW_HASH_BATCH)
+			n = CRUSH_STRAW_HASH_BATCH;
+		crush_hash32_3_many(bucket->h.hash, x, bucket->h.items + i, r,
+				    hashes, n);
+		for (j = 0; j < n; j++) {
+			if (bucket->item_weights[i + j]) {
+				/* log2((u+1) / 2^16) is in [-16, 0] */
+				draw = (__s64)crush_ln(hashes[j] & 0xffff) -
+					(16ll << 44);
+				draw /= (__s64)bucket->item_weights[i + j];
+			} else {
+				draw = -0x7fffffffffffffffll - 1;
+			}
+			if (i + j == 0 || draw > high_draw) {
+				high = i + j;
+				high_draw = draw;
+			}
 		}
 	}
 	return bucket->h.items[high];
 }
 
-static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
+static int crush_bucket_choose(struct crush_bucket *in,
+			       struct crush_work_bucket *work,
+			       int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
 	BUG_ON(in->size == 0);
 	switch (in->alg) {
 	case CRUSH_BUCKET_UNIFORM:
 		return bucket_uniform_choose((struct crush_bucket_uniform *)in,
-					  x, r);
+					     work, x, r);
 	case CRUSH_BUCKET_LIST:
 		return bucket_list_choose((struct crush_bucket_list *)in,
 					  x, r);
@@ -253,6 +424,9 @@ static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 	case CRUSH_BUCKET_STRAW:
 		return bucket_straw_choose((struct crush_bucket_straw *)in,
 					   x, r);
+	case CRUSH_BUCKET_STRAW2:
+		return bucket_straw2_choose((struct crush_bucket_straw2 *)in,
+					    x, r);
 	default:
 		dprintk("unknown bucket %d alg %d\n", in->id, in->alg);
 		return in->items[0];
@@ -290,6 +464,7 @@ static int is_out(const struct crush_map *map, const __u32 *weight, int weight_m
  * @param recurse_to_leaf: true if we want one device under each item of given type
  * @descend_once: true if we should only try one descent before giving up
  * @param out2 second output vector for leaf items (if @a recurse_to_leaf)
+ * @param work caller's workspace, or NULL to use the buckets' own scratch
  */
 static int crush_choose(const struct crush_map *map,
 			struct crush_bucket *bucket,
@@ -297,7 +472,8 @@ static int crush_choose(const struct crush_map *map,
 			int x, int numrep, int type,
 			int *out, int outpos,
 			int firstn, int recurse_to_leaf,
-			int descend_once, int *out2)
+			int descend_once, int *out2,
+			struct crush_work *work)
 {
 	int rep;
 	unsigned int ftotal, flocal;
@@ -308,6 +484,7 @@ static int crush_choose(const struct crush_map *map,
 	int item = 0;
 	int itemtype;
 	int collide, reject;
+	struct crush_work_bucket *wb;
 
 	dprintk("CHOOSE%s bucket %d x %d outpos %d numrep %d\n", recurse_to_leaf ? "_LEAF" : "",
 		bucket->id, x, outpos, numrep);
@@ -352,12 +529,13 @@ static int crush_choose(const struct crush_map *map,
 					reject = 1;
 					goto reject;
 				}
+				wb = work ? &work->buckets[-1-in->id] : NULL;
 				if (map->choose_local_fallback_tries > 0 &&
 				    flocal >= (in->size>>1) &&
 				    flocal > map->choose_local_fallback_tries)
-					item = bucket_perm_choose(in, x, r);
+					item = bucket_perm_choose(in, wb, x, r);
 				else
-					item = crush_bucket_choose(in, x, r);
+					item = crush_bucket_choose(in, wb, x, r);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					skip_rep = 1;
@@ -402,7 +580,7 @@ static int crush_choose(const struct crush_map *map,
 							 out2, outpos,
 							 firstn, 0,
 							 map->chooseleaf_descend_once,
-							 NULL) <= outpos)
+							 NULL, work) <= outpos)
 							/* didn't get leaf */
 							reject = 1;
 					} else {
@@ -467,17 +645,44 @@ reject:
 }
 
 
-/**
- * crush_do_rule - calculate a mapping with the given input and rule
- * @param map the crush_map
- * @param ruleno the rule id
- * @param x hash input
- * @param result pointer to result vector
- * @param resultmax: maximum result size
+/*
+ * workspaces: the scratch state for buckets that choose by permutation,
+ * kept outside the map so that several callers can map at once.
  */
-int crush_do_rule(const struct crush_map *map,
-		  int ruleno, int x, int *result, int result_max,
-		  const __u32 *weight, int weight_max)
+int crush_work_size(const struct crush_map *map)
+{
+	int size = sizeof(struct crush_work) +
+		map->max_buckets * sizeof(struct crush_work_bucket);
+	int b;
+
+	for (b = 0; b < map->max_buckets; b++)
+		if (map->buckets[b])
+			size += map->buckets[b]->size * sizeof(__u32);
+	return size;
+}
+
+void crush_init_work(const struct crush_map *map, void *v)
+{
+	struct crush_work *w = v;
+	__u32 *perm;
+	int b;
+
+	w->buckets = (struct crush_work_bucket *)(w + 1);
+	perm = (__u32 *)(w->buckets + map->max_buckets);
+	for (b = 0; b < map->max_buckets; b++) {
+		w->buckets[b].perm_x = 0;
+		w->buckets[b].perm_n = 0;
+		w->buckets[b].perm = perm;
+		if (map->buckets[b])
+			perm += map->buckets[b]->size;
+	}
+}
+
+static int crush_do_rule_work(const struct crush_map *map,
+			      const struct crush_rule *rule,
+			      int x, int *result, int result_max,
+			      const __u32 *weight, int weight_max,
+			      struct crush_work *work)
 {
 	int result_len;
 	int a[CRUSH_MAX_SET];
@@ -489,25 +694,18 @@ int crush_do_rule(const struct crush_map *map,
 	int *o;
 	int osize;
 	int *tmp;
-	struct crush_rule *rule;
 	__u32 step;
 	int i, j;
 	int numrep;
 	int firstn;
 	const int descend_once = 0;
 
-	if ((__u32)ruleno >= map->max_rules) {
-		dprintk(" bad ruleno %d\n", ruleno);
-		return 0;
-	}
-
-	rule = map->rules[ruleno];
 	result_len = 0;
 	w = a;
 	o = b;
 
 	for (step = 0; step < rule->len; step++) {
-		struct crush_rule_step *curstep = &rule->steps[step];
+		const struct crush_rule_step *curstep = &rule->steps[step];
 
 		firstn = 0;
 		switch (curstep->op) {
@@ -555,7 +753,8 @@ int crush_do_rule(const struct crush_map *map,
 						      o+osize, j,
 						      firstn,
 						      recurse_to_leaf,
-						      descend_once, c+osize);
+						      descend_once, c+osize,
+						      work);
 			}
 
 			if (recurse_to_leaf)
@@ -587,4 +786,62 @@ int crush_do_rule(const struct crush_map *map,
 	return result_len;
 }
 
+/**
+ * crush_do_rule - calculate a mapping with the given input and rule
+ * @param map the crush_map
+ * @param ruleno the rule id
+ * @param x hash input
+ * @param result pointer to result vector
+ * @param resultmax: maximum result size
+ */
+int crush_do_rule(const struct crush_map *map,
+		  int ruleno, int x, int *result, int result_max,
+		  const __u32 *weight, int weight_max)
+{
+	if ((__u32)ruleno >= map->max_rules) {
+		dprintk(" bad ruleno %d\n", ruleno);
+		return 0;
+	}
+	return crush_do_rule_work(map, map->rules[ruleno], x,
+				  result, result_max, weight, weight_max,
+				  NULL);
+}
 
+/**
+ * crush_do_rule_many - map several inputs with the same rule
+ * @param map the crush_map
+ * @param ruleno the rule id
+ * @param x hash inputs
+ * @param nx number of inputs
+ * @param result nx * result_max results, result_max per input
+ * @param result_max maximum result size per input
+ * @param result_len nx result sizes
+ * @param work a workspace set up by crush_init_work() for this map
+ *
+ * Only @work is written, not the map, so callers with their own
+ * workspaces can use the same map at once (unless choose_tries is
+ * being profiled).
+ */
+int crush_do_rule_many(const struct crush_map *map, int ruleno,
+		       const int *x, int nx,
+		       int *result, int result_max, int *result_len,
+		       const __u32 *weight, int weight_max,
+		       struct crush_work *work)
+{
+	const struct crush_rule *rule;
+	int i;
+
+	if ((__u32)ruleno >= map->max_rules) {
+		dprintk(" bad ruleno %d\n", ruleno);
+		for (i = 0; i < nx; i++)
+			result_len[i] = 0;
+		return 0;
+	}
+	rule = map->rules[ruleno];
+	for (i = 0; i < nx; i++)
+		result_len[i] = crush_do_rule_work(map, rule, x[i],
+						   result + i * result_max,
+						   result_max,
+						   weight, weight_max, work);
+	return nx;
+}
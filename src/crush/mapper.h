@@ -10,10 +10,35 @@
 
 #include "crush.h"
 
+/*
+ * A workspace holds the scratch state crush_do_rule() otherwise keeps
+ * in the map's buckets (the permutation for buckets that choose by
+ * permutation), so that several callers can map with one map at once.
+ * Allocate crush_work_size() bytes and set them up with
+ * crush_init_work(); a workspace is only good for the map it was set
+ * up for, and for one caller at a time.
+ */
+struct crush_work_bucket {
+	__u32 perm_x;  /* @x for which *perm is defined */
+	__u32 perm_n;  /* num elements of *perm that are permuted/defined */
+	__u32 *perm;
+};
+
+struct crush_work {
+	struct crush_work_bucket *buckets;  /* indexed like map->buckets */
+};
+
 extern int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size);
 extern int crush_do_rule(const struct crush_map *map,
 			 int ruleno,
 			 int x, int *result, int result_max,
 			 const __u32 *weights, int weight_max);
+extern int crush_work_size(const struct crush_map *map);
+extern void crush_init_work(const struct crush_map *map, void *v);
+extern int crush_do_rule_many(const struct crush_map *map, int ruleno,
+			      const int *x, int nx,
+			      int *result, int result_max, int *result_len,
+			      const __u32 *weights, int weight_max,
+			      struct crush_work *work);
 
 #endif
@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <fstream>
 
@@ -91,17 +92,23 @@ void usage()
   cout << "                         specify output for for (de)compilation\n";
   cout << "   --build --num_osds N layer1 ...\n";
   cout << "                         build a new map, where each 'layer' is\n";
-  cout << "                           'name (uniform|straw|list|tree) size'\n";
+  cout << "                           'name (uniform|straw|straw2|list|tree) size'\n";
   cout << "   -i mapfn --test       test a range of inputs on the map\n";
   cout << "      [--min-x x] [--max-x x] [--x x]\n";
   cout << "      [--min-rule r] [--max-rule r] [--rule r]\n";
   cout << "      [--num-rep n]\n";
   cout << "      [--batches b]      split the CRUSH mapping into b > 1 rounds\n";
+  cout << "      [--num-threads t]  map inputs with t threads (default: one\n";
+  cout << "                         per cpu)\n";
   cout << "      [--weight|-w devno weight]\n";
   cout << "                         where weight is 0 to 1.0\n";
   cout << "      [--simulate]       simulate placements using a random\n";
   cout << "                         number generator in place of the CRUSH\n";
   cout << "                         algorithm\n";
+  cout << "   -i mapfn --compare other_mapfn\n";
+  cout << "                         map the same inputs through both maps and\n";
+  cout << "                         report how many mappings change and the\n";
+  cout << "                         mapping rate of each\n";
   cout << "   -i mapfn --add-item id weight name [--loc type name ...]\n";
   cout << "                         insert an item into the hierarchy at the\n";
   cout << "                         given location\n";
@@ -120,6 +127,8 @@ void usage()
   cout << "   --show-statistics     show chi squared statistics\n";
   cout << "   --show-bad-mappings   show bad mappings\n";
   cout << "   --show-choose-tries   show choose tries histogram\n";
+  cout << "   --show-mapping-rate   show the time spent mapping and the\n";
+  cout << "                         mappings per second\n";
   cout << "   --set-choose-local-tries N\n";
   cout << "                         set choose local retries before re-descent\n";
   cout << "   --set-choose-local-fallback-tries N\n";
@@ -145,6 +154,7 @@ struct bucket_types_t {
   { "uniform", CRUSH_BUCKET_UNIFORM },
   { "list", CRUSH_BUCKET_LIST },
   { "straw", CRUSH_BUCKET_STRAW },
+  { "straw2", CRUSH_BUCKET_STRAW2 },
   { "tree", CRUSH_BUCKET_TREE },
   { 0, 0 },
 };
@@ -162,6 +172,7 @@ int main(int argc, const char **argv)
 
   const char *me = argv[0];
   std::string infn, srcfn, outfn, add_name, remove_name, reweight_name;
+  std::string comparefn;
   bool compile = false;
   bool decompile = false;
   bool test = false;
@@ -188,6 +199,8 @@ int main(int argc, const char **argv)
   int choose_total_tries = -1;
   int chooseleaf_descend_once = -1;
 
+  int num_threads = -1;
+
   CrushWrapper crush;
 
   CrushTester tester(crush, cerr, 1);
@@ -233,11 +246,16 @@ int main(int argc, const char **argv)
     } else if (ceph_argparse_flag(args, i, "--show_choose_tries", (char*)NULL)) {
       display = true;
       tester.set_output_choose_tries(true);
+    } else if (ceph_argparse_flag(args, i, "--show_mapping_rate", (char*)NULL)) {
+      display = true;
+      tester.set_output_mapping_rate(true);
     } else if (ceph_argparse_witharg(args, i, &val, "-c", "--compile", (char*)NULL)) {
       srcfn = val;
       compile = true;
     } else if (ceph_argparse_flag(args, i, "-t", "--test", (char*)NULL)) {
       test = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      comparefn = val;
     } else if (ceph_argparse_flag(args, i, "-s", "--simulate", (char*)NULL)) {
       tester.set_random_placement();
     } else if (ceph_argparse_flag(args, i, "--enable-unsafe-tunables", (char*)NULL)) {
@@ -375,6 +393,11 @@ int main(int argc, const char **argv)
 	exit(EXIT_FAILURE);
       }
       tester.set_rule(x);
+    } else if (ceph_argparse_withint(args, i, &num_threads, &err, "--num_threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else if (ceph_argparse_withint(args, i, &x, &err, "--batches", (char*)NULL)) {
       if (!err.str().empty()) {
 	cerr << err.str() << std::endl;
@@ -422,7 +445,7 @@ int main(int argc, const char **argv)
     exit(EXIT_FAILURE);
   }
   if (!compile && !decompile && !build && !test && !reweight && !adjust &&
-      add_item < 0 &&
+      add_item < 0 && comparefn.empty() &&
       remove_name.empty() && reweight_name.empty()) {
     cout << "no action specified; -h for help" << std::endl;
     exit(EXIT_FAILURE);
@@ -719,10 +742,30 @@ int main(int argc, const char **argv)
   }
 
   if (test) {
+    if (num_threads < 0)
+      num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    tester.set_num_threads(num_threads);
     int r = tester.test();
     if (r < 0)
       exit(1);
   }
 
+  if (!comparefn.empty()) {
+    bufferlist bl;
+    std::string error;
+    int r = bl.read_file(comparefn.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": error reading '" << comparefn << "': "
+	   << error << std::endl;
+      exit(1);
+    }
+    CrushWrapper other;
+    bufferlist::iterator p = bl.begin();
+    other.decode(p);
+    r = tester.compare(other);
+    if (r < 0)
+      exit(1);
+  }
+
   return 0;
 }
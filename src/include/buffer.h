@@ -55,6 +55,7 @@ void	*valloc(size_t);
 #include <iostream>
 #include <istream>
 #include <iomanip>
+#include <iterator>
 #include <list>
 #include <string>
 #include <exception>
@@ -68,6 +69,12 @@ void	*valloc(size_t);
 # include <assert.h>
 #endif
 
+/*
+ * a list's appends go in a buffer this big until the list outgrows it,
+ * and in whole pages after that.
+ */
+#define CEPH_BUFFER_APPEND_SMALL 256
+
 namespace ceph {
 
 class buffer {
@@ -121,6 +128,7 @@ private:
   class raw_posix_aligned;
   class raw_hack_aligned;
   class raw_char;
+  class raw_combined;
 
   friend std::ostream& operator<<(std::ostream& out, const raw &r);
 
@@ -218,18 +226,214 @@ public:
    */
 
   class list {
+  public:
+    /*
+     * the ptrs of a list.  a doubly linked ring, like std::list, except
+     * that one node is held inline, so a list of a single ptr (most
+     * small encodes) doesn't allocate a node.  iterators stay valid as
+     * with std::list, but splice() and swap() may move a ptr out of
+     * the source's inline node into another node.
+     */
+    class buffers_t {
+      struct node_base {
+	node_base *prev, *next;
+      };
+      struct node : public node_base {
+	ptr bp;
+	node() {}
+	explicit node(const ptr& p) : bp(p) {}
+      };
+
+      node_base _head;
+      node _inline;
+      bool _inline_used;
+      size_t _size;
+
+      node *_get_node(const ptr& bp) {
+	if (!_inline_used) {
+	  _inline_used = true;
+	  _inline.bp = bp;
+	  return &_inline;
+	}
+	return new node(bp);
+      }
+      void _put_node(node *n) {
+	if (n == &_inline) {
+	  _inline.bp = ptr();
+	  _inline_used = false;
+	} else {
+	  delete n;
+	}
+      }
+      void _init() {
+	_head.prev = _head.next = &_head;
+	_size = 0;
+      }
+      static void _link_before(node_base *pos, node_base *n) {
+	n->next = pos;
+	n->prev = pos->prev;
+	pos->prev->next = n;
+	pos->prev = n;
+      }
+
+    public:
+      class const_iterator;
+      class iterator {
+	node_base *n;
+	friend class buffers_t;
+	friend class const_iterator;
+      public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef ptr value_type;
+	typedef ptrdiff_t difference_type;
+	typedef ptr* pointer;
+	typedef ptr& reference;
+
+	iterator() : n(0) {}
+	explicit iterator(node_base *n) : n(n) {}
+	ptr& operator*() const { return static_cast<node*>(n)->bp; }
+	ptr* operator->() const { return &static_cast<node*>(n)->bp; }
+	iterator& operator++() { n = n->next; return *this; }
+	iterator operator++(int) { iterator t(*this); n = n->next; return t; }
+	iterator& operator--() { n = n->prev; return *this; }
+	iterator operator--(int) { iterator t(*this); n = n->prev; return t; }
+	bool operator==(const iterator& o) const { return n == o.n; }
+	bool operator!=(const iterator& o) const { return n != o.n; }
+      };
+      class const_iterator {
+	const node_base *n;
+      public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef ptr value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const ptr* pointer;
+	typedef const ptr& reference;
+
+	const_iterator() : n(0) {}
+	explicit const_iterator(const node_base *n) : n(n) {}
+	const_iterator(const iterator& i) : n(i.n) {}
+	const ptr& operator*() const { return static_cast<const node*>(n)->bp; }
+	const ptr* operator->() const { return &static_cast<const node*>(n)->bp; }
+	const_iterator& operator++() { n = n->next; return *this; }
+	const_iterator operator++(int) { const_iterator t(*this); n = n->next; return t; }
+	const_iterator& operator--() { n = n->prev; return *this; }
+	const_iterator operator--(int) { const_iterator t(*this); n = n->prev; return t; }
+	friend bool operator==(const const_iterator& a, const const_iterator& b) {
+	  return a.n == b.n;
+	}
+	friend bool operator!=(const const_iterator& a, const const_iterator& b) {
+	  return a.n != b.n;
+	}
+      };
+
+      buffers_t() : _inline_used(false) {
+	_init();
+      }
+      buffers_t(const buffers_t& other) : _inline_used(false) {
+	_init();
+	for (const_iterator p = other.begin(); p != other.end(); ++p)
+	  push_back(*p);
+      }
+      buffers_t& operator=(const buffers_t& other) {
+	if (this != &other) {
+	  clear();
+	  for (const_iterator p = other.begin(); p != other.end(); ++p)
+	    push_back(*p);
+	}
+	return *this;
+      }
+      ~buffers_t() {
+	clear();
+      }
+
+      iterator begin() { return iterator(_head.next); }
+      iterator end() { return iterator(&_head); }
+      const_iterator begin() const { return const_iterator(_head.next); }
+      const_iterator end() const { return const_iterator(&_head); }
+
+      bool empty() const { return _size == 0; }
+      size_t size() const { return _size; }
+      ptr& front() { return *begin(); }
+      const ptr& front() const { return *begin(); }
+      ptr& back() { return *iterator(_head.prev); }
+      const ptr& back() const { return *const_iterator(_head.prev); }
+
+      iterator insert(iterator pos, const ptr& bp) {
+	node *n = _get_node(bp);
+	_link_before(pos.n, n);
+	_size++;
+	return iterator(n);
+      }
+      iterator erase(iterator pos) {
+	node_base *next = pos.n->next;
+	pos.n->prev->next = next;
+	next->prev = pos.n->prev;
+	_put_node(static_cast<node*>(pos.n));
+	_size--;
+	return iterator(next);
+      }
+      void push_back(const ptr& bp) {
+	insert(end(), bp);
+      }
+      void push_front(const ptr& bp) {
+	insert(begin(), bp);
+      }
+      void clear() {
+	node_base *n = _head.next;
+	while (n != &_head) {
+	  node_base *next = n->next;
+	  _put_node(static_cast<node*>(n));
+	  n = next;
+	}
+	_init();
+      }
+
+      /// move all of other's ptrs in before pos
+      void splice(iterator pos, buffers_t& other) {
+	if (&other == this || other.empty())
+	  return;
+	if (other._inline_used) {
+	  // other's inline node can't leave other; put its ptr in one of ours
+	  node *n = _get_node(ptr());
+	  n->bp.swap(other._inline.bp);
+	  n->prev = other._inline.prev;
+	  n->next = other._inline.next;
+	  n->prev->next = n;
+	  n->next->prev = n;
+	  other._inline_used = false;
+	}
+	node_base *first = other._head.next;
+	node_base *last = other._head.prev;
+	first->prev = pos.n->prev;
+	last->next = pos.n;
+	pos.n->prev->next = first;
+	pos.n->prev = last;
+	_size += other._size;
+	other._init();
+      }
+      void swap(buffers_t& other) {
+	buffers_t t;
+	t.splice(t.end(), *this);
+	splice(end(), other);
+	other.splice(other.end(), t);
+      }
+    };
+
+  private:
     // my private bits
-    std::list<ptr> _buffers;
+    buffers_t _buffers;
     unsigned _len;
 
     ptr append_buffer;  // where i put small appends.
 
+    void _new_append_buffer(unsigned len);
+
   public:
     class iterator {
       list *bl;
-      std::list<ptr> *ls; // meh.. just here to avoid an extra pointer dereference..
+      buffers_t *ls; // meh.. just here to avoid an extra pointer dereference..
       unsigned off;  // in bl
-      std::list<ptr>::iterator p;
+      buffers_t::iterator p;
       unsigned p_off; // in *p
     public:
       // constructor.  position.
@@ -239,7 +443,7 @@ public:
 	bl(l), ls(&bl->_buffers), off(0), p(ls->begin()), p_off(0) {
 	advance(o);
       }
-      iterator(list *l, unsigned o, std::list<ptr>::iterator ip, unsigned po) : 
+      iterator(list *l, unsigned o, buffers_t::iterator ip, unsigned po) : 
 	bl(l), ls(&bl->_buffers), off(o), p(ip), p_off(po) { }
 
       iterator(const iterator& other) : bl(other.bl),
@@ -310,14 +514,14 @@ public:
       return *this;
     }
 
-    const std::list<ptr>& buffers() const { return _buffers; }
+    const buffers_t& buffers() const { return _buffers; }
     
     void swap(list& other);
     unsigned length() const {
 #if 0
       // DEBUG: verify _len
       unsigned len = 0;
-      for (std::list<ptr>::const_iterator it = _buffers.begin();
+      for (buffers_t::const_iterator it = _buffers.begin();
 	   it != _buffers.end();
 	   it++) {
 	len += (*it).length();
@@ -418,8 +622,8 @@ public:
     int write_file(const char *fn, int mode=0644);
     int write_fd(int fd) const;
     __u32 crc32c(__u32 crc) {
-      for (std::list<ptr>::const_iterator it = _buffers.begin(); 
-	   it != _buffers.end(); 
+      for (buffers_t::const_iterator it = _buffers.begin();
+	   it != _buffers.end();
 	   it++)
 	if (it->length())
 	  crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
@@ -502,7 +706,7 @@ inline std::ostream& operator<<(std::ostream& out, const buffer::ptr& bp) {
 inline std::ostream& operator<<(std::ostream& out, const buffer::list& bl) {
   out << "buffer::list(len=" << bl.length() << "," << std::endl;
 
-  std::list<buffer::ptr>::const_iterator it = bl.buffers().begin();
+  buffer::list::buffers_t::const_iterator it = bl.buffers().begin();
   while (it != bl.buffers().end()) {
     out << "\t" << *it;
     if (++it == bl.buffers().end()) break;
@@ -40,6 +40,16 @@ struct Entry {
     }
   }
 
+  /// reinitialize a recycled Entry
+  void reset(utime_t s, pthread_t t, short pr, short sub) {
+    m_stamp = s;
+    m_thread = t;
+    m_prio = pr;
+    m_subsys = sub;
+    m_next = NULL;
+    m_streambuf.reset();
+  }
+
   void set_str(const std::string s) {
     ostream os(&m_streambuf);
     os << s;
@@ -16,6 +16,7 @@
 
 #define DEFAULT_MAX_NEW    100
 #define DEFAULT_MAX_RECENT 10000
+#define DEFAULT_MAX_FREE   1000
 
 #define PREALLOC 1000000
 
@@ -29,19 +30,53 @@ static void log_on_exit(int r, void *p)
     l->flush();
 }
 
+/*
+ * Each thread keeps a private list of recycled Entries.  When it runs
+ * dry it takes the whole shared free list in one atomic exchange, so
+ * create_entry never contends with other loggers on a lock.
+ */
+static pthread_key_t entry_cache_key;
+static pthread_once_t entry_cache_once = PTHREAD_ONCE_INIT;
+
+static void entry_cache_destroy(void *p)
+{
+  Entry *e = (Entry *)p;
+  while (e) {
+    Entry *next = e->m_next;
+    delete e;
+    e = next;
+  }
+}
+
+static void entry_cache_init()
+{
+  int ret = pthread_key_create(&entry_cache_key, entry_cache_destroy);
+  assert(ret == 0);
+}
+
+static void delete_entries(Entry *e)
+{
+  entry_cache_destroy(e);
+}
+
 Log::Log(SubsystemMap *s)
   : m_indirect_this(NULL),
     m_subs(s),
-    m_new(), m_recent(),
+    m_new_head(NULL), m_new_len(0),
+    m_recent(),
+    m_free_head(NULL), m_free_len(0),
     m_fd(-1),
     m_syslog_log(-2), m_syslog_crash(-2),
     m_stderr_log(1), m_stderr_crash(-1),
     m_stop(false),
     m_max_new(DEFAULT_MAX_NEW),
-    m_max_recent(DEFAULT_MAX_RECENT)
+    m_max_recent(DEFAULT_MAX_RECENT),
+    m_max_free(DEFAULT_MAX_FREE)
 {
   int ret;
 
+  pthread_once(&entry_cache_once, entry_cache_init);
+
   ret = pthread_spin_init(&m_lock, PTHREAD_PROCESS_SHARED);
   assert(ret == 0);
 
@@ -73,6 +108,9 @@ Log::~Log()
   if (m_fd >= 0)
     TEMP_FAILURE_RETRY(::close(m_fd));
 
+  delete_entries(m_new_head);
+  delete_entries(m_free_head);
+
   pthread_spin_destroy(&m_lock);
   pthread_mutex_destroy(&m_queue_mutex);
   pthread_mutex_destroy(&m_flush_mutex);
@@ -139,49 +177,97 @@ void Log::set_stderr_level(int log, int crash)
 
 void Log::submit_entry(Entry *e)
 {
-  pthread_mutex_lock(&m_queue_mutex);
-
-  // wait for flush to catch up
-  while (m_new.m_len > m_max_new)
-    pthread_cond_wait(&m_cond_loggers, &m_queue_mutex);
-
-  m_new.enqueue(e);
-  pthread_cond_signal(&m_cond_flusher);
-  pthread_mutex_unlock(&m_queue_mutex);
+  // push onto the new list without taking any lock
+  Entry *head;
+  do {
+    head = m_new_head;
+    e->m_next = head;
+  } while (!__sync_bool_compare_and_swap(&m_new_head, head, e));
+  int len = __sync_add_and_fetch(&m_new_len, 1);
+
+  // only the entry that makes the list non-empty wakes the flusher, and
+  // loggers only block when the flusher falls behind
+  if (head == NULL || len > m_max_new) {
+    pthread_mutex_lock(&m_queue_mutex);
+    if (head == NULL)
+      pthread_cond_signal(&m_cond_flusher);
+
+    // wait for flush to catch up
+    while (m_new_len > m_max_new)
+      pthread_cond_wait(&m_cond_loggers, &m_queue_mutex);
+    pthread_mutex_unlock(&m_queue_mutex);
+  }
 }
 
 Entry *Log::create_entry(int level, int subsys)
 {
-  if (true) {
+  Entry *e = (Entry *)pthread_getspecific(entry_cache_key);
+  if (!e && m_free_head) {
+    e = __sync_lock_test_and_set(&m_free_head, (Entry *)NULL);
+    __sync_lock_test_and_set(&m_free_len, 0);
+  }
+  if (!e) {
     return new Entry(ceph_clock_now(NULL),
 		   pthread_self(),
 		   level, subsys);
-  } else {
-    // kludge for perf testing
+  }
+  pthread_setspecific(entry_cache_key, e->m_next);
+  e->reset(ceph_clock_now(NULL), pthread_self(), level, subsys);
+  return e;
+}
+
+void Log::_take_new(EntryQueue *t)
+{
+  Entry *e = __sync_lock_test_and_set(&m_new_head, (Entry *)NULL);
+
+  // the list is newest first; reverse it into submission order
+  Entry *rev = NULL;
+  int n = 0;
+  while (e) {
+    Entry *next = e->m_next;
+    e->m_next = rev;
+    rev = e;
+    e = next;
+    n++;
+  }
+  while (rev) {
+    Entry *next = rev->m_next;
+    t->enqueue(rev);
+    rev = next;
+  }
+
+  if (n) {
+    __sync_sub_and_fetch(&m_new_len, n);
+    pthread_mutex_lock(&m_queue_mutex);
+    pthread_cond_broadcast(&m_cond_loggers);
+    pthread_mutex_unlock(&m_queue_mutex);
+  }
+}
+
+void Log::_trim_recent()
+{
+  while (m_recent.m_len > m_max_recent) {
     Entry *e = m_recent.dequeue();
-    e->m_stamp = ceph_clock_now(NULL);
-    e->m_thread = pthread_self();
-    e->m_prio = level;
-    e->m_subsys = subsys;
-    return e;
+    if (m_free_len >= m_max_free) {
+      delete e;
+      continue;
+    }
+    Entry *head;
+    do {
+      head = m_free_head;
+      e->m_next = head;
+    } while (!__sync_bool_compare_and_swap(&m_free_head, head, e));
+    __sync_add_and_fetch(&m_free_len, 1);
   }
 }
 
 void Log::flush()
 {
   pthread_mutex_lock(&m_flush_mutex);
-  pthread_mutex_lock(&m_queue_mutex);
   EntryQueue t;
-  t.swap(m_new);
-  pthread_cond_broadcast(&m_cond_loggers);
-  pthread_mutex_unlock(&m_queue_mutex);
+  _take_new(&t);
   _flush(&t, &m_recent, false);
-
-  // trim
-  while (m_recent.m_len > m_max_recent) {
-    delete m_recent.dequeue();
-  }
-
+  _trim_recent();
   pthread_mutex_unlock(&m_flush_mutex);
 }
 
@@ -254,10 +340,8 @@ void Log::dump_recent()
 {
   pthread_mutex_lock(&m_flush_mutex);
 
-  pthread_mutex_lock(&m_queue_mutex);
   EntryQueue t;
-  t.swap(m_new);
-  pthread_mutex_unlock(&m_queue_mutex);
+  _take_new(&t);
   _flush(&t, &m_recent, false);
 
   EntryQueue old;
@@ -313,7 +397,7 @@ void *Log::entry()
 {
   pthread_mutex_lock(&m_queue_mutex);
   while (!m_stop) {
-    if (!m_new.empty()) {
+    if (m_new_head) {
       pthread_mutex_unlock(&m_queue_mutex);
       flush();
       pthread_mutex_lock(&m_queue_mutex);
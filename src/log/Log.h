@@ -27,9 +27,13 @@ class Log : private Thread
   pthread_cond_t m_cond_loggers;
   pthread_cond_t m_cond_flusher;
 
-  EntryQueue m_new;    ///< new entries
+  Entry *m_new_head;   ///< new entries, newest first; pushed without locks
+  int m_new_len;       ///< entries on m_new_head
   EntryQueue m_recent; ///< recent (less new) entries we've already written at low detail
 
+  Entry *m_free_head;  ///< trimmed entries, for create_entry to recycle
+  int m_free_len;      ///< approximate length of m_free_head
+
   std::string m_log_file;
   int m_fd;
 
@@ -38,11 +42,13 @@ class Log : private Thread
 
   bool m_stop;
 
-  int m_max_new, m_max_recent;
+  int m_max_new, m_max_recent, m_max_free;
 
   void *entry();
 
+  void _take_new(EntryQueue *q);
   void _flush(EntryQueue *q, EntryQueue *requeue, bool crash);
+  void _trim_recent();
 
   void _log_message(const char *s, bool crash);
 
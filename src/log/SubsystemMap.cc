@@ -6,11 +6,14 @@ namespace log {
 
 void SubsystemMap::add(unsigned subsys, std::string name, int log, int gather)
 {
-  if (subsys >= m_subsys.size())
+  if (subsys >= m_subsys.size()) {
     m_subsys.resize(subsys + 1);
+    m_gather_levels.resize(subsys + 1);
+  }
   m_subsys[subsys].name = name;
   m_subsys[subsys].log_level = log;
   m_subsys[subsys].gather_level = gather;
+  _update_gather_level(subsys);
   if (name.length() > m_max_name_len)
     m_max_name_len = name.length();
 }
@@ -19,12 +22,14 @@ void SubsystemMap::set_log_level(unsigned subsys, int log)
 {
   assert(subsys < m_subsys.size());
   m_subsys[subsys].log_level = log;
+  _update_gather_level(subsys);
 }
 
 void SubsystemMap::set_gather_level(unsigned subsys, int gather)
 {
   assert(subsys < m_subsys.size());
   m_subsys[subsys].gather_level = gather;
+  _update_gather_level(subsys);
 }
 
 }
@@ -4,10 +4,12 @@
 #ifndef CEPH_LOG_SUBSYSTEMS
 #define CEPH_LOG_SUBSYSTEMS
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "include/assert.h"
+#include "common/likely.h"
 
 namespace ceph {
 namespace log {
@@ -23,6 +25,15 @@ class SubsystemMap {
   std::vector<Subsystem> m_subsys;
   unsigned m_max_name_len;
 
+  /// max(log_level, gather_level) per subsystem, so that should_gather,
+  /// which runs for every dout, is a single load and compare
+  std::vector<int> m_gather_levels;
+
+  void _update_gather_level(unsigned subsys) {
+    m_gather_levels[subsys] = std::max(m_subsys[subsys].log_level,
+				       m_subsys[subsys].gather_level);
+  }
+
   friend class Log;
 
 public:
@@ -59,9 +70,8 @@ public:
   }
 
   bool should_gather(unsigned sub, int level) {
-    assert(sub < m_subsys.size());
-    return level <= m_subsys[sub].gather_level ||
-      level <= m_subsys[sub].log_level;
+    assert(sub < m_gather_levels.size());
+    return unlikely(level <= m_gather_levels[sub]);
   }
 };
 
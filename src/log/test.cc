@@ -3,6 +3,10 @@
 #include "log/Log.h"
 #include "common/Clock.h"
 #include "common/PrebufferedStreambuf.h"
+#include "common/Thread.h"
+
+#include <fstream>
+#include <sstream>
 
 using namespace ceph::log;
 
@@ -187,3 +191,60 @@ TEST(Log, ManyGather)
   log.flush();
   log.stop();
 }
+
+struct LogThread : public Thread {
+  Log *log;
+  int id;
+  LogThread(Log *l, int i) : log(l), id(i) {}
+  void *entry() {
+    for (int i=0; i<many; i++) {
+      Entry *e = log->create_entry(10, 1);
+      ostream os(&e->m_streambuf);
+      os << "thread " << id << " seq " << i;
+      log->submit_entry(e);
+    }
+    return NULL;
+  }
+};
+
+TEST(Log, ManyThreadsRecycle)
+{
+  SubsystemMap subs;
+  subs.add(1, "foo", 20, 1);
+  Log log(&subs);
+  log.set_max_recent(10);  // trim (and recycle) almost everything
+  log.start();
+  log.set_log_file("/tmp/log_threads");
+  ::unlink("/tmp/log_threads");
+  log.reopen_log_file();
+
+  const int nthreads = 8;
+  vector<LogThread*> threads;
+  for (int i=0; i<nthreads; i++) {
+    threads.push_back(new LogThread(&log, i));
+    threads.back()->create();
+  }
+  for (int i=0; i<nthreads; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  log.flush();
+  log.stop();
+
+  // every entry made it out, in order per thread
+  vector<int> next(nthreads, 0);
+  ifstream in("/tmp/log_threads");
+  string line;
+  while (getline(in, line)) {
+    size_t p = line.find("thread ");
+    ASSERT_NE(string::npos, p);
+    istringstream is(line.substr(p));
+    string word;
+    int id, seq;
+    is >> word >> id >> word >> seq;
+    ASSERT_EQ(next[id], seq);
+    next[id]++;
+  }
+  for (int i=0; i<nthreads; i++)
+    ASSERT_EQ(many, next[i]);
+}
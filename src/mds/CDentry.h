@@ -26,6 +26,7 @@ using namespace std;
 #include "include/lru.h"
 #include "include/elist.h"
 #include "include/filepath.h"
+#include "common/mempool.h"
 #include "mdstypes.h"
 
 #include "SimpleLock.h"
@@ -64,9 +65,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    mempool::adjust(mempool::mds_co, sizeof(CDentry), 1);
     return n;
   }
   void operator delete(void *p) {
+    mempool::adjust(mempool::mds_co, -(int64_t)sizeof(CDentry), -1);
     pool.free(p);
   }
 
@@ -22,6 +22,7 @@
 #include "mdstypes.h"
 #include "common/config.h"
 #include "common/DecayCounter.h"
+#include "common/mempool.h"
 
 #include <iostream>
 
@@ -57,9 +58,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    mempool::adjust(mempool::mds_co, sizeof(CDir), 1);
     return n;
   }
   void operator delete(void *p) {
+    mempool::adjust(mempool::mds_co, -(int64_t)sizeof(CDir), -1);
     pool.free(p);
   }
 
@@ -18,6 +18,7 @@
 #define CEPH_CINODE_H
 
 #include "common/config.h"
+#include "common/mempool.h"
 #include "include/dlist.h"
 #include "include/elist.h"
 #include "include/types.h"
@@ -110,9 +111,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    mempool::adjust(mempool::mds_co, sizeof(CInode), 1);
     return n;
   }
   void operator delete(void *p) {
+    mempool::adjust(mempool::mds_co, -(int64_t)sizeof(CInode), -1);
     pool.free(p);
   }
 
@@ -1052,8 +1052,14 @@ MMonProbe *Monitor::fill_probe_data(MMonProbe *m, Paxos *pax)
     for (list<string>::iterator p = pax->extra_state_dirs.begin();
          p != pax->extra_state_dirs.end();
          ++p) {
-      store->get_bl_sn_safe(r->paxos_values[*p][v], p->c_str(), v);
-      len += r->paxos_values[*p][v].length();
+      // not every version has extra state (osdmap_full is only stored
+      // every mon_osdmap_full_interval epochs); don't send empty values
+      bufferlist bl;
+      store->get_bl_sn_safe(bl, p->c_str(), v);
+      if (!bl.length())
+	continue;
+      len += bl.length();
+      r->paxos_values[*p][v].claim(bl);
     }
     if (len >= g_conf->mon_slurp_bytes)
       break;
@@ -1108,10 +1114,23 @@ void Monitor::handle_probe_data(MMonProbe *m)
     for (map<string, map<version_t, bufferlist> >::iterator p = m->paxos_values.begin();
 	 p != m->paxos_values.end();
 	 ++p) {
+      if (p->first != m->machine_name) {
+	// older peers send an empty value for every version without
+	// extra state; storing those would look like real (full) maps
+	map<version_t, bufferlist>::iterator q = p->second.begin();
+	while (q != p->second.end()) {
+	  if (q->second.length())
+	    ++q;
+	  else
+	    p->second.erase(q++);
+	}
+	if (p->second.empty())
+	  continue;
+      }
       store->put_bl_sn_map(p->first.c_str(), p->second.begin(), p->second.end(), &m->gv[p->first]);
     }
 
-    pax->last_committed = m->paxos_values.begin()->second.rbegin()->first;
+    pax->last_committed = m->paxos_values[m->machine_name].rbegin()->first;
     store->put_int(pax->last_committed, m->machine_name.c_str(),
 		   "last_committed");
   }
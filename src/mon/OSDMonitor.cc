@@ -117,10 +117,13 @@ void OSDMonitor::update_from_paxos()
     OSDMap::Incremental inc(bl);
     osdmap.apply_incremental(inc);
 
-    // write out the full map for all past epochs
+    // write out the full map every mon_osdmap_full_interval epochs
     bl.clear();
     osdmap.encode(bl);
-    mon->store->put_bl_sn(bl, "osdmap_full", osdmap.epoch);
+    if (g_conf->mon_osdmap_full_interval <= 1 ||
+	osdmap.epoch % g_conf->mon_osdmap_full_interval == 0 ||
+	osdmap.epoch == 1)
+      mon->store->put_bl_sn(bl, "osdmap_full", osdmap.epoch);
 
     // share
     dout(1) << osdmap << dendl;
@@ -171,6 +174,8 @@ void OSDMonitor::update_msgr_features()
     features |= CEPH_FEATURE_CRUSH_TUNABLES;
   if (osdmap.crush->has_nondefault_tunables2())
     features |= CEPH_FEATURE_CRUSH_TUNABLES2;
+  if (osdmap.crush->has_straw2_buckets())
+    features |= CEPH_FEATURE_CRUSH_STRAW2;
 
   for (set<int>::iterator q = types.begin(); q != types.end(); ++q) {
     if ((mon->messenger->get_policy(*q).features_required & mask) != features) {
@@ -403,6 +408,36 @@ int OSDMonitor::reweight_by_utilization(int oload, std::string& out_str)
   return changed;
 }
 
+/* Reweight osds that hold more (or fewer) pgs than their crush weight
+ * asks for, moving no more than mon_reweight_max_pgs pgs at a time.
+ */
+int OSDMonitor::reweight_by_pg(double max_deviation, int64_t pool,
+			       std::string& out_str)
+{
+  ostringstream oss;
+  int r = osdmap.calc_pg_reweights(pool, max_deviation,
+				   g_conf->mon_reweight_max_change,
+				   MAX(g_conf->mon_reweight_max_pgs, 0),
+				   &pending_inc.new_weight, &oss);
+  if (r == -EINVAL) {
+    out_str = "deviation must be > 0 and mon_reweight_max_change in (0, 1)";
+  } else if (r == -EDOM) {
+    out_str = "no pgs map to in osds";
+  } else if (r < 0) {
+    out_str = cpp_strerror(r);
+  } else {
+    // one line per osd, then a summary; reply with all of it on one line
+    istringstream in(oss.str());
+    string line, sep;
+    while (getline(in, line)) {
+      out_str += sep + line;
+      sep = "; ";
+    }
+  }
+  dout(0) << "reweight_by_pg: " << out_str << dendl;
+  return r;
+}
+
 void OSDMonitor::create_pending()
 {
   pending_inc = OSDMap::Incremental(osdmap.epoch+1);
@@ -1329,6 +1364,41 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
   return m;
 }
 
+/*
+ * Rebuild a full map we didn't store from the nearest earlier one we
+ * did and the incrementals since.
+ */
+int OSDMonitor::get_full_map_bl(epoch_t e, bufferlist& bl)
+{
+  if (e > osdmap.get_epoch())
+    return -ENOENT;
+  if (mon->store->get_bl_sn(bl, "osdmap_full", e) > 0)
+    return 0;
+
+  epoch_t from = e;
+  bufferlist fbl;
+  while (from > paxos->get_first_committed()) {
+    --from;
+    if (mon->store->get_bl_sn(fbl, "osdmap_full", from) > 0)
+      break;
+  }
+  if (!fbl.length())
+    return -ENOENT;
+
+  dout(20) << "get_full_map_bl " << e << " from full " << from << dendl;
+  OSDMap m;
+  m.decode(fbl);
+  for (epoch_t i = from + 1; i <= e; i++) {
+    bufferlist ibl;
+    if (!paxos->read(i, ibl))
+      return -ENOENT;
+    OSDMap::Incremental inc(ibl);
+    m.apply_incremental(inc);
+  }
+  m.encode(bl);
+  return 0;
+}
+
 void OSDMonitor::send_full(PaxosServiceMessage *m)
 {
   dout(5) << "send_full to " << m->get_orig_source_inst() << dendl;
@@ -1342,8 +1412,8 @@ void OSDMonitor::send_incremental(PaxosServiceMessage *req, epoch_t first)
   if (first < paxos->get_first_committed()) {
     first = paxos->get_first_committed();
     bufferlist bl;
-    mon->store->get_bl_sn_safe(bl, "osdmap_full", first);
-    assert(bl.length());
+    int r = get_full_map_bl(first, bl);
+    assert(r == 0);
     dout(20) << "send_incremental starting with base full " << first << " " << bl.length() << " bytes" << dendl;
     MOSDMap *m = new MOSDMap(osdmap.get_fsid());
     m->oldest_map = paxos->get_first_committed();
@@ -1370,8 +1440,8 @@ void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool oneti
   if (first < paxos->get_first_committed()) {
     first = paxos->get_first_committed();
     bufferlist bl;
-    mon->store->get_bl_sn_safe(bl, "osdmap_full", first);
-    assert(bl.length());
+    int r = get_full_map_bl(first, bl);
+    assert(r == 0);
     dout(20) << "send_incremental starting with base full " << first << " " << bl.length() << " bytes" << dendl;
     MOSDMap *m = new MOSDMap(osdmap.get_fsid());
     m->oldest_map = paxos->get_first_committed();
@@ -1407,12 +1477,31 @@ void OSDMonitor::check_subs()
   string type = "osdmap";
   if (mon->session_map.subs.count(type) == 0)
     return;
+
+  // most subscribers only need the latest incremental, which is the same
+  // message for all of them: encode it once and fan it out.
+  epoch_t e = osdmap.get_epoch();
+  list<Connection*> cons;
   xlist<Subscription*>::iterator p = mon->session_map.subs[type]->begin();
   while (!p.end()) {
     Subscription *sub = *p;
     ++p;
+    if (sub->next == e && e >= paxos->get_first_committed() &&
+	!sub->session->proxy_con) {
+      dout(20) << "check_subs " << sub->session->inst << " gets shared inc " << e << dendl;
+      cons.push_back(sub->session->con);
+      if (sub->onetime)
+	mon->session_map.remove_sub(sub);
+      else
+	sub->next = e + 1;
+      continue;
+    }
     check_sub(sub);
   }
+  if (!cons.empty()) {
+    dout(10) << "check_subs sending inc " << e << " to " << cons.size() << " subscribers" << dendl;
+    mon->messenger->send_message_multi(build_incremental(e, e), cons);
+  }
 }
 
 void OSDMonitor::check_sub(Subscription *sub)
@@ -1588,6 +1677,14 @@ void OSDMonitor::tick()
       else
 	floor = 0;
     }
+    // the first map we keep must be stored in full.  check even with
+    // an interval of 1: it may have been larger when floor was written,
+    // or on the mon that wrote it.  an empty file (slurped from an
+    // older mon) doesn't count.
+    bufferlist fbl;
+    while (floor > paxos->get_first_committed() &&
+	   mon->store->get_bl_sn(fbl, "osdmap_full", floor) <= 0)
+      floor--;
     if (floor > paxos->get_first_committed())
       paxos->trim_to(floor);
   }    
@@ -1753,7 +1850,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       OSDMap *p = &osdmap;
       if (epoch) {
 	bufferlist b;
-	mon->store->get_bl_sn_safe(b,"osdmap_full", epoch);
+	get_full_map_bl(epoch, b);
 	if (!b.length()) {
 	  p = 0;
 	  r = -ENOENT;
@@ -3169,6 +3266,42 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	return true;
       }
     }
+    else if ((m->cmd.size() > 1) &&
+	     (m->cmd[1] == "reweight-by-pg")) {
+      double max_deviation = g_conf->mon_reweight_max_deviation;
+      int64_t pool = -1;
+      if (m->cmd.size() > 2) {
+	const char *start = m->cmd[2].c_str();
+	char *end;
+	max_deviation = strtod(start, &end);
+	if (end == start || *end || !(max_deviation > 0)) {
+	  ss << "invalid max-deviation '" << m->cmd[2] << "'";
+	  err = -EINVAL;
+	  goto out;
+	}
+      }
+      if (m->cmd.size() > 3) {
+	pool = osdmap.lookup_pg_pool_name(m->cmd[3].c_str());
+	if (pool < 0) {
+	  ss << "unrecognized pool '" << m->cmd[3] << "'";
+	  err = -ENOENT;
+	  goto out;
+	}
+      }
+      string out_str;
+      err = reweight_by_pg(max_deviation, pool, out_str);
+      if (err < 0) {
+	ss << "FAILED reweight-by-pg: " << out_str;
+      }
+      else if (err == 0) {
+	ss << "no change: " << out_str;
+      } else {
+	ss << "SUCCESSFUL reweight-by-pg: " << out_str;
+	getline(ss, rs);
+	paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	return true;
+      }
+    }
     else if (m->cmd.size() == 3 && m->cmd[1] == "thrash") {
       long l = parse_pos_long(m->cmd[2].c_str(), &ss);
       if (l < 0) {
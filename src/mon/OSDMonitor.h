@@ -160,6 +160,7 @@ private:
   void send_to_waiting();     // send current map to waiters.
   MOSDMap *build_latest_full();
   MOSDMap *build_incremental(epoch_t first, epoch_t last);
+  int get_full_map_bl(epoch_t e, bufferlist& bl);
   void send_full(PaxosServiceMessage *m);
   void send_incremental(PaxosServiceMessage *m, epoch_t first);
   void send_incremental(epoch_t first, entity_inst_t& dest, bool onetime);
@@ -167,6 +168,7 @@ private:
   void remove_redundant_pg_temp();
   void remove_down_pg_temp();
   int reweight_by_utilization(int oload, std::string& out_str);
+  int reweight_by_pg(double max_deviation, int64_t pool, std::string& out_str);
  
   bool preprocess_failure(class MOSDFailure *m);
   bool prepare_failure(class MOSDFailure *m);
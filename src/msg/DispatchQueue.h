@@ -152,7 +152,8 @@ class DispatchQueue {
     : cct(cct), msgr(msgr),
       lock("SimpleMessenger::DispatchQeueu::lock"), 
       mqueue(cct->_conf->ms_pq_max_tokens_per_priority,
-	     cct->_conf->ms_pq_min_cost),
+	     cct->_conf->ms_pq_min_cost,
+	     cct->_conf->ms_pq_cost_fair),
       next_pipe_id(1),
       dispatch_thread(this),
       stop(false)
@@ -164,7 +164,8 @@ void Message::encode(uint64_t features, bool datacrc)
     if (header.compat_version == 0)
       header.compat_version = header.version;
   }
-  calc_front_crc();
+  if (!footer_crcs_valid)
+    calc_front_crc();
 
   // update envelope
   header.front_len = get_payload().length();
@@ -175,7 +176,8 @@ void Message::encode(uint64_t features, bool datacrc)
   footer.flags = CEPH_MSG_FOOTER_COMPLETE;
 
   if (datacrc) {
-    calc_data_crc();
+    if (!footer_crcs_valid)
+      calc_data_crc();
 
 #ifdef ENCODE_DUMP
     bufferlist bl;
@@ -218,6 +220,15 @@ void Message::dump(Formatter *f) const
   f->dump_string("summary", ss.str());
 }
 
+Message *PreEncodedMessage::decode_copy(CephContext *cct)
+{
+  // decode_message() claims the buffers it is given, so pass copies
+  ceph_msg_header h = header;
+  ceph_msg_footer f = footer;
+  bufferlist fr = payload, mi = middle, da = data;
+  return decode_message(cct, h, f, fr, mi, da);
+}
+
 Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_footer& footer,
 			bufferlist& front, bufferlist& middle, bufferlist& data)
 {
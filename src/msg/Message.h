@@ -305,20 +305,27 @@ protected:
   // currently throttled.
   uint64_t dispatch_throttle_size;
 
+  // true if the front/middle/data crcs in the footer are known to match
+  // the payload, middle and data, which must then not be modified.  set
+  // for pre-encoded copies, so that encode() only redoes the header crc.
+  bool footer_crcs_valid;
+
   friend class Messenger;
 
 public:
   Message()
     : connection(NULL),
       throttler(NULL),
-      dispatch_throttle_size(0) {
+      dispatch_throttle_size(0),
+      footer_crcs_valid(false) {
     memset(&header, 0, sizeof(header));
     memset(&footer, 0, sizeof(footer));
   };
   Message(int t, int version=1, int compat_version=0)
     : connection(NULL),
       throttler(NULL),
-      dispatch_throttle_size(0) {
+      dispatch_throttle_size(0),
+      footer_crcs_valid(false) {
     memset(&header, 0, sizeof(header));
     header.type = t;
     header.version = version;
@@ -479,6 +486,51 @@ public:
 };
 typedef boost::intrusive_ptr<Message> MessageRef;
 
+/**
+ * A copy of an already-encoded Message that shares its payload, middle
+ * and data buffers.  This lets us send one encoded Message to many peers
+ * (see Messenger::send_message_multi()) without calling encode_payload()
+ * or recalculating the payload crcs for each of them; only the envelope
+ * (seq, header crc, signature) is filled in per Connection.
+ *
+ * It cannot be dispatched itself; a receiver in this process (see
+ * ms_inprocess_delivery) gets the real Message from decode_copy().
+ */
+class PreEncodedMessage : public Message {
+  Message *orig;
+
+public:
+  PreEncodedMessage(Message *m)
+    : Message(m->get_type()),
+      orig(m->get()) {
+    header = m->get_header();
+    footer = m->get_footer();
+    payload = m->get_payload();
+    middle = m->get_middle();
+    data = m->get_data();
+    footer_crcs_valid = true;
+  }
+private:
+  ~PreEncodedMessage() {
+    orig->put();
+  }
+
+public:
+  int get_cost() const { return orig->get_cost(); }
+
+  /// build the real Message from the encoded buffers; NULL on failure
+  Message *decode_copy(CephContext *cct);
+
+  void decode_payload() { assert(0); }
+  void encode_payload(uint64_t features) {
+    // the payload was encoded by the original Message
+  }
+  const char *get_type_name() const { return orig->get_type_name(); }
+  void print(ostream& out) const {
+    orig->print(out);
+  }
+};
+
 extern Message *decode_message(CephContext *cct, ceph_msg_header &header,
 			       ceph_msg_footer& footer, bufferlist& front,
 			       bufferlist& middle, bufferlist& data);
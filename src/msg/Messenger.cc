@@ -3,6 +3,9 @@
 #include "Messenger.h"
 
 #include "SimpleMessenger.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_ms
 
 Messenger *Messenger::create(CephContext *cct,
 			     entity_name_t name,
@@ -11,3 +14,78 @@ Messenger *Messenger::create(CephContext *cct,
 {
   return new SimpleMessenger(cct, name, lname, nonce);
 }
+
+Message *Messenger::decode_copy(Message *m)
+{
+  PreEncodedMessage *pre = new PreEncodedMessage(m);
+  Message *copy = pre->decode_copy(cct);
+  pre->put();
+  return copy;
+}
+
+int Messenger::send_message_multi(Message *m, const list<Connection*>& cons)
+{
+  m->get_header().src = get_myname();
+  if (!m->get_priority())
+    m->set_priority(get_default_send_priority());
+
+  // the payload encoding may depend on the peer's features, so group
+  // the remote Connections by what they negotiated.
+  map<uint64_t, list<Connection*> > by_features;
+  Connection *local = NULL;
+  for (list<Connection*>::const_iterator p = cons.begin();
+       p != cons.end();
+       ++p) {
+    if ((*p)->get_peer_addr() == get_myaddr())
+      local = *p;
+    else
+      by_features[(*p)->get_features()].push_back(*p);
+  }
+
+  // encode_payload() may change the Message to suit the features it is
+  // given (MOSDMap re-encodes its maps for old peers), so encode the
+  // original once, with every feature, and give each other feature
+  // group (and the local recipient) a copy decoded from that.
+  bool datacrc = !cct->_conf->ms_nocrc;
+  __u16 version = m->get_header().version;
+  __u16 compat_version = m->get_header().compat_version;
+  m->encode(CEPH_FEATURES_ALL, datacrc);
+  for (map<uint64_t, list<Connection*> >::iterator p = by_features.begin();
+       p != by_features.end();
+       ++p) {
+    Message *gm = m;
+    if (p->first == CEPH_FEATURES_ALL) {
+      m->get();
+    } else {
+      gm = decode_copy(m);
+      if (!gm) {
+	ldout(cct, 0) << "send_message_multi failed to copy " << *m
+		      << " for features " << hex << p->first << dec
+		      << ", dropping it for " << p->second.size() << " peers" << dendl;
+	continue;
+      }
+      // start from the versions the original had before encoding
+      gm->get_header().version = version;
+      gm->get_header().compat_version = compat_version;
+      gm->clear_payload();
+      gm->encode(p->first, datacrc);
+    }
+    for (list<Connection*>::iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q)
+      send_message(new PreEncodedMessage(gm), *q);
+    gm->put();
+  }
+
+  // local delivery skips encoding, so it needs a Message of its own.
+  if (local) {
+    Message *lm = decode_copy(m);
+    if (lm)
+      send_message(lm, local);
+    else
+      ldout(cct, 0) << "send_message_multi failed to copy " << *m
+		    << " for local delivery, dropping it" << dendl;
+  }
+  m->put();
+  return 0;
+}
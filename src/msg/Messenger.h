@@ -422,6 +422,25 @@ public:
    * @return 0.
    */
   virtual int lazy_send_message(Message *m, Connection *con) = 0;
+  /**
+   * Queue the same Message to send out on each of the given Connections.
+   * The payload is encoded once for each distinct set of features
+   * negotiated on those Connections, and the encoded buffers are shared
+   * between all the copies sent; only the envelope is prepared per
+   * Connection. The Message itself is only encoded with all features;
+   * each other feature set (and our loopback Connection, if it is one
+   * of them) gets a copy decoded from that, since encode_payload() may
+   * change the Message it encodes.
+   * As with send_message(), success only guarantees that the Message
+   * was queued.
+   *
+   * @param m The Message to send. The Messenger consumes a single reference
+   * when you pass it in. Do not modify it afterwards.
+   * @param cons The Connections to send the Message out on.
+   *
+   * @return 0 on success, or -errno on failure.
+   */
+  virtual int send_message_multi(Message *m, const list<Connection*>& cons);
 
   /**
    * @} // Messaging
@@ -529,6 +548,12 @@ protected:
    * will be called when we receive our first Dispatcher.
    */
   virtual void ready() { }
+  /**
+   * A copy of an already-encoded Message, decoded from its encoding.
+   *
+   * @return the copy, or NULL if it could not be decoded.
+   */
+  Message *decode_copy(Message *m);
   /**
    * @} // Subclass Interfacing
    */
@@ -24,6 +24,7 @@
 
 #include "common/debug.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 
 // Below included to get encode_encrypt(); That probably should be in Crypto.h, instead
 
@@ -118,6 +119,32 @@ void Pipe::handle_ack(uint64_t seq)
   }
 }
 
+void Pipe::_send(Message *m)
+{
+  assert(pipe_lock.is_locked());
+  out_q[m->get_priority()].push_back(m);
+  msgr->logger->inc(l_msgr_send_queue);
+  cond.Signal();
+}
+
+Message *Pipe::_get_next_outgoing()
+{
+  assert(pipe_lock.is_locked());
+  Message *m = 0;
+  while (!m && !out_q.empty()) {
+    map<int, list<Message*> >::reverse_iterator p = out_q.rbegin();
+    if (!p->second.empty()) {
+      m = p->second.front();
+      p->second.pop_front();
+    }
+    if (p->second.empty())
+      out_q.erase(p->first);
+  }
+  if (m)
+    msgr->logger->dec(l_msgr_send_queue);
+  return m;
+}
+
 void Pipe::start_reader()
 {
   assert(pipe_lock.is_locked());
@@ -1093,6 +1120,7 @@ void Pipe::requeue_sent(uint64_t max_acked)
       ldout(msgr->cct,10) << "requeue_sent " << *m << " for resend seq " << out_seq
           << " (" << m->get_seq() << ")" << dendl;
       rq.push_front(m);
+      msgr->logger->inc(l_msgr_send_queue);
       out_seq--;
     } else {
       ldout(msgr->cct,10) << "requeue_sent " << *m << " for resend seq " << out_seq
@@ -1119,6 +1147,7 @@ void Pipe::discard_out_queue()
     for (list<Message*>::iterator r = p->second.begin(); r != p->second.end(); r++) {
       ldout(msgr->cct,20) << "  discard " << *r << dendl;
       (*r)->put();
+      msgr->logger->dec(l_msgr_send_queue);
     }
   out_q.clear();
 }
@@ -1201,6 +1230,7 @@ void Pipe::fault(bool onread)
     } else {
       ldout(msgr->cct,0) << "fault, initiating reconnect" << dendl;
       connect_seq++;
+      msgr->logger->inc(l_msgr_reconnect);
       state = STATE_CONNECTING;
     }
     backoff = utime_t();
@@ -1357,6 +1387,11 @@ void Pipe::reader()
 
       // note last received message.
       in_seq = m->get_seq();
+      last_active = m->get_recv_complete_stamp();
+      int l = SimpleMessenger::get_peer_type_counters(peer_type);
+      msgr->logger->inc(l);
+      msgr->logger->inc(l + 1, m->get_payload().length() + m->get_middle().length() +
+			m->get_data().length());
 
       cond.Signal();  // wake up writer, to ack this
       
@@ -1419,6 +1454,7 @@ void Pipe::writer()
     // standby?
     if (is_queued() && state == STATE_STANDBY && !policy.server) {
       connect_seq++;
+      msgr->logger->inc(l_msgr_reconnect);
       state = STATE_CONNECTING;
     }
 
@@ -1461,23 +1497,17 @@ void Pipe::writer()
 	keepalive = false;
       }
 
-      // send ack?
-      if (in_seq > in_seq_acked) {
-	uint64_t send_seq = in_seq;
-	pipe_lock.Unlock();
-	int rc = write_ack(send_seq);
-	pipe_lock.Lock();
-	if (rc < 0) {
-	  ldout(msgr->cct,2) << "writer couldn't write ack, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
-	  fault();
- 	  continue;
-	}
-	in_seq_acked = send_seq;
-      }
+      // grab outgoing messages; everything queued, up to
+      // ms_writer_batch_bytes, goes out in one sendmsg
+      list<Message*> batch;
+      list<bufferlist> blists;
+      uint64_t batch_bytes = 0;
+      while (batch.empty() ||
+	     batch_bytes < msgr->cct->_conf->ms_writer_batch_bytes) {
+	Message *m = _get_next_outgoing();
+	if (!m)
+	  break;
 
-      // grab outgoing message
-      Message *m = _get_next_outgoing();
-      if (m) {
 	m->set_seq(++out_seq);
 	if (!policy.lossy || close_on_empty) {
 	  // put on sent list
@@ -1514,22 +1544,46 @@ void Pipe::writer()
 	  }
 	}
 
-	bufferlist blist = m->get_payload();
+	blists.push_back(m->get_payload());
+	bufferlist& blist = blists.back();
 	blist.append(m->get_middle());
 	blist.append(m->get_data());
+	batch.push_back(m);
+	batch_bytes += blist.length();
+      }
 
+      // send ack?  it rides along with the batch
+      bool send_ack = in_seq > in_seq_acked;
+      uint64_t send_seq = in_seq;
+      if (send_ack || !batch.empty()) {
 	pipe_lock.Unlock();
 
-        ldout(msgr->cct,20) << "writer sending " << m->get_seq() << " " << m << dendl;
-	int rc = write_message(header, footer, blist);
+        ldout(msgr->cct,20) << "writer sending " << batch.size() << " messages, "
+			    << batch_bytes << " bytes" << dendl;
+	int rc = write_messages(send_ack ? &send_seq : NULL, batch, blists);
 
 	pipe_lock.Lock();
 	if (rc < 0) {
-          ldout(msgr->cct,1) << "writer error sending " << m << ", "
-		  << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+          ldout(msgr->cct,1) << "writer error sending " << batch.size()
+			     << " messages" << (send_ack ? " and ack" : "") << ", "
+			     << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
 	  fault();
-        }
-	m->put();
+        } else {
+	  if (send_ack)
+	    in_seq_acked = send_seq;
+	  if (!batch.empty()) {
+	    last_active = ceph_clock_now(msgr->cct);
+	    msgr->logger->inc(l_msgr_write_batch, batch.size());
+	  }
+	  int l = SimpleMessenger::get_peer_type_counters(peer_type);
+	  list<bufferlist>::iterator q = blists.begin();
+	  for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p, ++q) {
+	    msgr->logger->inc(l + 2);
+	    msgr->logger->inc(l + 3, q->length());
+	  }
+	}
+	for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p)
+	  (*p)->put();
       }
       continue;
     }
@@ -1655,6 +1709,8 @@ int Pipe::read_message(Message **pm)
   }
 
   utime_t throttle_stamp = ceph_clock_now(msgr->cct);
+  if (waited_on_throttle)
+    msgr->logger->tinc(l_msgr_throttle_wait, throttle_stamp - recv_stamp);
 
   // read front
   front_len = header.front_len;
@@ -1821,6 +1877,7 @@ int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more)
     }
 
     int r = ::sendmsg(sd, msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    msgr->logger->inc(l_msgr_sendmsg);
     if (r == 0) 
       ldout(msgr->cct,10) << "do_sendmsg hmm do_sendmsg got r==0!" << dendl;
     if (r < 0) { 
@@ -1858,29 +1915,6 @@ int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more)
 }
 
 
-int Pipe::write_ack(uint64_t seq)
-{
-  ldout(msgr->cct,10) << "write_ack " << seq << dendl;
-
-  char c = CEPH_MSGR_TAG_ACK;
-  ceph_le64 s;
-  s = seq;
-
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(msg));
-  struct iovec msgvec[2];
-  msgvec[0].iov_base = &c;
-  msgvec[0].iov_len = 1;
-  msgvec[1].iov_base = &s;
-  msgvec[1].iov_len = sizeof(s);
-  msg.msg_iov = msgvec;
-  msg.msg_iovlen = 2;
-  
-  if (do_sendmsg(&msg, 1 + sizeof(s), true) < 0)
-    return -1;	
-  return 0;
-}
-
 int Pipe::write_keepalive()
 {
   ldout(msgr->cct,10) << "write_keepalive" << dendl;
@@ -1901,124 +1935,122 @@ int Pipe::write_keepalive()
 }
 
 
-int Pipe::write_message(ceph_msg_header& header, ceph_msg_footer& footer, bufferlist& blist)
+int Pipe::append_iov(struct msghdr *msg, struct iovec *msgvec, int *msglen,
+		     void *base, size_t len)
+{
+  if (msg->msg_iovlen >= IOV_MAX) {
+    if (do_sendmsg(msg, *msglen, true))
+      return -1;
+
+    // and restart the iov
+    msg->msg_iov = msgvec;
+    msg->msg_iovlen = 0;
+    *msglen = 0;
+  }
+  msgvec[msg->msg_iovlen].iov_base = base;
+  msgvec[msg->msg_iovlen].iov_len = len;
+  *msglen += len;
+  msg->msg_iovlen++;
+  return 0;
+}
+
+int Pipe::write_messages(const uint64_t *ack, list<Message*>& msgs,
+			 list<bufferlist>& blists)
 {
-  int ret;
+  int ret = -1;
+  bool new_header = connection_state->has_feature(CEPH_FEATURE_NOSRCADDR);
+  bool new_footer = connection_state->has_feature(CEPH_FEATURE_MSG_AUTH);
+
+  // envelopes for peers that want the old formats; these must outlive
+  // the sendmsg, so build them all up front
+  vector<ceph_msg_header_old> oldheaders(new_header ? 0 : msgs.size());
+  vector<ceph_msg_footer_old> oldfooters(new_footer ? 0 : msgs.size());
 
   // set up msghdr and iovecs
+  size_t iovs = 2;
+  for (list<bufferlist>::iterator q = blists.begin(); q != blists.end(); ++q)
+    iovs += 3 + q->buffers().size();  // conservative upper bound
   struct msghdr msg;
   memset(&msg, 0, sizeof(msg));
-  struct iovec *msgvec = new iovec[3 + blist.buffers().size()];  // conservative upper bound
+  struct iovec *msgvec = new iovec[MIN(iovs, (size_t)IOV_MAX)];
   msg.msg_iov = msgvec;
   int msglen = 0;
-  
-  // send tag
-  char tag = CEPH_MSGR_TAG_MSG;
-  msgvec[msg.msg_iovlen].iov_base = &tag;
-  msgvec[msg.msg_iovlen].iov_len = 1;
-  msglen++;
-  msg.msg_iovlen++;
-
-  // send envelope
-  ceph_msg_header_old oldheader;
-  if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
-    msgvec[msg.msg_iovlen].iov_base = (char*)&header;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(header);
-    msglen += sizeof(header);
-    msg.msg_iovlen++;
-  } else {
-    memcpy(&oldheader, &header, sizeof(header));
-    oldheader.src.name = header.src;
-    oldheader.src.addr = connection_state->get_peer_addr();
-    oldheader.orig_src = oldheader.src;
-    oldheader.reserved = header.reserved;
-    oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
-			      sizeof(oldheader) - sizeof(oldheader.crc));
-    msgvec[msg.msg_iovlen].iov_base = (char*)&oldheader;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(oldheader);
-    msglen += sizeof(oldheader);
-    msg.msg_iovlen++;
-  }
-
-  // payload (front+data)
-  list<bufferptr>::const_iterator pb = blist.buffers().begin();
-  int b_off = 0;  // carry-over buffer offset, if any
-  int bl_pos = 0; // blist pos
-  int left = blist.length();
-
-  while (left > 0) {
-    int donow = MIN(left, (int)pb->length()-b_off);
-    if (donow == 0) {
-      ldout(msgr->cct,0) << "donow = " << donow << " left " << left << " pb->length " << pb->length()
-	      << " b_off " << b_off << dendl;
-    }
-    assert(donow > 0);
-    ldout(msgr->cct,30) << " bl_pos " << bl_pos << " b_off " << b_off
-	     << " leftinchunk " << left
-	     << " buffer len " << pb->length()
-	     << " writing " << donow 
-	     << dendl;
-    
-    if (msg.msg_iovlen >= IOV_MAX-2) {
-      if (do_sendmsg(&msg, msglen, true))
-	goto fail;
-      
-      // and restart the iov
-      msg.msg_iov = msgvec;
-      msg.msg_iovlen = 0;
-      msglen = 0;
-    }
-    
-    msgvec[msg.msg_iovlen].iov_base = (void*)(pb->c_str()+b_off);
-    msgvec[msg.msg_iovlen].iov_len = donow;
-    msglen += donow;
-    msg.msg_iovlen++;
-    
-    left -= donow;
-    assert(left >= 0);
-    b_off += donow;
-    bl_pos += donow;
-    if (left == 0)
-      break;
-    while (b_off == (int)pb->length()) {
-      pb++;
-      b_off = 0;
-    }
+
+  char ack_tag = CEPH_MSGR_TAG_ACK;
+  char msg_tag = CEPH_MSGR_TAG_MSG;
+  ceph_le64 s;
+  if (ack) {
+    ldout(msgr->cct,10) << "write_messages ack " << *ack << dendl;
+    s = *ack;
+    if (append_iov(&msg, msgvec, &msglen, &ack_tag, 1) ||
+	append_iov(&msg, msgvec, &msglen, &s, sizeof(s)))
+      goto out;
   }
-  assert(left == 0);
 
-  // send footer; if receiver doesn't support signatures, use the old footer format
+  {
+    unsigned i = 0;
+    list<bufferlist>::iterator q = blists.begin();
+    for (list<Message*>::iterator p = msgs.begin(); p != msgs.end(); ++p, ++q, ++i) {
+      ceph_msg_header& header = (*p)->get_header();
+      ceph_msg_footer& footer = (*p)->get_footer();
+
+      // send tag
+      if (append_iov(&msg, msgvec, &msglen, &msg_tag, 1))
+	goto out;
+
+      // send envelope
+      if (new_header) {
+	if (append_iov(&msg, msgvec, &msglen, &header, sizeof(header)))
+	  goto out;
+      } else {
+	ceph_msg_header_old& oldheader = oldheaders[i];
+	memcpy(&oldheader, &header, sizeof(header));
+	oldheader.src.name = header.src;
+	oldheader.src.addr = connection_state->get_peer_addr();
+	oldheader.orig_src = oldheader.src;
+	oldheader.reserved = header.reserved;
+	oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
+				       sizeof(oldheader) - sizeof(oldheader.crc));
+	if (append_iov(&msg, msgvec, &msglen, &oldheader, sizeof(oldheader)))
+	  goto out;
+      }
 
-  ceph_msg_footer_old old_footer;
-  if (connection_state->has_feature(CEPH_FEATURE_MSG_AUTH)) {
-    msgvec[msg.msg_iovlen].iov_base = (void*)&footer;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(footer);
-    msglen += sizeof(footer);
-    msg.msg_iovlen++;
-  } else {
-    old_footer.front_crc = footer.front_crc;   
-    old_footer.middle_crc = footer.middle_crc;   
-    old_footer.data_crc = footer.data_crc;   
-    old_footer.flags = footer.flags;   
-    msgvec[msg.msg_iovlen].iov_base = (char*)&old_footer;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(old_footer);
-    msglen += sizeof(old_footer);
-    msg.msg_iovlen++;
+      // payload (front+middle+data)
+      for (bufferlist::buffers_t::const_iterator pb = q->buffers().begin();
+	   pb != q->buffers().end();
+	   ++pb) {
+	if (pb->length() == 0)
+	  continue;
+	ldout(msgr->cct,30) << " writing buffer len " << pb->length() << dendl;
+	if (append_iov(&msg, msgvec, &msglen, (void*)pb->c_str(), pb->length()))
+	  goto out;
+      }
+
+      // send footer; if receiver doesn't support signatures, use the old footer format
+      if (new_footer) {
+	if (append_iov(&msg, msgvec, &msglen, &footer, sizeof(footer)))
+	  goto out;
+      } else {
+	ceph_msg_footer_old& old_footer = oldfooters[i];
+	old_footer.front_crc = footer.front_crc;   
+	old_footer.middle_crc = footer.middle_crc;   
+	old_footer.data_crc = footer.data_crc;   
+	old_footer.flags = footer.flags;   
+	if (append_iov(&msg, msgvec, &msglen, &old_footer, sizeof(old_footer)))
+	  goto out;
+      }
+    }
   }
 
   // send
-  if (do_sendmsg(&msg, msglen))
-    goto fail;
+  if (msglen && do_sendmsg(&msg, msglen))
+    goto out;
 
   ret = 0;
 
  out:
   delete[] msgvec;
   return ret;
-
- fail:
-  ret = -1;
-  goto out;
 }
 
 
@@ -168,6 +168,8 @@ class DispatchQueue;
     __u32 connect_seq, peer_global_seq;
     uint64_t out_seq;
     uint64_t in_seq, in_seq_acked;
+
+    utime_t last_active;   // last time we read or wrote a Message
     
     int accept();   // server handshake
     int connect();  // client handshake
@@ -178,7 +180,25 @@ class DispatchQueue;
     int randomize_out_seq();
 
     int read_message(Message **pm);
-    int write_message(ceph_msg_header& h, ceph_msg_footer& f, bufferlist& body);
+    /**
+     * Write a batch of encoded Messages (and an optional ack ahead of
+     * them) to the socket with as few sendmsg calls as IOV_MAX allows.
+     *
+     * @param ack If non-NULL, the seq to ack before the Messages
+     * @param msgs The Messages to send, already encoded and signed
+     * @param blists The payload+middle+data of each Message, in order
+     * @return 0, or -1 on failure (unrecoverable -- close the socket).
+     */
+    int write_messages(const uint64_t *ack, list<Message*>& msgs,
+		       list<bufferlist>& blists);
+    /**
+     * Append an iovec to msg, first flushing msg (with MSG_MORE) if
+     * msgvec is full.
+     *
+     * @return 0, or -1 if the flush failed.
+     */
+    int append_iov(struct msghdr *msg, struct iovec *msgvec, int *msglen,
+		   void *base, size_t len);
     /**
      * Write the given data (of length len) to the Pipe's socket. This function
      * will loop until all passed data has been written out.
@@ -191,7 +211,6 @@ class DispatchQueue;
      * @return 0, or -1 on failure (unrecoverable -- close the socket).
      */
     int do_sendmsg(struct msghdr *msg, int len, bool more=false);
-    int write_ack(uint64_t s);
     int write_keepalive();
 
     void fault(bool reader=false);
@@ -244,27 +263,12 @@ class DispatchQueue;
     }
     void stop();
 
-    void _send(Message *m) {
-      out_q[m->get_priority()].push_back(m);
-      cond.Signal();
-    }
+    void _send(Message *m);
     void _send_keepalive() {
       keepalive = true;
       cond.Signal();
     }
-    Message *_get_next_outgoing() {
-      Message *m = 0;
-      while (!m && !out_q.empty()) {
-        map<int, list<Message*> >::reverse_iterator p = out_q.rbegin();
-        if (!p->second.empty()) {
-          m = p->second.front();
-          p->second.pop_front();
-        }
-        if (p->second.empty())
-          out_q.erase(p->first);
-      }
-      return m;
-    }
+    Message *_get_next_outgoing();
 
     /* Remove all messages from the sent queue. Add those with seq > max_acked
      * to the highest priority outgoing queue. */
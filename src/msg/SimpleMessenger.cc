@@ -22,6 +22,9 @@
 #include "common/config.h"
 #include "common/Timer.h"
 #include "common/errno.h"
+#include "common/admin_socket.h"
+#include "common/perf_counters.h"
+#include "common/Formatter.h"
 #include "auth/Crypto.h"
 
 #define dout_subsys ceph_subsys_ms
@@ -31,6 +34,26 @@ static ostream& _prefix(std::ostream *_dout, SimpleMessenger *msgr) {
   return *_dout << "-- " << msgr->get_myaddr() << " ";
 }
 
+/*
+ * SimpleMessengers in this process that accept in-process delivery,
+ * by address.  A messenger may be registered under several addresses
+ * (e.g., before and after it learns its IP).
+ */
+static pthread_mutex_t inprocess_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static map<entity_addr_t, SimpleMessenger*> inprocess_registry;
+
+class SimpleMessengerHook : public AdminSocketHook {
+  SimpleMessenger *msgr;
+public:
+  SimpleMessengerHook(SimpleMessenger *m) : msgr(m) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    msgr->dump_connections(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 
 /*******************
  * SimpleMessenger
@@ -44,17 +67,62 @@ SimpleMessenger::SimpleMessenger(CephContext *cct, entity_name_t name,
     reaper_thread(this),
     my_type(name.type()),
     nonce(_nonce),
-    lock("SimpleMessenger::lock"), need_addr(true), did_bind(false),
+    lock("SimpleMessenger::lock"), admin_hook(NULL),
+    need_addr(true), did_bind(false),
     global_seq(0),
     cluster_protocol(0),
     policy_lock("SimpleMessenger::policy_lock"),
     dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
     reaper_started(false), reaper_stop(false),
+    inprocess_lock("SimpleMessenger::inprocess_lock"),
+    inprocess_registered(false),
     timeout(0),
-    local_connection(new Connection)
+    local_connection(new Connection),
+    logger(NULL)
 {
   pthread_spin_init(&global_seq_lock, PTHREAD_PROCESS_PRIVATE);
   init_local_connection();
+
+  PerfCountersBuilder b(cct, string("msgr-") + mname, l_msgr_first, l_msgr_last);
+  b.add_u64_counter(l_msgr_mon_msgs_in, "mon_msgs_in");
+  b.add_u64_counter(l_msgr_mon_bytes_in, "mon_bytes_in");
+  b.add_u64_counter(l_msgr_mon_msgs_out, "mon_msgs_out");
+  b.add_u64_counter(l_msgr_mon_bytes_out, "mon_bytes_out");
+  b.add_u64_counter(l_msgr_mds_msgs_in, "mds_msgs_in");
+  b.add_u64_counter(l_msgr_mds_bytes_in, "mds_bytes_in");
+  b.add_u64_counter(l_msgr_mds_msgs_out, "mds_msgs_out");
+  b.add_u64_counter(l_msgr_mds_bytes_out, "mds_bytes_out");
+  b.add_u64_counter(l_msgr_osd_msgs_in, "osd_msgs_in");
+  b.add_u64_counter(l_msgr_osd_bytes_in, "osd_bytes_in");
+  b.add_u64_counter(l_msgr_osd_msgs_out, "osd_msgs_out");
+  b.add_u64_counter(l_msgr_osd_bytes_out, "osd_bytes_out");
+  b.add_u64_counter(l_msgr_client_msgs_in, "client_msgs_in");
+  b.add_u64_counter(l_msgr_client_bytes_in, "client_bytes_in");
+  b.add_u64_counter(l_msgr_client_msgs_out, "client_msgs_out");
+  b.add_u64_counter(l_msgr_client_bytes_out, "client_bytes_out");
+  b.add_u64_counter(l_msgr_other_msgs_in, "other_msgs_in");
+  b.add_u64_counter(l_msgr_other_bytes_in, "other_bytes_in");
+  b.add_u64_counter(l_msgr_other_msgs_out, "other_msgs_out");
+  b.add_u64_counter(l_msgr_other_bytes_out, "other_bytes_out");
+  b.add_u64(l_msgr_send_queue, "send_queue");
+  b.add_u64_counter(l_msgr_reconnect, "reconnect");
+  b.add_time_avg(l_msgr_throttle_wait, "throttle_wait");
+  b.add_u64_counter(l_msgr_sendmsg, "sendmsg");
+  b.add_u64_avg(l_msgr_write_batch, "write_batch");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  admin_hook = new SimpleMessengerHook(this);
+  admin_command = string("msgr connections ") + mname;
+  int r = cct->get_admin_socket()->register_command(admin_command, admin_hook,
+						   "dump state of " + mname + " messenger connections");
+  if (r < 0) {
+    // another messenger by the same name in this process; only it gets dumped
+    ldout(cct,1) << "unable to register admin socket command '" << admin_command
+		 << "': " << cpp_strerror(r) << dendl;
+    delete admin_hook;
+    admin_hook = NULL;
+  }
 }
 
 /**
@@ -66,7 +134,15 @@ SimpleMessenger::~SimpleMessenger()
   assert(!did_bind); // either we didn't bind or we shut down the Accepter
   assert(rank_pipe.empty()); // we don't have any running Pipes.
   assert(reaper_stop && !reaper_started); // the reaper thread is stopped
+  inprocess_unregister();
+  inprocess_mark_down(NULL);
   local_connection->put();
+  if (admin_hook) {
+    cct->get_admin_socket()->unregister_command(admin_command);
+    delete admin_hook;
+  }
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
 }
 
 void SimpleMessenger::ready()
@@ -84,6 +160,7 @@ void SimpleMessenger::ready()
 int SimpleMessenger::shutdown()
 {
   ldout(cct,10) << "shutdown " << get_myaddr() << dendl;
+  inprocess_unregister();
   dispatch_queue.shutdown();
   mark_down_all();
   return 0;
@@ -271,9 +348,13 @@ int SimpleMessenger::bind(const entity_addr_t &bind_addr)
 int SimpleMessenger::rebind(int avoid_port)
 {
   ldout(cct,1) << "rebind avoid " << avoid_port << dendl;
+  inprocess_unregister();
   mark_down_all();
   assert(did_bind);
-  return accepter.rebind(avoid_port);
+  int r = accepter.rebind(avoid_port);
+  if (cct->_conf->ms_inprocess_delivery)
+    inprocess_register();
+  return r;
 }
 
 int SimpleMessenger::start()
@@ -292,6 +373,9 @@ int SimpleMessenger::start()
 
   lock.Unlock();
 
+  if (cct->_conf->ms_inprocess_delivery)
+    inprocess_register();
+
   reaper_started = true;
   reaper_thread.create();
   return 0;
@@ -364,6 +448,25 @@ Connection *SimpleMessenger::get_connection(const entity_inst_t& dest)
     return (Connection *)local_connection->get();
   }
 
+  // in-process?
+  if (inprocess_registered) {
+    pthread_mutex_lock(&inprocess_registry_lock);
+    bool found = inprocess_registry.count(dest.addr);
+    if (found) {
+      inprocess_lock.Lock();
+      bool is_new = false;
+      InProcessPeer& peer = _get_inprocess_peer(dest.addr, dest.name.type(), &is_new);
+      Connection *con = peer.con->get();
+      inprocess_lock.Unlock();
+      if (is_new)
+	dispatch_queue.queue_connect(con);
+      ldout(cct, 10) << "get_connection " << dest << " in-process " << con << dendl;
+      pthread_mutex_unlock(&inprocess_registry_lock);
+      return con;
+    }
+    pthread_mutex_unlock(&inprocess_registry_lock);
+  }
+
   // remote
   while (true) {
     Pipe *pipe = _lookup_pipe(dest.addr);
@@ -422,6 +525,10 @@ void SimpleMessenger::submit_message(Message *m, Connection *con,
     return;
   }
 
+  // another messenger in this process?
+  if (try_inprocess_delivery(m, dest_addr))
+    return;
+
   // remote, no existing pipe.
   const Policy& policy = get_policy(dest_type);
   if (policy.server) {
@@ -552,6 +659,7 @@ void SimpleMessenger::mark_down_all()
 {
   ldout(cct,1) << "mark_down_all" << dendl;
   lock.Lock();
+  inprocess_mark_down(NULL);
   while (!rank_pipe.empty()) {
     hash_map<entity_addr_t,Pipe*>::iterator it = rank_pipe.begin();
     Pipe *p = it->second;
@@ -578,6 +686,7 @@ void SimpleMessenger::mark_down(const entity_addr_t& addr)
   } else {
     ldout(cct,1) << "mark_down " << addr << " -- pipe dne" << dendl;
   }
+  inprocess_mark_down(&addr);
   lock.Unlock();
 }
 
@@ -595,6 +704,7 @@ void SimpleMessenger::mark_down(Connection *con)
     p->put();
   } else {
     ldout(cct,1) << "mark_down " << con << " -- pipe dne" << dendl;
+    inprocess_mark_down(&con->get_peer_addr());
   }
   lock.Unlock();
 }
@@ -658,6 +768,8 @@ void SimpleMessenger::learned_addr(const entity_addr_t &peer_addr_for_me)
     ldout(cct,1) << "learned my addr " << my_inst.addr << dendl;
     need_addr = false;
     init_local_connection();
+    if (inprocess_registered)
+      inprocess_register();
   }
   lock.Unlock();
 }
@@ -674,3 +786,199 @@ void SimpleMessenger::init_local_connection()
   local_connection->peer_addr = my_inst.addr;
   local_connection->peer_type = my_type;
 }
+
+
+/*******************
+ * in-process delivery
+ */
+
+void SimpleMessenger::inprocess_register()
+{
+  ldout(cct,10) << "inprocess_register " << my_inst.addr << dendl;
+  pthread_mutex_lock(&inprocess_registry_lock);
+  map<entity_addr_t, SimpleMessenger*>::iterator p = inprocess_registry.find(my_inst.addr);
+  if (p != inprocess_registry.end() && p->second != this) {
+    // two messengers claiming the same address; let them use the network
+    ldout(cct,0) << "inprocess_register " << my_inst.addr << " already registered by "
+		 << p->second << dendl;
+  } else {
+    inprocess_registry[my_inst.addr] = this;
+    inprocess_registered = true;
+  }
+  pthread_mutex_unlock(&inprocess_registry_lock);
+}
+
+void SimpleMessenger::inprocess_unregister()
+{
+  pthread_mutex_lock(&inprocess_registry_lock);
+  if (inprocess_registered) {
+    ldout(cct,10) << "inprocess_unregister" << dendl;
+    map<entity_addr_t, SimpleMessenger*>::iterator p = inprocess_registry.begin();
+    while (p != inprocess_registry.end()) {
+      if (p->second == this)
+	inprocess_registry.erase(p++);
+      else
+	++p;
+    }
+    inprocess_registered = false;
+  }
+  pthread_mutex_unlock(&inprocess_registry_lock);
+}
+
+void SimpleMessenger::inprocess_mark_down(const entity_addr_t *addr)
+{
+  Mutex::Locker l(inprocess_lock);
+  map<entity_addr_t, InProcessPeer>::iterator p;
+  if (addr)
+    p = inprocess_peers.find(*addr);
+  else
+    p = inprocess_peers.begin();
+  while (p != inprocess_peers.end()) {
+    ldout(cct,10) << "inprocess_mark_down " << p->first << " " << p->second.con << dendl;
+    p->second.con->put();
+    inprocess_peers.erase(p++);
+    if (addr)
+      break;
+  }
+}
+
+SimpleMessenger::InProcessPeer&
+SimpleMessenger::_get_inprocess_peer(const entity_addr_t& addr, int type, bool *is_new)
+{
+  assert(inprocess_lock.is_locked());
+  map<entity_addr_t, InProcessPeer>::iterator p = inprocess_peers.find(addr);
+  if (p != inprocess_peers.end())
+    return p->second;
+
+  InProcessPeer& peer = inprocess_peers[addr];
+  peer.con = new Connection;
+  peer.con->set_peer_addr(addr);
+  peer.con->set_peer_type(type);
+  // same binary, so same feature set
+  peer.con->set_features(CEPH_FEATURES_ALL);
+  peer.conn_id = dispatch_queue.get_id();
+  ldout(cct,10) << "_get_inprocess_peer " << addr << " new con " << peer.con
+		<< " id " << peer.conn_id << dendl;
+  *is_new = true;
+  return peer;
+}
+
+bool SimpleMessenger::try_inprocess_delivery(Message *m, const entity_addr_t& dest_addr)
+{
+  if (!inprocess_registered)
+    return false;
+
+  pthread_mutex_lock(&inprocess_registry_lock);
+  map<entity_addr_t, SimpleMessenger*>::iterator p = inprocess_registry.find(dest_addr);
+  if (p == inprocess_registry.end()) {
+    pthread_mutex_unlock(&inprocess_registry_lock);
+    return false;
+  }
+  ldout(cct,20) << "submit_message " << *m << " in-process, " << dest_addr
+		<< " msgr " << p->second << dendl;
+  // an already-encoded copy (see send_message_multi()) can't be
+  // dispatched as is; hand over the Message it encodes
+  PreEncodedMessage *pre = dynamic_cast<PreEncodedMessage*>(m);
+  if (pre) {
+    m = pre->decode_copy(cct);
+    pre->put();
+    if (!m) {
+      pthread_mutex_unlock(&inprocess_registry_lock);
+      ldout(cct,0) << "submit_message failed to decode pre-encoded message for "
+		   << dest_addr << ", dropping" << dendl;
+      return true;
+    }
+  }
+  // hold the registry lock so the receiver cannot go away under us
+  p->second->inprocess_receive(m, my_inst.addr, my_type);
+  pthread_mutex_unlock(&inprocess_registry_lock);
+  return true;
+}
+
+void SimpleMessenger::inprocess_receive(Message *m, const entity_addr_t& from, int from_type)
+{
+  m->set_recv_stamp(ceph_clock_now(cct));
+
+  inprocess_lock.Lock();
+  bool is_new = false;
+  InProcessPeer& peer = _get_inprocess_peer(from, from_type, &is_new);
+  m->set_connection(peer.con->get());
+  m->set_seq(++peer.in_seq);
+  uint64_t conn_id = peer.conn_id;
+  if (is_new)
+    dispatch_queue.queue_accept(peer.con);
+  inprocess_lock.Unlock();
+
+  ldout(cct,20) << "inprocess_receive " << m->get_seq() << " " << m << " " << *m
+		<< " from " << from << dendl;
+  m->set_recv_complete_stamp(m->get_recv_stamp());
+  dispatch_queue.enqueue(m, m->get_priority(), conn_id);
+}
+
+void SimpleMessenger::dump_connections(ostream& out)
+{
+  JSONFormatter f(true);
+  utime_t now = ceph_clock_now(cct);
+
+  f.open_object_section("messenger");
+  f.dump_stream("addr") << get_myaddr();
+
+  lock.Lock();
+  f.open_array_section("pipes");
+  for (set<Pipe*>::iterator p = pipes.begin(); p != pipes.end(); ++p) {
+    Pipe *pipe = *p;
+    Mutex::Locker l(pipe->pipe_lock);
+    f.open_object_section("pipe");
+    f.dump_stream("peer") << ceph_entity_type_name(pipe->peer_type) << " " << pipe->peer_addr;
+    f.dump_string("state", pipe->get_state_name());
+    f.dump_int("lossy", pipe->policy.lossy);
+    f.dump_unsigned("features", pipe->connection_state->get_features());
+    f.dump_unsigned("connect_seq", pipe->connect_seq);
+    f.dump_unsigned("in_seq", pipe->in_seq);
+    f.dump_unsigned("out_seq", pipe->out_seq);
+
+    unsigned queued = 0;
+    uint64_t queued_bytes = 0;
+    for (map<int, list<Message*> >::iterator q = pipe->out_q.begin();
+	 q != pipe->out_q.end();
+	 ++q) {
+      for (list<Message*>::iterator m = q->second.begin(); m != q->second.end(); ++m) {
+	queued++;
+	queued_bytes += (*m)->get_payload().length() + (*m)->get_middle().length() +
+	  (*m)->get_data().length();
+      }
+    }
+    uint64_t unacked_bytes = 0;
+    for (list<Message*>::iterator m = pipe->sent.begin(); m != pipe->sent.end(); ++m)
+      unacked_bytes += (*m)->get_payload().length() + (*m)->get_middle().length() +
+	(*m)->get_data().length();
+    f.dump_unsigned("queue_len", queued);
+    f.dump_unsigned("queue_bytes", queued_bytes);
+    f.dump_unsigned("unacked_len", pipe->sent.size());
+    f.dump_unsigned("unacked_bytes", unacked_bytes);
+    f.dump_unsigned("in_flight_bytes", queued_bytes + unacked_bytes);
+    f.dump_stream("last_active") << pipe->last_active;
+    if (pipe->last_active != utime_t())
+      f.dump_float("idle", (double)(now - pipe->last_active));
+    f.close_section();
+  }
+  f.close_section();
+  lock.Unlock();
+
+  inprocess_lock.Lock();
+  f.open_array_section("inprocess_peers");
+  for (map<entity_addr_t, InProcessPeer>::iterator p = inprocess_peers.begin();
+       p != inprocess_peers.end();
+       ++p) {
+    f.open_object_section("peer");
+    f.dump_stream("peer") << ceph_entity_type_name(p->second.con->get_peer_type())
+			  << " " << p->first;
+    f.dump_unsigned("in_seq", p->second.in_seq);
+    f.close_section();
+  }
+  f.close_section();
+  inprocess_lock.Unlock();
+
+  f.close_section();
+  f.flush(out);
+}
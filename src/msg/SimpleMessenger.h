@@ -39,6 +39,44 @@ using namespace __gnu_cxx;
 #include "Pipe.h"
 #include "Accepter.h"
 
+class AdminSocketHook;
+class PerfCounters;
+
+/*
+ * Each peer type gets four consecutive counters: msgs_in, bytes_in,
+ * msgs_out and bytes_out (see SimpleMessenger::get_peer_type_counters()).
+ * Only traffic over Pipes is counted.
+ */
+enum {
+  l_msgr_first = 94000,
+  l_msgr_mon_msgs_in,
+  l_msgr_mon_bytes_in,
+  l_msgr_mon_msgs_out,
+  l_msgr_mon_bytes_out,
+  l_msgr_mds_msgs_in,
+  l_msgr_mds_bytes_in,
+  l_msgr_mds_msgs_out,
+  l_msgr_mds_bytes_out,
+  l_msgr_osd_msgs_in,
+  l_msgr_osd_bytes_in,
+  l_msgr_osd_msgs_out,
+  l_msgr_osd_bytes_out,
+  l_msgr_client_msgs_in,
+  l_msgr_client_bytes_in,
+  l_msgr_client_msgs_out,
+  l_msgr_client_bytes_out,
+  l_msgr_other_msgs_in,
+  l_msgr_other_bytes_in,
+  l_msgr_other_msgs_out,
+  l_msgr_other_bytes_out,
+  l_msgr_send_queue,       // Messages queued on all our Pipes
+  l_msgr_reconnect,        // Pipe faults we reconnect after
+  l_msgr_throttle_wait,    // time a reader blocked on the policy/dispatch throttlers
+  l_msgr_sendmsg,          // sendmsg(2) calls made by Pipe writers
+  l_msgr_write_batch,      // Messages written per writer wakeup
+  l_msgr_last,
+};
+
 /*
  * This class handles transmission and reception of messages. Generally
  * speaking, there are several major components:
@@ -67,6 +105,11 @@ using namespace __gnu_cxx;
  *       Pipe::pipe_lock
  *           DispatchQueue::lock
  *               IncomingQueue::lock
+ *
+ *   SimpleMessenger::lock
+ *       in-process registry lock (SimpleMessenger.cc)
+ *           SimpleMessenger::inprocess_lock (of the sender or the receiver)
+ *               DispatchQueue::lock
  */
 
 class SimpleMessenger : public Messenger {
@@ -467,6 +510,34 @@ private:
    * Look through the pipes in the pipe_reap_queue and tear them down.
    */
   void reaper();
+  /**
+   * Make ourselves reachable by other SimpleMessengers in this process
+   * under our current address (in addition to any earlier ones).
+   */
+  void inprocess_register();
+  /**
+   * Stop accepting in-process deliveries, under any address.
+   */
+  void inprocess_unregister();
+  /**
+   * Drop our in-process peer state for the given address, or for all
+   * peers if addr is NULL.
+   */
+  void inprocess_mark_down(const entity_addr_t *addr);
+  /**
+   * If the given address belongs to another SimpleMessenger in this
+   * process, hand the Message straight to it without encoding it.
+   *
+   * @param m The Message to deliver. Consumed on success.
+   * @param dest_addr The address we are sending to.
+   * @return true if the Message was delivered in-process.
+   */
+  bool try_inprocess_delivery(Message *m, const entity_addr_t& dest_addr);
+  /**
+   * Receive a Message from another SimpleMessenger in this process,
+   * and queue it for dispatch as if it arrived on a Pipe.
+   */
+  void inprocess_receive(Message *m, const entity_addr_t& from, int from_type);
   /**
    * @} // Utility functions
    */
@@ -478,6 +549,9 @@ private:
   uint64_t nonce;
   /// overall lock used for SimpleMessenger data structures
   Mutex lock;
+  /// admin socket command to dump our connections, if we registered one
+  string admin_command;
+  AdminSocketHook *admin_hook;
   /// true, specifying we haven't learned our addr; set false when we find it.
   // maybe this should be protected by the lock?
   bool need_addr;
@@ -509,6 +583,34 @@ private:
   /// a list of Pipes we want to tear down
   list<Pipe*>     pipe_reap_queue;
 
+  /**
+   * Peers in this process that we exchange Messages with directly
+   * (see ms_inprocess_delivery). These have a Connection but no Pipe;
+   * conn_id keeps their Messages ordered in the DispatchQueue.
+   */
+  struct InProcessPeer {
+    Connection *con;
+    uint64_t conn_id;
+    uint64_t in_seq;
+    InProcessPeer() : con(NULL), conn_id(0), in_seq(0) {}
+  };
+  /// lock protecting inprocess_peers; nests inside the in-process registry lock
+  Mutex inprocess_lock;
+  map<entity_addr_t, InProcessPeer> inprocess_peers;
+  /// true if other SimpleMessengers in this process can reach us directly
+  bool inprocess_registered;
+  /**
+   * Look up (or create) the Connection we use for an in-process peer.
+   * Must hold inprocess_lock.
+   *
+   * @param addr The peer's address.
+   * @param type The peer's entity type.
+   * @param is_new Set to true if we did not know about this peer yet.
+   * @return The peer state, which we keep a Connection reference for.
+   */
+  InProcessPeer& _get_inprocess_peer(const entity_addr_t& addr, int type,
+				     bool *is_new);
+
   /// internal cluster protocol version, if any, for talking to entities of the same type.
   int cluster_protocol;
 
@@ -552,6 +654,28 @@ public:
    * @{
    */
 
+  /// our messenger perf counters
+  PerfCounters *logger;
+
+  /**
+   * Get the index of the msgs_in counter for the given peer type; its
+   * bytes_in, msgs_out and bytes_out counters follow it.
+   */
+  static int get_peer_type_counters(int peer_type) {
+    switch (peer_type) {
+    case CEPH_ENTITY_TYPE_MON: return l_msgr_mon_msgs_in;
+    case CEPH_ENTITY_TYPE_MDS: return l_msgr_mds_msgs_in;
+    case CEPH_ENTITY_TYPE_OSD: return l_msgr_osd_msgs_in;
+    case CEPH_ENTITY_TYPE_CLIENT: return l_msgr_client_msgs_in;
+    default: return l_msgr_other_msgs_in;
+    }
+  }
+  /**
+   * Dump the state of each of our Pipes (and in-process peers) for the
+   * admin socket.
+   */
+  void dump_connections(ostream& out);
+
   /**
    * This wraps ms_deliver_get_authorizer. We use it for Pipe.
    */
@@ -376,7 +376,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   fsid_fd(-1), op_fd(-1),
   basedir_fd(-1), current_fd(-1),
   index_manager(do_update),
-  ondisk_finisher(g_ceph_context),
+  ondisk_finisher(g_ceph_context, "filestore-ondisk",
+		  MAX(g_conf->filestore_finisher_threads, 1)),
   lock("FileStore::lock"),
   force_sync(false), sync_epoch(0),
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
@@ -385,7 +386,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   default_osr("default"),
   op_queue_len(0), op_queue_bytes(0),
   op_throttle_lock("FileStore::op_throttle_lock"),
-  op_finisher(g_ceph_context),
+  op_finisher(g_ceph_context, "filestore-apply",
+	      MAX(g_conf->filestore_finisher_threads, 1)),
   op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads, "filestore_op_threads"),
   op_wq(this, g_conf->filestore_op_thread_timeout,
 	g_conf->filestore_op_thread_suicide_timeout, &op_tp),
@@ -1986,7 +1988,7 @@ void FileStore::_finish_op(OpSequencer *osr)
     o->onreadable_sync->finish(0);
     delete o->onreadable_sync;
   }
-  op_finisher.queue(o->onreadable);
+  op_finisher.queue(osr, o->onreadable);
   delete o;
 }
 
@@ -2088,7 +2090,7 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
     onreadable_sync->finish(r);
     delete onreadable_sync;
   }
-  op_finisher.queue(onreadable, r);
+  op_finisher.queue(osr, onreadable, r);
 
   submit_manager.op_submit_finish(op);
   apply_manager.op_apply_finish(op);
@@ -2109,7 +2111,7 @@ void FileStore::_journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk)
   // getting blocked behind an ondisk completion.
   if (ondisk) {
     dout(10) << " queueing ondisk " << ondisk << dendl;
-    ondisk_finisher.queue(ondisk);
+    ondisk_finisher.queue(osr, ondisk);
   }
 }
 
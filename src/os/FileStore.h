@@ -85,7 +85,7 @@ private:
   // ObjectMap
   boost::scoped_ptr<ObjectMap> object_map;
   
-  Finisher ondisk_finisher;
+  MultiFinisher ondisk_finisher;
 
   // helper fns
   int get_cdir(coll_t cid, char *s, int len);
@@ -203,7 +203,7 @@ private:
   uint64_t op_queue_len, op_queue_bytes;
   Cond op_throttle_cond;
   Mutex op_throttle_lock;
-  Finisher op_finisher;
+  MultiFinisher op_finisher;
 
   ThreadPool op_tp;
   struct OpWQ : public ThreadPool::WorkQueue<OpSequencer> {
@@ -1064,6 +1064,10 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_rw_outb,"op_rw_out_bytes");  // client rmw out bytes
   osd_plb.add_time_avg(l_osd_op_rw_rlat,"op_rw_rlat");  // client rmw readable/applied latency
   osd_plb.add_time_avg(l_osd_op_rw_lat, "op_rw_latency");   // client rmw latency
+  osd_plb.add_time_histogram(l_osd_op_r_lat_outb_hist, "op_r_latency_out_bytes_histogram",
+			     "latency_usec", 32, "out_bytes", 32);  // client read latency x size
+  osd_plb.add_time_histogram(l_osd_op_w_lat_inb_hist, "op_w_latency_in_bytes_histogram",
+			     "latency_usec", 32, "in_bytes", 32);   // client write latency x size
 
   osd_plb.add_u64_counter(l_osd_sop,       "subop");         // subops
   osd_plb.add_u64_counter(l_osd_sop_inb,   "subop_in_bytes");     // subop in bytes
@@ -3993,10 +3997,10 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
+	// shares crush, pg_temp, etc. with prev until the incremental
+	// changes them
 	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
+	*o = *prev;
       }
 
       OSDMap::Incremental inc;
@@ -4009,12 +4013,15 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       pinned_maps.push_back(add_map(o));
 
-      bufferlist fbl;
-      o->encode(fbl);
+      // between checkpoints, the incremental is all we keep
+      if (service.should_store_full_map(e)) {
+	bufferlist fbl;
+	o->encode(fbl);
 
-      hobject_t fulloid = get_osdmap_pobject_name(e);
-      t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
-      pin_map_bl(e, fbl);
+	hobject_t fulloid = get_osdmap_pobject_name(e);
+	t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
+	pin_map_bl(e, fbl);
+      }
       continue;
     }
 
@@ -4026,16 +4033,40 @@ void OSD::handle_osd_map(MOSDMap *m)
     epoch_t min(
       MIN(m->oldest_map,
 	  service.map_cache.cached_key_lower_bound()));
-    for (epoch_t e = superblock.oldest_map; e < min; ++e) {
-      dout(20) << " removing old osdmap epoch " << e << dendl;
-      t.remove(coll_t::META_COLL, get_osdmap_pobject_name(e));
-      t.remove(coll_t::META_COLL, get_inc_osdmap_pobject_name(e));
-      superblock.oldest_map = e+1;
+    epoch_t oldest = superblock.oldest_map;
+    while (oldest < min) {
+      ++oldest;
       num++;
       if (num >= g_conf->osd_target_transaction_size &&
 	  (uint64_t)num > (last - first))  // make sure we at least keep pace with incoming maps
 	break;
     }
+
+    // the oldest map we keep must be stored in full: the later ones are
+    // rebuilt from it.  build it while the maps before it are still
+    // there, and keep them if we can't.
+    bufferlist bl;
+    if (num &&
+	!store->exists(coll_t::META_COLL, get_osdmap_pobject_name(oldest))) {
+      if (get_map_bl(oldest, bl)) {
+	dout(20) << " storing full osdmap epoch " << oldest << dendl;
+	t.write(coll_t::META_COLL, get_osdmap_pobject_name(oldest), 0, bl.length(), bl);
+	pin_map_bl(oldest, bl);
+      } else {
+	derr << "unable to build full osdmap epoch " << oldest
+	     << ", not removing older maps" << dendl;
+	num = 0;
+      }
+    }
+
+    if (num) {
+      for (epoch_t e = superblock.oldest_map; e < oldest; ++e) {
+	dout(20) << " removing old osdmap epoch " << e << dendl;
+	t.remove(coll_t::META_COLL, get_osdmap_pobject_name(e));
+	t.remove(coll_t::META_COLL, get_inc_osdmap_pobject_name(e));
+      }
+      superblock.oldest_map = oldest;
+    }
   }
 
   if (!superblock.oldest_map || skip_maps)
@@ -4198,6 +4229,8 @@ void OSD::check_osdmap_features()
     features |= CEPH_FEATURE_CRUSH_TUNABLES;
   if (osdmap->crush->has_nondefault_tunables2())
     features |= CEPH_FEATURE_CRUSH_TUNABLES2;
+  if (osdmap->crush->has_straw2_buckets())
+    features |= CEPH_FEATURE_CRUSH_STRAW2;
 
   {
     Messenger::Policy p = client_messenger->get_default_policy();
@@ -4505,6 +4538,19 @@ void OSD::send_incremental_map(epoch_t since, Connection *con)
 }
 
 bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
+{
+  if (_get_stored_map_bl(e, bl))
+    return true;
+  OSDMap *m = _build_map(e);
+  if (!m)
+    return false;
+  m->encode(bl);
+  delete m;
+  _add_map_bl(e, bl);
+  return true;
+}
+
+bool OSDService::_get_stored_map_bl(epoch_t e, bufferlist& bl)
 {
   bool found = map_bl_cache.lookup(e, &bl);
   if (found)
@@ -4516,9 +4562,49 @@ bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
   return found;
 }
 
-bool OSDService::get_inc_map_bl(epoch_t e, bufferlist& bl)
+/*
+ * Full maps are only stored every osd_map_full_interval epochs.  Build
+ * one we don't have from the nearest earlier map we do have, cached or
+ * stored, and the incrementals since.
+ */
+OSDMap *OSDService::_build_map(epoch_t e)
+{
+  OSDMap *m = new OSDMap;
+  epoch_t from = e;
+  for (; from > 0; --from) {
+    OSDMapRef cached = map_cache.lookup(from);
+    if (cached) {
+      *m = *cached;
+      break;
+    }
+    bufferlist bl;
+    if (_get_stored_map_bl(from, bl)) {
+      m->decode(bl);
+      break;
+    }
+  }
+  if (from == 0) {
+    delete m;
+    return NULL;
+  }
+  dout(20) << "build_map " << e << " from " << from << dendl;
+  for (epoch_t i = from + 1; i <= e; ++i) {
+    bufferlist bl;
+    if (!_get_inc_map_bl(i, bl)) {
+      derr << "build_map " << e << " missing incremental " << i << dendl;
+      delete m;
+      return NULL;
+    }
+    OSDMap::Incremental inc;
+    bufferlist::iterator p = bl.begin();
+    inc.decode(p);
+    m->apply_incremental(inc);
+  }
+  return m;
+}
+
+bool OSDService::_get_inc_map_bl(epoch_t e, bufferlist& bl)
 {
-  Mutex::Locker l(map_cache_lock);
   bool found = map_bl_inc_cache.lookup(e, &bl);
   if (found)
     return true;
@@ -4588,8 +4674,13 @@ OSDMapRef OSDService::get_map(epoch_t epoch)
   if (epoch > 0) {
     dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
     bufferlist bl;
-    assert(_get_map_bl(epoch, bl));
-    map->decode(bl);
+    if (_get_stored_map_bl(epoch, bl)) {
+      map->decode(bl);
+    } else {
+      delete map;
+      map = _build_map(epoch);
+      assert(map);
+    }
   } else {
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
   }
@@ -77,6 +77,8 @@ enum {
   l_osd_op_rw_outb,
   l_osd_op_rw_rlat,
   l_osd_op_rw_lat,
+  l_osd_op_r_lat_outb_hist,
+  l_osd_op_w_lat_inb_hist,
 
   l_osd_sop,
   l_osd_sop_inb,
@@ -361,6 +363,12 @@ public:
     return _get_map_bl(e, bl);
   }
   bool _get_map_bl(epoch_t e, bufferlist& bl);
+  bool _get_stored_map_bl(epoch_t e, bufferlist& bl);
+  bool should_store_full_map(epoch_t e) const {
+    return g_conf->osd_map_full_interval <= 1 ||
+      e % g_conf->osd_map_full_interval == 0;
+  }
+  OSDMap *_build_map(epoch_t e);
 
   void add_map_inc_bl(epoch_t e, bufferlist& bl) {
     Mutex::Locker l(map_cache_lock);
@@ -368,7 +376,11 @@ public:
   }
   void pin_map_inc_bl(epoch_t e, bufferlist &bl);
   void _add_map_inc_bl(epoch_t e, bufferlist& bl);
-  bool get_inc_map_bl(epoch_t e, bufferlist& bl);
+  bool get_inc_map_bl(epoch_t e, bufferlist& bl) {
+    Mutex::Locker l(map_cache_lock);
+    return _get_inc_map_bl(e, bl);
+  }
+  bool _get_inc_map_bl(epoch_t e, bufferlist& bl);
 
   void clear_map_bl_cache_pins(epoch_t e);
 
@@ -647,7 +659,8 @@ private:
 	qlock("OpWQ::qlock"),
 	osd(o),
 	pqueue(o->cct->_conf->osd_op_pq_max_tokens_per_priority,
-	       o->cct->_conf->osd_op_pq_min_cost)
+	       o->cct->_conf->osd_op_pq_min_cost,
+	       o->cct->_conf->osd_op_pq_cost_fair)
     {}
 
     void dump(Formatter *f) {
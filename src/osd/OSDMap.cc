@@ -19,6 +19,9 @@
 #include "include/ceph_features.h"
 
 #include "common/code_environment.h"
+#include "common/mempool.h"
+
+#include <unistd.h>
 
 #define dout_subsys ceph_subsys_osd
 
@@ -585,6 +588,8 @@ void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
 // ----------------------------------
 // OSDMap
 
+MEMPOOL_DEFINE_OBJECT_FACTORY(OSDMap, osdmap)
+
 void OSDMap::set_epoch(epoch_t e)
 {
   epoch = e;
@@ -612,6 +617,8 @@ bool OSDMap::is_blacklisted(const entity_addr_t& a) const
 
 void OSDMap::set_max_osd(int m)
 {
+  if (m != max_osd)
+    _invalidate_pg_mapping();
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -622,6 +629,10 @@ void OSDMap::set_max_osd(int m)
   }
   osd_info.resize(m);
   osd_xinfo.resize(m);
+  if (osd_addrs->client_addr.size() != (unsigned)m)
+    _cow(osd_addrs);
+  if (osd_uuid->size() != (unsigned)m)
+    _cow(osd_uuid);
   osd_addrs->client_addr.resize(m);
   osd_addrs->cluster_addr.resize(m);
   osd_addrs->hb_addr.resize(m);
@@ -721,49 +732,70 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
 
   int diff = 0;
 
-  // do addrs match?
-  if (o->max_osd != n->max_osd)
-    diff++;
-  for (int i = 0; i < o->max_osd && i < n->max_osd; i++) {
-    if ( n->osd_addrs->client_addr[i] &&  o->osd_addrs->client_addr[i] &&
-	*n->osd_addrs->client_addr[i] == *o->osd_addrs->client_addr[i])
-      n->osd_addrs->client_addr[i] = o->osd_addrs->client_addr[i];
-    else
-      diff++;
-    if ( n->osd_addrs->cluster_addr[i] &&  o->osd_addrs->cluster_addr[i] &&
-	*n->osd_addrs->cluster_addr[i] == *o->osd_addrs->cluster_addr[i])
-      n->osd_addrs->cluster_addr[i] = o->osd_addrs->cluster_addr[i];
-    else
-      diff++;
-    if ( n->osd_addrs->hb_addr[i] &&  o->osd_addrs->hb_addr[i] &&
-	*n->osd_addrs->hb_addr[i] == *o->osd_addrs->hb_addr[i])
-      n->osd_addrs->hb_addr[i] = o->osd_addrs->hb_addr[i];
-    else
+  // do addrs match?  if n's are shared with another map, leave them be;
+  // the entries came from a copy and are shared already.
+  if (n->osd_addrs != o->osd_addrs && n->osd_addrs.unique()) {
+    if (o->max_osd != n->max_osd)
       diff++;
-  }
-  if (diff == 0) {
-    // zoinks, no differences at all!
-    n->osd_addrs = o->osd_addrs;
+    for (int i = 0; i < o->max_osd && i < n->max_osd; i++) {
+      if ( n->osd_addrs->client_addr[i] &&  o->osd_addrs->client_addr[i] &&
+	  *n->osd_addrs->client_addr[i] == *o->osd_addrs->client_addr[i])
+	n->osd_addrs->client_addr[i] = o->osd_addrs->client_addr[i];
+      else
+	diff++;
+      if ( n->osd_addrs->cluster_addr[i] &&  o->osd_addrs->cluster_addr[i] &&
+	  *n->osd_addrs->cluster_addr[i] == *o->osd_addrs->cluster_addr[i])
+	n->osd_addrs->cluster_addr[i] = o->osd_addrs->cluster_addr[i];
+      else
+	diff++;
+      if ( n->osd_addrs->hb_addr[i] &&  o->osd_addrs->hb_addr[i] &&
+	  *n->osd_addrs->hb_addr[i] == *o->osd_addrs->hb_addr[i])
+	n->osd_addrs->hb_addr[i] = o->osd_addrs->hb_addr[i];
+      else
+	diff++;
+    }
+    if (diff == 0) {
+      // zoinks, no differences at all!
+      n->osd_addrs = o->osd_addrs;
+    }
   }
 
   // does crush match?
-  bufferlist oc, nc;
-  ::encode(*o->crush, oc);
-  ::encode(*n->crush, nc);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  if (n->crush != o->crush) {
+    bufferlist oc, nc;
+    ::encode(*o->crush, oc);
+    ::encode(*n->crush, nc);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
   }
 
   // does pg_temp match?
-  if (o->pg_temp->size() == n->pg_temp->size()) {
+  if (n->pg_temp != o->pg_temp &&
+      o->pg_temp->size() == n->pg_temp->size()) {
     if (*o->pg_temp == *n->pg_temp)
       n->pg_temp = o->pg_temp;
   }
 
   // do uuids match?
-  if (o->osd_uuid->size() == n->osd_uuid->size() &&
+  if (n->osd_uuid != o->osd_uuid &&
+      o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
     n->osd_uuid = o->osd_uuid;
+
+  // can we share pg mappings?  (pools are checked per lookup)
+  if (o->pg_mapping && n->pg_mapping &&
+      n->crush == o->crush &&
+      n->osd_weight == o->osd_weight) {
+    bool same = true;
+    for (int i = 0; i < n->max_osd; i++)
+      if (n->exists(i) != o->exists(i)) {
+	same = false;
+	break;
+      }
+    if (same)
+      n->pg_mapping = o->pg_mapping;
+  }
 }
 
 int OSDMap::apply_incremental(const Incremental &inc)
@@ -826,11 +858,20 @@ int OSDMap::apply_incremental(const Incremental &inc)
       osd_state[i->first] &= ~(CEPH_OSD_AUTOOUT | CEPH_OSD_NEW);
   }
 
+  if (!inc.new_up_client.empty() || !inc.new_up_internal.empty())
+    _cow(osd_addrs);
+  if (!inc.new_state.empty() || !inc.new_uuid.empty())
+    _cow(osd_uuid);
+  if (!inc.new_pg_temp.empty())
+    _cow(pg_temp);
+
   // up/down
   for (map<int32_t,uint8_t>::const_iterator i = inc.new_state.begin();
        i != inc.new_state.end();
        i++) {
     int s = i->second ? i->second : CEPH_OSD_UP;
+    if (s & CEPH_OSD_EXISTS)
+      _invalidate_pg_mapping();
     if ((osd_state[i->first] & CEPH_OSD_UP) &&
 	(s & CEPH_OSD_UP)) {
       osd_info[i->first].down_at = epoch;
@@ -844,6 +885,8 @@ int OSDMap::apply_incremental(const Incremental &inc)
   for (map<int32_t,entity_addr_t>::const_iterator i = inc.new_up_client.begin();
        i != inc.new_up_client.end();
        i++) {
+    if (!(osd_state[i->first] & CEPH_OSD_EXISTS))
+      _invalidate_pg_mapping();
     osd_state[i->first] |= CEPH_OSD_EXISTS | CEPH_OSD_UP;
     osd_addrs->client_addr[i->first].reset(new entity_addr_t(i->second));
     if (inc.new_hb_up.empty())
@@ -913,6 +956,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
     bufferlist::iterator blp = bl.begin();
     crush.reset(new CrushWrapper);
     crush->decode(blp);
+    _invalidate_pg_mapping();
   }
 
   calc_num_osds();
@@ -963,22 +1007,129 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
     osds.resize(osds.size() - removed);
 }
 
-int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+int OSDMap::_calc_pg_to_osds(const CrushWrapper& c, const pg_pool_t& pool,
+			     pg_t pg, vector<int>& osds) const
 {
   // map to osds[]
   ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
   unsigned size = pool.get_size();
 
   // what crush rule?
-  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  int ruleno = c.find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
   if (ruleno >= 0)
-    crush->do_rule(ruleno, pps, osds, size, osd_weight);
+    c.do_rule(ruleno, pps, osds, size, osd_weight);
+  else
+    osds.clear();
 
   _remove_nonexistent_osds(osds);
 
   return osds.size();
 }
 
+int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+{
+  const pg_mapping_t::pool_mapping_t *m = _get_pool_mapping(pg.pool(), pool);
+  if (!m)
+    return _calc_pg_to_osds(*crush, pool, pg, osds);
+  unsigned seed = ceph_stable_mod(pg.ps(), pool.get_pgp_num(),
+				  pool.get_pgp_num_mask());
+  const int32_t *p = &m->osds[seed * (m->size + 1)];
+  osds.assign(p + 1, p + 1 + p[0]);
+  return osds.size();
+}
+
+
+// -- pg mapping cache --
+
+OSDMap::pg_mapping_t::~pg_mapping_t()
+{
+  while (head) {
+    pool_mapping_t *m = head;
+    head = m->next;
+    mempool::adjust(mempool::osdmap,
+		    -(int64_t)(m->osds.size() * sizeof(int32_t)), 0);
+    delete m;
+  }
+}
+
+void OSDMap::_invalidate_pg_mapping()
+{
+  // callers are changing this map, so nobody else is looking at it,
+  // but copies may share the mappings
+  if (pg_mapping && (pg_mapping->head || !pg_mapping.unique()))
+    pg_mapping.reset(new pg_mapping_t);
+}
+
+void OSDMap::set_pg_mapping_cache(bool on)
+{
+  if (on && !pg_mapping)
+    pg_mapping.reset(new pg_mapping_t);
+  else if (!on)
+    pg_mapping.reset();
+}
+
+// split pools with more seeds than this over several threads
+static const unsigned PG_MAPPING_SEEDS_PER_THREAD = 1024;
+static const unsigned PG_MAPPING_MAX_THREADS = 16;
+
+const OSDMap::pg_mapping_t::pool_mapping_t *
+OSDMap::_get_pool_mapping(int64_t poolid, const pg_pool_t& pool) const
+{
+  pg_mapping_t *pm = pg_mapping.get();
+  if (!pm || !pool.get_pgp_num())
+    return NULL;
+  for (const pg_mapping_t::pool_mapping_t *m = pm->head; m; m = m->next)
+    if (m->matches(poolid, pool))
+      return m;
+
+  Mutex::Locker l(pm->lock);
+  for (const pg_mapping_t::pool_mapping_t *m = pm->head; m; m = m->next)
+    if (m->matches(poolid, pool))
+      return m;
+
+  pg_mapping_t::pool_mapping_t *m = new pg_mapping_t::pool_mapping_t;
+  m->pool = poolid;
+  m->pgp_num = pool.get_pgp_num();
+  m->size = pool.get_size();
+  m->ruleset = pool.get_crush_ruleset();
+  m->type = pool.get_type();
+  m->osds.resize(m->pgp_num * (m->size + 1));
+
+  unsigned nthreads = m->pgp_num / PG_MAPPING_SEEDS_PER_THREAD;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpus > 0 && nthreads > (unsigned)ncpus)
+    nthreads = ncpus;
+  if (nthreads > PG_MAPPING_MAX_THREADS)
+    nthreads = PG_MAPPING_MAX_THREADS;
+
+  // map all the seeds in one batch
+  vector<int> pps(m->pgp_num), raw(m->pgp_num * m->size), rawlen(m->pgp_num);
+  for (unsigned ps = 0; ps < m->pgp_num; ps++)
+    pps[ps] = pool.raw_pg_to_pps(pg_t(ps, poolid, -1));
+  int ruleno = crush->find_rule(m->ruleset, m->type, m->size);
+  if (ruleno >= 0 && m->size)
+    crush->do_rule_many(ruleno, &pps[0], m->pgp_num, &raw[0], &rawlen[0],
+			m->size, osd_weight, nthreads);
+
+  vector<int> osds;
+  for (unsigned ps = 0; ps < m->pgp_num; ps++) {
+    vector<int>::iterator r = raw.begin() + ps * m->size;
+    osds.assign(r, r + rawlen[ps]);
+    _remove_nonexistent_osds(osds);
+    int32_t *p = &m->osds[ps * (m->size + 1)];
+    p[0] = osds.size();
+    for (int i = 0; i < p[0]; i++)
+      p[i + 1] = osds[i];
+  }
+  mempool::adjust(mempool::osdmap, m->osds.size() * sizeof(int32_t), 0);
+
+  // publish only once it is filled in; readers don't take the lock
+  m->next = pm->head;
+  __sync_synchronize();
+  pm->head = m;
+  return m;
+}
+
 // pg -> (up osd list)
 void OSDMap::_raw_to_up_osds(pg_t pg, vector<int>& raw, vector<int>& up) const
 {
@@ -1026,6 +1177,20 @@ int OSDMap::pg_to_acting_osds(pg_t pg, vector<int>& acting) const
   return acting.size();
 }
 
+bool OSDMap::pg_to_raw_acting_osds(pg_t pg, vector<int>& raw, vector<int>& acting) const
+{
+  raw.clear();
+  acting.clear();
+  const pg_pool_t *pool = get_pg_pool(pg.pool());
+  if (!pool)
+    return false;
+  _pg_to_osds(*pool, pg, raw);
+  if (_raw_to_temp_osds(*pool, pg, raw, acting))
+    return true;
+  _raw_to_up_osds(pg, raw, acting);
+  return false;
+}
+
 void OSDMap::pg_to_raw_up(pg_t pg, vector<int>& up) const
 {
   const pg_pool_t *pool = get_pg_pool(pg.pool());
@@ -1065,6 +1230,176 @@ int OSDMap::calc_pg_role(int osd, vector<int>& acting, int nrep)
   return calc_pg_rank(osd, acting, nrep);
 }
 
+/*
+ * count the up set slots each osd holds in pool (or all pools, if
+ * pool < 0); returns the total.
+ */
+static unsigned count_pgs_by_osd(const OSDMap& m, int64_t pool,
+				 vector<unsigned>& count)
+{
+  count.assign(m.get_max_osd(), 0);
+  unsigned total = 0;
+  vector<int> up;
+  for (map<int64_t,pg_pool_t>::const_iterator p = m.get_pools().begin();
+       p != m.get_pools().end();
+       ++p) {
+    if (pool >= 0 && p->first != pool)
+      continue;
+    for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++) {
+      m.pg_to_raw_up(pg_t(ps, p->first, -1), up);
+      for (unsigned i = 0; i < up.size(); i++) {
+	if (up[i] < 0 || up[i] >= (int)count.size())
+	  continue;
+	count[up[i]]++;
+	total++;
+      }
+    }
+  }
+  return total;
+}
+
+/// how many pgs, in any pool, get a different up set with the first n changes
+static unsigned count_moved_pgs(const OSDMap& m,
+				const vector<pair<int,uint32_t> >& changes,
+				unsigned n)
+{
+  OSDMap tmp(m);  // shares everything but what we change
+  // we map only some pgs with tmp, once each; don't build whole pools
+  tmp.set_pg_mapping_cache(false);
+  vector<bool> changed(m.get_max_osd(), false);
+  bool raised = false;
+  for (unsigned i = 0; i < n; i++) {
+    int o = changes[i].first;
+    if (changes[i].second > m.get_weight(o))
+      raised = true;
+    tmp.set_weight(o, changes[i].second);
+    changed[o] = true;
+  }
+
+  // lowering an osd's reweight only makes crush reject it more often,
+  // so only the pgs mapped to it can move; raising one can draw any pg
+  // to it.
+  unsigned moved = 0;
+  vector<int> raw, a, b;
+  for (map<int64_t,pg_pool_t>::const_iterator p = m.get_pools().begin();
+       p != m.get_pools().end();
+       ++p) {
+    for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++) {
+      pg_t pgid(ps, p->first, -1);
+      if (!raised) {
+	m.pg_to_osds(pgid, raw);
+	bool affected = false;
+	for (unsigned i = 0; i < raw.size() && !affected; i++)
+	  affected = raw[i] >= 0 && raw[i] < (int)changed.size() && changed[raw[i]];
+	if (!affected)
+	  continue;
+      }
+      m.pg_to_raw_up(pgid, a);
+      tmp.pg_to_raw_up(pgid, b);
+      if (a != b)
+	moved++;
+    }
+  }
+  return moved;
+}
+
+int OSDMap::calc_pg_reweights(int64_t pool, double max_deviation,
+			      double max_change, unsigned max_pgs,
+			      map<int32_t,uint32_t> *new_weight,
+			      ostream *out) const
+{
+  if (max_deviation <= 0 || max_change <= 0 || max_change >= 1)
+    return -EINVAL;
+  if (pool >= 0 && !have_pg_pool(pool))
+    return -ENOENT;
+
+  vector<unsigned> count;
+  unsigned total = count_pgs_by_osd(*this, pool, count);
+
+  // what each in osd should hold goes by its crush weight; the
+  // reweight is what we are adjusting
+  vector<double> expected(max_osd, 0);
+  double weight_sum = 0;
+  for (int i = 0; i < max_osd; i++) {
+    if (!is_in(i))
+      continue;
+    int w = crush->get_item_weight(i);
+    if (w > 0) {
+      expected[i] = w;
+      weight_sum += w;
+    }
+  }
+  if (!total || weight_sum <= 0)
+    return -EDOM;
+  for (int i = 0; i < max_osd; i++)
+    expected[i] = expected[i] * total / weight_sum;
+
+  // worst first
+  vector<pair<double,int> > by_dev;
+  for (int i = 0; i < max_osd; i++) {
+    if (expected[i] <= 0)
+      continue;
+    double dev = (count[i] - expected[i]) / expected[i];
+    if (dev > max_deviation ||
+	(dev < -max_deviation && get_weight(i) < CEPH_OSD_IN))
+      by_dev.push_back(make_pair(-fabs(dev), i));
+  }
+  sort(by_dev.begin(), by_dev.end());
+
+  vector<pair<int,uint32_t> > changes;
+  for (unsigned j = 0; j < by_dev.size(); j++) {
+    int o = by_dev[j].second;
+    double ratio = count[o] ? expected[o] / count[o] : 1.0 + max_change;
+    ratio = MAX(1.0 - max_change, MIN(1.0 + max_change, ratio));
+    unsigned w = get_weight(o);
+    unsigned nw = MIN((unsigned)CEPH_OSD_IN, (unsigned)(w * ratio));
+    if (nw == 0)
+      nw = 1;
+    if (nw != w)
+      changes.push_back(make_pair(o, (uint32_t)nw));
+  }
+
+  unsigned use = changes.size();
+  unsigned moved = use ? count_moved_pgs(*this, changes, use) : 0;
+  if (max_pgs && moved > max_pgs) {
+    // reweighting more osds moves more pgs (near enough), so look for
+    // the longest run of the worst osds that fits
+    unsigned lo = 0, hi = use;
+    moved = 0;
+    while (hi - lo > 1) {
+      unsigned mid = (lo + hi) / 2;
+      unsigned m = count_moved_pgs(*this, changes, mid);
+      if (m <= max_pgs) {
+	lo = mid;
+	moved = m;
+      } else {
+	hi = mid;
+      }
+    }
+    use = lo;
+  }
+
+  for (unsigned i = 0; i < use; i++) {
+    int o = changes[i].first;
+    if (new_weight)
+      (*new_weight)[o] = changes[i].second;
+    if (out) {
+      char buf[160];
+      snprintf(buf, sizeof(buf),
+	       "osd.%d pgs %u expected %.1f (%+.1f%%) reweight %.4f -> %.4f\n",
+	       o, count[o], expected[o],
+	       100.0 * (count[o] - expected[o]) / expected[o],
+	       (float)get_weight(o) / (float)CEPH_OSD_IN,
+	       (float)changes[i].second / (float)CEPH_OSD_IN);
+      *out << buf;
+    }
+  }
+  if (out)
+    *out << "reweighted " << use << "/" << changes.size() << " osds off by more than "
+	 << 100.0 * max_deviation << "%, moving " << moved << " pgs\n";
+  return use;
+}
+
 
 // serialize, unserialize
 void OSDMap::encode_client_old(bufferlist& bl) const
@@ -1183,6 +1518,12 @@ void OSDMap::decode(bufferlist::iterator& p)
 {
   __u32 n, t;
   __u16 v;
+  _invalidate_pg_mapping();
+  // don't decode over components we may share with another map
+  osd_addrs.reset(new addrs_s);
+  pg_temp.reset(new map<pg_t,vector<int> >);
+  osd_uuid.reset(new vector<uuid_d>);
+  crush.reset(new CrushWrapper);
   ::decode(v, p);
 
   // base
@@ -1704,6 +2045,7 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
   }
 
   build_simple_crush_map(cct, *crush, rulesets, nosd);
+  _invalidate_pg_mapping();
 
   for (int i=0; i<nosd; i++) {
     set_state(i, 0);
@@ -1828,6 +2170,7 @@ int OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
   }
 
   build_simple_crush_map_from_conf(cct, *crush, rulesets);
+  _invalidate_pg_mapping();
 
   for (int i=0; i<=maxosd; i++) {
     set_state(i, 0);
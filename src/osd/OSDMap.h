@@ -27,6 +27,7 @@
 #include "msg/Message.h"
 #include "common/Mutex.h"
 #include "common/Clock.h"
+#include "common/mempool.h"
 
 #include "include/ceph_features.h"
 
@@ -174,6 +175,13 @@ private:
 
   uint32_t flags;
 
+  /*
+   * osd_addrs, pg_temp, osd_uuid and crush are shared by copies of a
+   * map (and by maps that dedup() against each other) and copied on
+   * write: anything that changes one in place must call _cow() on it
+   * first, so copying a map and applying an incremental costs as much
+   * as the incremental rather than the whole map.
+   */
   int num_osd;         // not saved
   int32_t max_osd;
   vector<uint8_t> osd_state;
@@ -202,6 +210,37 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * CRUSH's raw pg -> osd mappings for each pool, computed for all of
+   * the pool's placement seeds (on several threads, if there are many)
+   * the first time the pool is mapped.  They depend only on the crush
+   * map, the pool, osd weights and which osds exist, so copies of the
+   * map share them until one of those changes; up/down state and
+   * pg_temp are applied on each lookup.  NULL if disabled.
+   */
+  struct pg_mapping_t {
+    struct pool_mapping_t {
+      int64_t pool;
+      unsigned pgp_num, size;
+      int ruleset, type;
+      vector<int32_t> osds;   ///< per seed: count, then size slots
+      pool_mapping_t *next;
+
+      bool matches(int64_t id, const pg_pool_t& p) const {
+	return pool == id && pgp_num == p.get_pgp_num() &&
+	  size == p.get_size() && ruleset == p.get_crush_ruleset() &&
+	  type == (int)p.get_type();
+      }
+    };
+
+    Mutex lock;   ///< held while adding a pool
+    pool_mapping_t * volatile head;
+
+    pg_mapping_t() : lock("OSDMap::pg_mapping_t::lock"), head(NULL) {}
+    ~pg_mapping_t();
+  };
+  std::tr1::shared_ptr<pg_mapping_t> pg_mapping;
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
@@ -210,6 +249,8 @@ private:
   friend class MDS;
 
  public:
+  MEMPOOL_CLASS_HELPERS()
+
   OSDMap() : epoch(0), 
 	     pool_max(-1),
 	     flags(0),
@@ -218,6 +259,7 @@ private:
 	     pg_temp(new map<pg_t,vector<int> >),
 	     osd_uuid(new vector<uuid_d>),
 	     cluster_snapshot_epoch(0),
+	     pg_mapping(new pg_mapping_t),
 	     crush(new CrushWrapper) {
     memset(&fsid, 0, sizeof(fsid));
   }
@@ -276,6 +318,8 @@ private:
   }
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
+    if ((osd_state[o] ^ s) & CEPH_OSD_EXISTS)
+      _invalidate_pg_mapping();
     osd_state[o] = s;
   }
   void set_weightf(int o, float w) {
@@ -283,6 +327,9 @@ private:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    if (osd_weight[o] != w ||
+	(w && !(osd_state[o] & CEPH_OSD_EXISTS)))
+      _invalidate_pg_mapping();
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -437,6 +484,20 @@ public:
 private:
   /// pg -> (raw osd list)
   int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const;
+  int _calc_pg_to_osds(const CrushWrapper& c, const pg_pool_t& pool, pg_t pg,
+		       vector<int>& osds) const;
+
+  /// drop cached mappings; call before changing anything they depend on
+  void _invalidate_pg_mapping();
+
+  /// make our own copy of a component before changing it, if it is shared
+  template<class T>
+  static void _cow(std::tr1::shared_ptr<T>& p) {
+    if (!p.unique())
+      p.reset(new T(*p));
+  }
+  const pg_mapping_t::pool_mapping_t *_get_pool_mapping(int64_t poolid,
+							const pg_pool_t& pool) const;
   void _remove_nonexistent_osds(vector<int>& osds) const;
 
   /// pg -> (up osd list)
@@ -445,8 +506,14 @@ private:
   bool _raw_to_temp_osds(const pg_pool_t& pool, pg_t pg, vector<int>& raw, vector<int>& temp) const;
 
 public:
+  /// turn caching of pg mappings on or off (it is on by default)
+  void set_pg_mapping_cache(bool on);
+  bool get_pg_mapping_cache() const { return pg_mapping ? true : false; }
+
   int pg_to_osds(pg_t pg, vector<int>& raw) const;
   int pg_to_acting_osds(pg_t pg, vector<int>& acting) const;
+  /// raw and acting osds; returns true if acting came from pg_temp
+  bool pg_to_raw_acting_osds(pg_t pg, vector<int>& raw, vector<int>& acting) const;
   void pg_to_raw_up(pg_t pg, vector<int>& up) const;
   void pg_to_up_acting_osds(pg_t pg, vector<int>& up, vector<int>& acting) const;
 
@@ -526,6 +593,25 @@ public:
   /* what replica # is a given osd? 0 primary, -1 for none. */
   static int calc_pg_rank(int osd, vector<int>& acting, int nrep=0);
   static int calc_pg_role(int osd, vector<int>& acting, int nrep=0);
+
+  /*
+   * Pick new osd reweights that bring the number of pgs (up set slots)
+   * each in osd holds in pool (all pools if pool < 0) closer to its
+   * share of the crush weight.  Osds more than max_deviation (a
+   * fraction of their share) over get a lower weight, and ones as far
+   * under get a higher one if they were reweighted below 1; no weight
+   * changes by more than max_change.  If max_pgs is nonzero, only the
+   * worst osds are changed, as many as keeps the pgs that move at or
+   * under max_pgs.  Returns the number of osds changed, or -errno.
+   *
+   * Counting the pgs that move remaps, without the pg mapping cache,
+   * the pgs on the changed osds (every pg, if any weight goes up): once,
+   * plus about log2(#changed osds) times more if that moves too many.
+   * The mon calls this from prepare_command(), so this is its cost.
+   */
+  int calc_pg_reweights(int64_t pool, double max_deviation, double max_change,
+			unsigned max_pgs, map<int32_t,uint32_t> *new_weight,
+			ostream *out) const;
   
   /* rank is -1 (stray), 0 (primary), 1,2,3,... (replica) */
   int get_pg_acting_rank(pg_t pg, int osd) const {
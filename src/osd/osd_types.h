@@ -26,6 +26,7 @@
 #include "include/interval_set.h"
 #include "common/snap_types.h"
 #include "common/Formatter.h"
+#include "common/mempool.h"
 #include "os/hobject.h"
 
 
@@ -1287,6 +1288,8 @@ struct pg_log_entry_t {
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
   uint64_t offset;   // [soft state] my offset on disk
+
+  mempool::counter<mempool::osd_pglog, pg_log_entry_t> mempool_counter;
       
   pg_log_entry_t()
     : op(0), invalid_hash(false), invalid_pool(false), offset(0) {}
@@ -13,6 +13,7 @@
 
 /*** ObjectCacher::BufferHead ***/
 
+MEMPOOL_DEFINE_OBJECT_FACTORY(ObjectCacher::BufferHead, objectcacher_bh)
 
 /*** ObjectCacher::Object ***/
 
@@ -10,6 +10,7 @@
 
 #include "common/Cond.h"
 #include "common/Thread.h"
+#include "common/mempool.h"
 
 #include "Objecter.h"
 #include "Striper.h"
@@ -107,6 +108,8 @@ class ObjectCacher {
     int error; // holds return value for failed reads
     
     map< loff_t, list<Context*> > waitfor_read;
+
+    MEMPOOL_CLASS_HELPERS()
     
     // cons
     BufferHead(Object *o) : 
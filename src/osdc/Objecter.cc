@@ -486,11 +486,13 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	    m->incremental_maps.count(e)) {
 	  ldout(cct, 3) << "handle_osd_map decoding incremental epoch " << e << dendl;
 	  OSDMap::Incremental inc(m->incremental_maps[e]);
+	  invalidate_pg_acting(inc);
 	  osdmap->apply_incremental(inc);
 	  logger->inc(l_osdc_map_inc);
 	}
 	else if (m->maps.count(e)) {
 	  ldout(cct, 3) << "handle_osd_map decoding full epoch " << e << dendl;
+	  pg_acting_cache.clear();
 	  osdmap->decode(m->maps[e]);
 	  logger->inc(l_osdc_map_full);
 	}
@@ -530,6 +532,7 @@ void Objecter::handle_osd_map(MOSDMap *m)
       // first map.  we want the full thing.
       if (m->maps.count(m->get_last())) {
 	ldout(cct, 3) << "handle_osd_map decoding full epoch " << m->get_last() << dendl;
+	pg_acting_cache.clear();
 	osdmap->decode(m->maps[m->get_last()]);
 
 	scan_requests(false, need_resend, need_resend_linger);
@@ -1114,7 +1117,7 @@ int Objecter::recalc_op_target(Op *op)
     if (ret == -ENOENT)
       return RECALC_OP_TARGET_POOL_DNE;
   }
-  osdmap->pg_to_acting_osds(pgid, acting);
+  acting = get_pg_acting(pgid);
 
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
     op->pgid = pgid;
@@ -1176,7 +1179,7 @@ bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
   if (ret == -ENOENT) {
     return RECALC_OP_TARGET_POOL_DNE;
   }
-  osdmap->pg_to_acting_osds(pgid, acting);
+  acting = get_pg_acting(pgid);
 
   if (pgid != linger_op->pgid || is_pg_changed(linger_op->acting, acting, true)) {
     linger_op->pgid = pgid;
@@ -1196,6 +1199,92 @@ bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+const vector<int>& Objecter::get_pg_acting(pg_t pgid)
+{
+  pg_t pg = osdmap->raw_pg_to_pg(pgid);
+  hash_map<pg_t, pg_acting_t>::iterator p = pg_acting_cache.find(pg);
+  if (p != pg_acting_cache.end())
+    return p->second.acting;
+  pg_acting_t& e = pg_acting_cache[pg];
+  e.temp = osdmap->pg_to_raw_acting_osds(pg, e.raw, e.acting);
+  return e.acting;
+}
+
+void Objecter::invalidate_pg_acting_pool(int64_t pool)
+{
+  for (hash_map<pg_t, pg_acting_t>::iterator p = pg_acting_cache.begin();
+       p != pg_acting_cache.end(); ) {
+    if (p->first.pool() == (uint64_t)pool)
+      pg_acting_cache.erase(p++);
+    else
+      ++p;
+  }
+}
+
+/*
+ * Drop the cached acting sets that inc will change, before it is
+ * applied.  Crush, weight and max_osd changes can move any pg, so
+ * they flush everything; a pool change only matters if it changes
+ * how the pool maps; an osd going up, down or away only affects pgs
+ * it is in (or may be in, via pg_temp).
+ */
+void Objecter::invalidate_pg_acting(const OSDMap::Incremental& inc)
+{
+  if (pg_acting_cache.empty())
+    return;
+  if (inc.fullmap.length() || inc.crush.length() || inc.new_max_osd >= 0 ||
+      !inc.new_weight.empty()) {
+    pg_acting_cache.clear();
+    return;
+  }
+
+  for (set<int64_t>::const_iterator p = inc.old_pools.begin();
+       p != inc.old_pools.end();
+       ++p)
+    invalidate_pg_acting_pool(*p);
+  for (map<int64_t,pg_pool_t>::const_iterator p = inc.new_pools.begin();
+       p != inc.new_pools.end();
+       ++p) {
+    const pg_pool_t *old = osdmap->get_pg_pool(p->first);
+    if (old &&
+	(old->get_pg_num() != p->second.get_pg_num() ||
+	 old->get_pgp_num() != p->second.get_pgp_num() ||
+	 old->get_size() != p->second.get_size() ||
+	 old->get_crush_ruleset() != p->second.get_crush_ruleset() ||
+	 old->get_type() != p->second.get_type()))
+      invalidate_pg_acting_pool(p->first);
+  }
+
+  for (map<pg_t,vector<int32_t> >::const_iterator p = inc.new_pg_temp.begin();
+       p != inc.new_pg_temp.end();
+       ++p)
+    pg_acting_cache.erase(p->first);
+
+  set<int> changed;
+  for (map<int32_t,uint8_t>::const_iterator p = inc.new_state.begin();
+       p != inc.new_state.end();
+       ++p)
+    changed.insert(p->first);
+  for (map<int32_t,entity_addr_t>::const_iterator p = inc.new_up_client.begin();
+       p != inc.new_up_client.end();
+       ++p)
+    changed.insert(p->first);
+  if (changed.empty())
+    return;
+  for (hash_map<pg_t, pg_acting_t>::iterator p = pg_acting_cache.begin();
+       p != pg_acting_cache.end(); ) {
+    bool drop = p->second.temp;
+    for (vector<int>::iterator q = p->second.raw.begin();
+	 !drop && q != p->second.raw.end();
+	 ++q)
+      drop = changed.count(*q);
+    if (drop)
+      pg_acting_cache.erase(p++);
+    else
+      ++p;
+  }
+}
+
 void Objecter::cancel_op(Op *op)
 {
   ldout(cct, 15) << "cancel_op " << op->tid << dendl;
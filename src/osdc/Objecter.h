@@ -908,6 +908,23 @@ public:
   int recalc_op_target(Op *op);
   bool recalc_linger_op_target(LingerOp *op);
 
+  /**
+   * acting sets of the pgs our ops have mapped to, as of the current
+   * osdmap, keyed by actual (not raw) pgid.  Each incremental drops
+   * only the entries whose inputs it changes, so ops in other pgs are
+   * retargeted with a lookup instead of a fresh mapping.
+   */
+  struct pg_acting_t {
+    vector<int> raw;      ///< crush result, before up/down and pg_temp
+    vector<int> acting;
+    bool temp;            ///< acting came from pg_temp
+  };
+  hash_map<pg_t, pg_acting_t> pg_acting_cache;
+
+  const vector<int>& get_pg_acting(pg_t pgid);
+  void invalidate_pg_acting(const OSDMap::Incremental& inc);
+  void invalidate_pg_acting_pool(int64_t pool);
+
   void send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
   void _linger_commit(LingerOp *info, int r);
@@ -18,12 +18,16 @@
 #include <errno.h>
 
 #include <iostream>
+#include <iomanip>
 #include <string>
+#include <math.h>
+#include <algorithm>
 using namespace std;
 
 #include "common/config.h"
 
 #include "common/errno.h"
+#include "common/Clock.h"
 #include "osd/OSDMap.h"
 #include "mon/MonMap.h"
 #include "common/ceph_argparse.h"
@@ -37,9 +41,179 @@ void usage()
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
   cout << "   --test-map-object <objectname> [--pool <poolid>] map an object to osds"
        << std::endl;
+  cout << "   --bench-pg-mapping <passes> time mapping every pg, with and without" << std::endl;
+  cout << "                           the pg mapping cache" << std::endl;
+  cout << "   --test-map-pgs [--pool <poolid>] map all pgs, report the distribution" << std::endl;
+  cout << "                           over osds and mapping speed" << std::endl;
+  cout << "   --test-map-pgs-compare <mapfile> [--pool <poolid>] map all pgs with" << std::endl;
+  cout << "                           both maps, report how many move" << std::endl;
+  cout << "   --mark-up-in            mark all osds up and in, for testing" << std::endl;
+  cout << "   --reweight-by-pg [--pool <poolid>] reweight osds that hold too many or" << std::endl;
+  cout << "                           too few pgs for their crush weight" << std::endl;
+  cout << "     --max-deviation <f>   reweight osds off by more than this fraction" << std::endl;
+  cout << "     --max-change <f>      change no weight by more than this fraction" << std::endl;
+  cout << "     --max-pgs <n>         move no more than n pgs a round (0 = no limit)" << std::endl;
+  cout << "     --rounds <n>          run n rounds" << std::endl;
   exit(1);
 }
 
+/// map every pg of every pool to up and acting sets, passes times
+static double map_all_pgs(const OSDMap& osdmap, int passes)
+{
+  vector<int> up, acting;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < passes; i++) {
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++)
+	osdmap.pg_to_up_acting_osds(pg_t(ps, p->first, -1), up, acting);
+    }
+  }
+  return (double)(ceph_clock_now(g_ceph_context) - start);
+}
+
+/*
+ * map every pg in pool (or all pools, if pool < 0) with CRUSH, and
+ * report how many each osd got against what its weight asks for, and
+ * how fast the mapping went.
+ */
+static void print_pg_distribution(OSDMap& osdmap, int pool)
+{
+  int n = osdmap.get_max_osd();
+  vector<int> count(n, 0), first(n, 0);
+  vector<int> sizes;
+  uint64_t pgs = 0, total = 0;
+
+  // time CRUSH, not the mapping cache
+  bool was_on = osdmap.get_pg_mapping_cache();
+  osdmap.set_pg_mapping_cache(false);
+  vector<int> up, acting;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p) {
+    if (pool >= 0 && p->first != pool)
+      continue;
+    cout << "pool " << p->first << " pg_num " << p->second.get_pg_num() << std::endl;
+    for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++) {
+      osdmap.pg_to_up_acting_osds(pg_t(ps, p->first, -1), up, acting);
+      pgs++;
+      if (sizes.size() <= acting.size())
+	sizes.resize(acting.size() + 1);
+      sizes[acting.size()]++;
+      for (unsigned i = 0; i < acting.size(); i++) {
+	if (acting[i] < 0 || acting[i] >= n)
+	  continue;
+	count[acting[i]]++;
+	total++;
+      }
+      if (!acting.empty() && acting[0] >= 0 && acting[0] < n)
+	first[acting[0]]++;
+    }
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  osdmap.set_pg_mapping_cache(was_on);
+
+  // what each in osd should get: crush weight scaled by its reweight
+  vector<double> weight(n, 0);
+  double weight_sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (!osdmap.is_in(i))
+      continue;
+    weight[i] = osdmap.crush->get_item_weightf(i) * osdmap.get_weightf(i);
+    weight_sum += weight[i];
+  }
+
+  cout << "#osd\tcount\tfirst\texpected\tcrush wt\treweight" << std::endl;
+  int in = 0, min_osd = -1, max_osd = -1;
+  double dev_sum = 0, expected_var_sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (!osdmap.is_in(i))
+      continue;
+    in++;
+    double share = weight_sum > 0 ? weight[i] / weight_sum : 0;
+    double expected = share * total;
+    cout << "osd." << i << "\t" << count[i] << "\t" << first[i]
+	 << "\t" << expected << "\t" << osdmap.crush->get_item_weightf(i)
+	 << "\t" << osdmap.get_weightf(i) << std::endl;
+    dev_sum += (count[i] - expected) * (count[i] - expected);
+    // binomial: how far off we'd be with independent random placement
+    expected_var_sum += expected * (1.0 - share);
+    if (min_osd < 0 || count[i] < count[min_osd])
+      min_osd = i;
+    if (max_osd < 0 || count[i] > count[max_osd])
+      max_osd = i;
+  }
+  cout << " in " << in << std::endl;
+  if (in) {
+    double avg = (double)total / in;
+    double stddev = sqrt(dev_sum / in);
+    double expected_stddev = sqrt(expected_var_sum / in);
+    cout << " avg " << avg << " stddev " << stddev << " (" << stddev / avg
+	 << "x) (expected " << expected_stddev << " " << expected_stddev / avg
+	 << "x)" << std::endl;
+    cout << " min osd." << min_osd << " " << count[min_osd] << std::endl;
+    cout << " max osd." << max_osd << " " << count[max_osd] << std::endl;
+  }
+  for (unsigned i = 0; i < sizes.size(); i++)
+    cout << "size " << i << "\t" << sizes[i] << std::endl;
+  cout << " mapped " << pgs << " pgs in " << elapsed << " s, "
+       << (elapsed > 0 ? pgs / elapsed : 0) << " mappings/s" << std::endl;
+}
+
+/*
+ * map every pg in pool (or all pools) with both maps and report how
+ * many pgs, and how many of their replicas, land somewhere else.
+ */
+static void print_pg_movement(const OSDMap& a, const OSDMap& b, int pool)
+{
+  uint64_t pgs = 0, moved_pgs = 0, primary_moved = 0, replicas = 0, moved = 0;
+  vector<int> aup, aacting, bup, bacting;
+  for (map<int64_t,pg_pool_t>::const_iterator p = a.get_pools().begin();
+       p != a.get_pools().end();
+       ++p) {
+    if (pool >= 0 && p->first != pool)
+      continue;
+    const pg_pool_t *bp = b.get_pg_pool(p->first);
+    if (!bp) {
+      cout << "pool " << p->first << " not in other map, skipping" << std::endl;
+      continue;
+    }
+    if (bp->get_pg_num() != p->second.get_pg_num())
+      cout << "pool " << p->first << " pg_num " << p->second.get_pg_num()
+	   << " -> " << bp->get_pg_num() << ", comparing the first "
+	   << MIN(p->second.get_pg_num(), bp->get_pg_num()) << std::endl;
+    uint64_t pool_moved_pgs = 0, pool_moved = 0;
+    ps_t n = MIN(p->second.get_pg_num(), bp->get_pg_num());
+    for (ps_t ps = 0; ps < n; ps++) {
+      pg_t pgid(ps, p->first, -1);
+      a.pg_to_up_acting_osds(pgid, aup, aacting);
+      b.pg_to_up_acting_osds(pgid, bup, bacting);
+      pgs++;
+      replicas += bup.size();
+      unsigned m = 0;
+      for (unsigned i = 0; i < bup.size(); i++)
+	if (find(aup.begin(), aup.end(), bup[i]) == aup.end())
+	  m++;
+      if (m || aup.size() != bup.size())
+	pool_moved_pgs++;
+      if (!aup.empty() && !bup.empty() && aup[0] != bup[0])
+	primary_moved++;
+      pool_moved += m;
+    }
+    cout << "pool " << p->first << ": " << pool_moved_pgs << "/" << n
+	 << " pgs changed, " << pool_moved << " replicas moved" << std::endl;
+    moved_pgs += pool_moved_pgs;
+    moved += pool_moved;
+  }
+  cout << " " << moved_pgs << "/" << pgs << " pgs ("
+       << (pgs ? 100.0 * moved_pgs / pgs : 0) << "%) changed, "
+       << moved << "/" << replicas << " replicas ("
+       << (replicas ? 100.0 * moved / replicas : 0) << "%) moved, "
+       << primary_moved << " primaries changed" << std::endl;
+}
+
 int main(int argc, const char **argv)
 {
   vector<const char*> args;
@@ -69,6 +243,16 @@ int main(int argc, const char **argv)
   int range_first = -1;
   int range_last = -1;
   int pool = 0;
+  bool pool_set = false;
+  int bench_pg_mapping = 0;
+  bool test_map_pgs = false;
+  std::string test_map_pgs_compare;
+  bool mark_up_in = false;
+  bool reweight_by_pg = false;
+  float max_deviation = g_conf->mon_reweight_max_deviation;
+  float max_change = g_conf->mon_reweight_max_change;
+  int max_pgs = g_conf->mon_reweight_max_pgs;
+  int rounds = 1;
 
   std::string val;
   std::ostringstream err;
@@ -116,6 +300,40 @@ int main(int argc, const char **argv)
     } else if (ceph_argparse_withint(args, i, &range_first, &err, "--range_first", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &range_last, &err, "--range_last", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &pool, &err, "--pool", (char*)NULL)) {
+      pool_set = true;
+    } else if (ceph_argparse_flag(args, i, "--test-map-pgs", (char*)NULL)) {
+      test_map_pgs = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--test-map-pgs-compare", (char*)NULL)) {
+      test_map_pgs_compare = val;
+    } else if (ceph_argparse_withint(args, i, &bench_pg_mapping, &err, "--bench-pg-mapping", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_flag(args, i, "--mark-up-in", (char*)NULL)) {
+      mark_up_in = true;
+    } else if (ceph_argparse_flag(args, i, "--reweight-by-pg", (char*)NULL)) {
+      reweight_by_pg = true;
+    } else if (ceph_argparse_withfloat(args, i, &max_deviation, &err, "--max-deviation", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_withfloat(args, i, &max_change, &err, "--max-change", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_withint(args, i, &max_pgs, &err, "--max-pgs", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_withint(args, i, &rounds, &err, "--rounds", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else {
       ++i;
     }
@@ -244,6 +462,35 @@ int main(int argc, const char **argv)
     cout << me << ": exported crush map to " << export_crush << std::endl;
   }  
 
+  if (mark_up_in) {
+    for (int i = 0; i < osdmap.get_max_osd(); i++) {
+      osdmap.set_state(i, osdmap.get_state(i) | CEPH_OSD_EXISTS | CEPH_OSD_UP);
+      if (osdmap.is_out(i))
+	osdmap.set_weight(i, CEPH_OSD_IN);
+    }
+    modified = true;
+  }
+
+  if (reweight_by_pg) {
+    for (int round = 1; round <= rounds; round++) {
+      cout << "round " << round << std::endl;
+      map<int32_t,uint32_t> new_weight;
+      r = osdmap.calc_pg_reweights(pool_set ? pool : -1, max_deviation,
+				   max_change, MAX(max_pgs, 0), &new_weight, &cout);
+      if (r < 0) {
+	cerr << me << ": reweight-by-pg failed: " << cpp_strerror(r) << std::endl;
+	exit(1);
+      }
+      if (r == 0)
+	break;
+      for (map<int32_t,uint32_t>::iterator p = new_weight.begin();
+	   p != new_weight.end();
+	   ++p)
+	osdmap.set_weight(p->first, p->second);
+      modified = true;
+    }
+  }
+
   if (!test_map_object.empty()) {
     object_t oid(test_map_object);
     if (!osdmap.have_pg_pool(pool)) {
@@ -306,9 +553,60 @@ int main(int argc, const char **argv)
     }
   }
 
+  if (test_map_pgs)
+    print_pg_distribution(osdmap, pool_set ? pool : -1);
+
+  if (!test_map_pgs_compare.empty()) {
+    bufferlist obl;
+    std::string error;
+    r = obl.read_file(test_map_pgs_compare.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": couldn't open " << test_map_pgs_compare << ": "
+	   << error << std::endl;
+      return -1;
+    }
+    OSDMap other;
+    try {
+      other.decode(obl);
+    }
+    catch (const buffer::error &e) {
+      cerr << me << ": error decoding osdmap '" << test_map_pgs_compare
+	   << "'" << std::endl;
+      return -1;
+    }
+    print_pg_movement(osdmap, other, pool_set ? pool : -1);
+  }
+
+  if (bench_pg_mapping > 0) {
+    uint64_t pgs = 0;
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p)
+      pgs += p->second.get_pg_num();
+    cout << "mapping " << pgs << " pgs in " << osdmap.get_pools().size()
+	 << " pools, " << bench_pg_mapping << " passes" << std::endl;
+
+    bool was_on = osdmap.get_pg_mapping_cache();
+    osdmap.set_pg_mapping_cache(false);
+    double uncached = map_all_pgs(osdmap, bench_pg_mapping);
+    osdmap.set_pg_mapping_cache(true);
+    double build = map_all_pgs(osdmap, 1);
+    double cached = map_all_pgs(osdmap, bench_pg_mapping);
+    osdmap.set_pg_mapping_cache(was_on);
+
+    uint64_t n = pgs * bench_pg_mapping;
+    cout << " crush:     " << uncached << " s, " << (n ? uncached * 1000000000.0 / n : 0)
+	 << " ns/pg" << std::endl;
+    cout << " first use: " << build << " s (builds the cache)" << std::endl;
+    cout << " cached:    " << cached << " s, " << (n ? cached * 1000000000.0 / n : 0)
+	 << " ns/pg" << std::endl;
+  }
+
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
-      test_map_pg.empty() && test_map_object.empty()) {
+      test_map_pg.empty() && test_map_object.empty() &&
+      bench_pg_mapping <= 0 && !test_map_pgs && test_map_pgs_compare.empty() &&
+      !mark_up_in && !reweight_by_pg) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }
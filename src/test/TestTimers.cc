@@ -1,6 +1,7 @@
 #include "common/ceph_argparse.h"
 #include "common/Mutex.h"
 #include "common/Timer.h"
+#include "common/WheelTimer.h"
 #include "global/global_init.h"
 
 #include <iostream>
@@ -249,6 +250,109 @@ static int safe_timer_cancellation_test(SafeTimer &safe_timer, Mutex& safe_timer
   return ret;
 }
 
+class NopContext : public Context
+{
+public:
+  virtual void finish(int r) {}
+};
+
+/*
+ * Add and cancel many timeouts, the way Objecter, the MDS and OSD
+ * heartbeats do, and report the rate.  Most are cancelled before they
+ * fire; the rest fire within a second.
+ */
+template <typename T>
+static int timer_stress_test(T &timer, Mutex &lock, const char *name)
+{
+  cout << __PRETTY_FUNCTION__ << std::endl;
+
+  const int num = 200000;
+  vector<Context*> cs(num);
+  for (int i = 0; i < num; ++i)
+    cs[i] = new NopContext;
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  lock.Lock();
+  for (int i = 0; i < num; ++i) {
+    double secs = (i % 10 == 0) ? (i % 1000) / 1000.0 : 30.0 + (i % 10000) / 100.0;
+    timer.add_event_after(secs, cs[i]);
+  }
+  lock.Unlock();
+  utime_t added = ceph_clock_now(g_ceph_context);
+
+  int ret = 0;
+  lock.Lock();
+  for (int i = 0; i < num; ++i) {
+    if (i % 10 == 0)
+      continue;
+    if (!timer.cancel_event(cs[i])) {
+      cout << "error: failed to cancel event " << i << std::endl;
+      ret = 1;
+    }
+  }
+  lock.Unlock();
+  utime_t cancelled = ceph_clock_now(g_ceph_context);
+
+  cout << name << ": " << num / (double)(added - start) << " adds/sec, "
+       << (num - num / 10) / (double)(cancelled - added) << " cancels/sec"
+       << std::endl;
+
+  // let the short ones fire
+  sleep(2);
+  lock.Lock();
+  timer.cancel_all_events();
+  lock.Unlock();
+  return ret;
+}
+
+class StampContext : public Context
+{
+  utime_t *stamp;
+public:
+  StampContext(utime_t *s) : stamp(s) {}
+  virtual void finish(int r) {
+    *stamp = ceph_clock_now(g_ceph_context);
+  }
+};
+
+/*
+ * After the timer has sat idle, a new event must still fire near its
+ * deadline.  The fine tick makes any catching up on the idle ticks
+ * show as lateness.
+ */
+template <typename T>
+static int timer_idle_test(T &timer, Mutex &lock, const char *name)
+{
+  cout << __PRETTY_FUNCTION__ << std::endl;
+
+  int ret = 0;
+  for (int i = 0; i < 2; ++i) {
+    sleep(2);
+    utime_t fired;
+    lock.Lock();
+    utime_t when = ceph_clock_now(g_ceph_context);
+    when += 0.01;
+    timer.add_event_at(when, new StampContext(&fired));
+    lock.Unlock();
+
+    while (true) {
+      usleep(1000);
+      Mutex::Locker l(lock);
+      if (fired != utime_t())
+	break;
+    }
+    double late = fired - when;
+    cout << name << ": fired " << late * 1000.0 << " ms after its deadline"
+	 << std::endl;
+    if (fired < when || late > 0.1) {
+      cout << "error: event fired " << late << "s after its deadline"
+	   << std::endl;
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
 int main(int argc, const char **argv)
 {
   vector<const char*> args;
@@ -278,6 +382,35 @@ int main(int argc, const char **argv)
   if (ret)
     goto done;
 
+  {
+    Mutex wheel_timer_lock("wheel_timer_lock");
+    WheelTimer wheel_timer(g_ceph_context, wheel_timer_lock);
+    wheel_timer.init();
+
+    ret = basic_timer_test <WheelTimer>(wheel_timer, &wheel_timer_lock);
+    if (!ret)
+      ret = timer_stress_test(safe_timer, safe_timer_lock, "SafeTimer");
+    if (!ret)
+      ret = timer_stress_test(wheel_timer, wheel_timer_lock, "WheelTimer");
+    if (!ret)
+      ret = timer_idle_test(wheel_timer, wheel_timer_lock, "WheelTimer");
+
+    Mutex fine_timer_lock("fine_timer_lock");
+    WheelTimer fine_timer(g_ceph_context, fine_timer_lock, true, 0.0000001);
+    fine_timer.init();
+    if (!ret)
+      ret = timer_idle_test(fine_timer, fine_timer_lock, "WheelTimer, 100ns ticks");
+    fine_timer_lock.Lock();
+    fine_timer.shutdown();
+    fine_timer_lock.Unlock();
+
+    wheel_timer_lock.Lock();
+    wheel_timer.shutdown();
+    wheel_timer_lock.Unlock();
+    if (ret)
+      goto done;
+  }
+
 done:
   print_status(argv[0], ret);
   return ret;
@@ -0,0 +1,101 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Measure what small bufferlists cost.
+ *
+ * We encode a message-sized handful of fields into a fresh bufferlist
+ * and claim it into a payload, as a message encode does, and report
+ * the time and heap allocations per encode.  Then we append many small
+ * encodes to one bufferlist and report the append rate.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#include "include/buffer.h"
+#include "include/encoding.h"
+#include "common/Clock.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+// count heap allocations, so we can see what a bufferlist costs
+static uint64_t num_allocs = 0;
+
+void *operator new(size_t size) throw (std::bad_alloc) {
+  num_allocs++;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw () {
+  free(p);
+}
+
+static void small_encode(uint64_t n)
+{
+  std::string s("rbd_data.1234.0000000000000001");
+  uint64_t before = num_allocs;
+  utime_t start = ceph_clock_now(NULL);
+  for (uint64_t i = 0; i < n; i++) {
+    bufferlist bl;
+    ::encode((__u32)i, bl);
+    ::encode(s, bl);
+    bufferlist payload;
+    payload.claim_append(bl);
+  }
+  double elapsed = ceph_clock_now(NULL) - start;
+  cout << "small encode: " << elapsed * 1000000000.0 / n << " ns and "
+       << (double)(num_allocs - before) / n << " allocations per encode"
+       << std::endl;
+}
+
+static void append(uint64_t n)
+{
+  bufferlist big;
+  uint64_t before = num_allocs;
+  utime_t start = ceph_clock_now(NULL);
+  for (uint64_t i = 0; i < n; i++)
+    ::encode(i, big);
+  double elapsed = ceph_clock_now(NULL) - start;
+  cout << "append: " << (double)big.length() / elapsed / (1024*1024)
+       << " MB/s in " << big.buffers().size() << " buffers, "
+       << (double)(num_allocs - before) / n << " allocations per encode"
+       << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("num", po::value<uint64_t>()->default_value(1000000),
+     "encodes to time")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  uint64_t n = vm["num"].as<uint64_t>();
+  if (n < 1) {
+    cerr << "--num must be at least 1" << std::endl;
+    return 1;
+  }
+  small_encode(n);
+  append(n);
+  return 0;
+}
@@ -0,0 +1,156 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Measure what disabled dout statements cost a hot path.
+ *
+ * Each simulated op runs the dout statements an OSD client write
+ * passes through (handle_op, do_op, execute_ctx, do_osd_ops,
+ * issue_repop, ...), at levels 10-20, with debug_osd at its default.
+ * We time the op with the current gather check and with the check as
+ * it was before (two level lookups per statement), and report the
+ * per-op overhead against an op with no dout at all.
+ *
+ * Build with --with-debug-level-max=5 to see the statements compile out.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <iostream>
+
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_osd
+
+namespace po = boost::program_options;
+using namespace std;
+
+// the gather check as it was: log and gather level looked up separately
+#define old_ldout(cct, v)						\
+  if ((v) <= cct->_conf->subsys.get_log_level(dout_subsys) ||		\
+      (v) <= cct->_conf->subsys.get_gather_level(dout_subsys))		\
+    ldout(cct, v)
+
+#define no_ldout(cct, v)						\
+  if (0)								\
+    ldout(cct, v)
+
+#define WRITE_OP(D)							\
+  D(cct, 10) << "handle_op " << op << " from client." << op % 17 << dendl; \
+  D(cct, 20) << "require_same_or_newer_map " << op << dendl;		\
+  D(cct, 15) << "enqueue_op " << op << " prio 63 cost 4096" << dendl;	\
+  D(cct, 10) << "dequeue_op " << op << " latency 0.000123" << dendl;	\
+  D(cct, 10) << "do_op osd_op(client." << op % 17 << ".0:" << op	\
+	     << " rb.0.1.000000000" << op % 1024 << " [write 0~4096])" << dendl; \
+  D(cct, 20) << "get_object_context " << op % 1024 << dendl;		\
+  D(cct, 10) << "execute_ctx " << op << dendl;				\
+  D(cct, 10) << "do_osd_op rb.0.1.000000000" << op % 1024 << " [write 0~4096]" << dendl; \
+  D(cct, 10) << "do_osd_op  write 0~4096" << dendl;			\
+  D(cct, 20) << "make_writeable " << op % 1024 << " snapset=0=[]:[]" << dendl; \
+  D(cct, 20) << "do_op mode is idle(wr=0)" << dendl;			\
+  D(cct, 10) << "new_repop rep_tid " << op << dendl;			\
+  D(cct, 7) << "issue_repop rep_tid " << op << " o " << op % 1024 << dendl; \
+  D(cct, 10) << "append_log log(0'0,10'" << op << "]" << dendl;		\
+  D(cct, 10) << "eval_repop repgather(" << op << ") wants=d" << dendl;	\
+  D(cct, 10) << "apply_repop  applying update on " << op << dendl;	\
+  D(cct, 10) << "op_applied " << op << dendl;				\
+  D(cct, 10) << "sub_op_modify_reply " << op << " ondisk" << dendl;	\
+  D(cct, 10) << "eval_repop repgather(" << op << ") all committed" << dendl; \
+  D(cct, 15) << "log_op_stats osd_op(" << op << ") inb 4096 outb 0" << dendl; \
+  D(cct, 10) << "remove_repop repgather(" << op << ")" << dendl
+
+// keep the compiler from hoisting the level lookups out of the op loop,
+// as the calls between douts on the real path would
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+static double run_new(CephContext *cct, uint64_t ops)
+{
+  utime_t start = ceph_clock_now(cct);
+  for (uint64_t op = 0; op < ops; ++op) {
+    WRITE_OP(ldout);
+    barrier();
+  }
+  return (double)(ceph_clock_now(cct) - start);
+}
+
+static double run_old(CephContext *cct, uint64_t ops)
+{
+  utime_t start = ceph_clock_now(cct);
+  for (uint64_t op = 0; op < ops; ++op) {
+    WRITE_OP(old_ldout);
+    barrier();
+  }
+  return (double)(ceph_clock_now(cct) - start);
+}
+
+static double run_none(CephContext *cct, uint64_t ops)
+{
+  utime_t start = ceph_clock_now(cct);
+  for (uint64_t op = 0; op < ops; ++op) {
+    WRITE_OP(no_ldout);
+    barrier();
+  }
+  return (double)(ceph_clock_now(cct) - start);
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("num-ops", po::value<uint64_t>()->default_value(10000000),
+     "simulated write ops to run")
+    ;
+
+  po::variables_map vm;
+  po::parsed_options parsed =
+    po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+  po::store(
+    parsed,
+    vm);
+  po::notify(vm);
+
+  vector<const char *> ceph_options, def_args;
+  vector<string> ceph_option_strings = po::collect_unrecognized(
+    parsed.options, po::include_positional);
+  ceph_options.reserve(ceph_option_strings.size());
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_OSD,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  uint64_t ops = vm["num-ops"].as<uint64_t>();
+  CephContext *cct = g_ceph_context;
+  cout << ops << " ops, debug_osd " << cct->_conf->subsys.get_log_level(dout_subsys)
+       << "/" << cct->_conf->subsys.get_gather_level(dout_subsys)
+       << ", CEPH_DOUT_MAX_LEVEL " << CEPH_DOUT_MAX_LEVEL << std::endl;
+
+  double none = run_none(cct, ops);
+  double old_check = run_old(cct, ops);
+  double new_check = run_new(cct, ops);
+
+  cout << "no dout:        " << none * 1000000000.0 / ops << " ns/op" << std::endl;
+  cout << "old check:      " << old_check * 1000000000.0 / ops << " ns/op, overhead "
+       << (old_check - none) * 1000000000.0 / ops << " ns/op" << std::endl;
+  cout << "current check:  " << new_check * 1000000000.0 / ops << " ns/op, overhead "
+       << (new_check - none) * 1000000000.0 / ops << " ns/op" << std::endl;
+  return 0;
+}
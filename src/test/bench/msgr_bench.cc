@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "msgr_bench.h"
+
+#include <iostream>
+
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "messages/MPing.h"
+
+bool PingServer::ms_dispatch(Message *m)
+{
+  if (m->get_type() != CEPH_MSG_PING)
+    return false;
+  MPing *reply = new MPing;
+  reply->set_tid(m->get_tid());
+  msgr->send_message(reply, m->get_connection());
+  m->put();
+  return true;
+}
+
+PingClient::PingClient(CephContext *cct, unsigned depth, uint64_t num)
+  : Dispatcher(cct), lock("PingClient::lock"), depth(depth), received(0)
+{
+  assert(depth > 0);
+  latencies.reserve(num);
+}
+
+bool PingClient::ms_dispatch(Message *m)
+{
+  if (m->get_type() != CEPH_MSG_PING)
+    return false;
+  utime_t now = ceph_clock_now(cct);
+  Mutex::Locker l(lock);
+  std::map<tid_t, utime_t>::iterator p = in_flight.find(m->get_tid());
+  assert(p != in_flight.end());
+  latencies.push_back((double)(now - p->second));
+  in_flight.erase(p);
+  received++;
+  cond.Signal();
+  m->put();
+  return true;
+}
+
+void PingClient::start(tid_t tid)
+{
+  Mutex::Locker l(lock);
+  while (in_flight.size() >= depth)
+    cond.Wait(lock);
+  in_flight[tid] = ceph_clock_now(cct);
+}
+
+void PingClient::wait_for(uint64_t num)
+{
+  Mutex::Locker l(lock);
+  while (received < num)
+    cond.Wait(lock);
+}
+
+MPing *new_ping(tid_t tid, const bufferlist& front, const bufferlist& data)
+{
+  MPing *m = new MPing;
+  m->set_tid(tid);
+  if (front.length()) {
+    // MPing encodes nothing, so a preset payload goes out as the front.
+    bufferlist bl(front);
+    m->set_payload(bl);
+  }
+  if (data.length())
+    m->set_data(data);
+  return m;
+}
+
+Messenger *start_ping_server(CephContext *cct, const entity_addr_t& addr,
+			     uint64_t nonce, PingServer **server)
+{
+  Messenger *msgr = Messenger::create(cct, entity_name_t::OSD(0), "server",
+				      nonce);
+  msgr->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  int r = msgr->bind(addr);
+  if (r < 0) {
+    std::cerr << "failed to bind to " << addr << ": " << cpp_strerror(r)
+	      << std::endl;
+    exit(1);
+  }
+  *server = new PingServer(msgr);
+  msgr->add_dispatcher_head(*server);
+  msgr->start();
+  return msgr;
+}
+
+Messenger *start_ping_client(CephContext *cct, PingClient *client,
+			     uint64_t nonce)
+{
+  Messenger *msgr = Messenger::create(cct, entity_name_t::CLIENT(-1),
+				      "client", nonce);
+  msgr->set_default_policy(Messenger::Policy::lossless_client(0, 0));
+  msgr->add_dispatcher_head(client);
+  msgr->start();
+  return msgr;
+}
@@ -0,0 +1,75 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ping server and client shared by the messenger benchmarks.
+ */
+
+#ifndef CEPH_TEST_BENCH_MSGR_BENCH_H
+#define CEPH_TEST_BENCH_MSGR_BENCH_H
+
+#include <map>
+#include <vector>
+
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "include/utime.h"
+#include "msg/Messenger.h"
+
+class MPing;
+
+/// answers every MPing with an empty MPing carrying the same tid
+class PingServer : public Dispatcher {
+  Messenger *msgr;
+public:
+  PingServer(Messenger *msgr) : Dispatcher(msgr->cct), msgr(msgr) {}
+  bool ms_dispatch(Message *m);
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+  bool ms_verify_authorizer(Connection *con, int peer_type,
+			    int protocol, bufferlist& authorizer,
+			    bufferlist& authorizer_reply,
+			    bool& isvalid, CryptoKey& session_key) {
+    isvalid = true;
+    return true;
+  }
+};
+
+/**
+ * Keeps up to depth pings in flight and times each round trip.
+ *
+ * The sender calls start() before it sends each ping, then
+ * wait_for() once it has sent them all.
+ */
+class PingClient : public Dispatcher {
+  Mutex lock;
+  Cond cond;
+  unsigned depth;
+  uint64_t received;
+  std::map<tid_t, utime_t> in_flight;
+public:
+  /// round trip times in seconds, in the order the replies came
+  std::vector<double> latencies;
+
+  PingClient(CephContext *cct, unsigned depth, uint64_t num);
+  bool ms_dispatch(Message *m);
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+
+  /// wait for a free slot, and note that tid is sent now
+  void start(tid_t tid);
+  /// wait until num replies have come back
+  void wait_for(uint64_t num);
+};
+
+/// an MPing with the given front payload and data
+MPing *new_ping(tid_t tid, const bufferlist& front, const bufferlist& data);
+
+/// create, bind and start a messenger running a PingServer
+Messenger *start_ping_server(CephContext *cct, const entity_addr_t& addr,
+			     uint64_t nonce, PingServer **server);
+
+/// create and start a client messenger running client
+Messenger *start_ping_client(CephContext *cct, PingClient *client,
+			     uint64_t nonce);
+
+#endif
@@ -0,0 +1,136 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Compare SimpleMessenger delivery between two messengers in the same
+ * process over TCP loopback with in-process delivery
+ * (ms_inprocess_delivery), which hands Messages over without encoding.
+ *
+ * A client sends MPings carrying data-size bytes to a server, which
+ * answers each with an empty MPing; at most depth are in flight.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <iostream>
+
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "msg/Messenger.h"
+#include "messages/MPing.h"
+#include "msgr_bench.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+static double run(bool inprocess, uint64_t num, unsigned depth,
+		  unsigned data_size)
+{
+  g_conf->set_val("ms_inprocess_delivery", inprocess ? "true" : "false");
+  g_conf->apply_changes(NULL);
+
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1:0");
+  PingServer *server;
+  Messenger *smsgr = start_ping_server(g_ceph_context, bind_addr, getpid(),
+				       &server);
+  PingClient client(g_ceph_context, depth, num);
+  Messenger *cmsgr = start_ping_client(g_ceph_context, &client, getpid() + 1);
+
+  Connection *con = cmsgr->get_connection(smsgr->get_myinst());
+
+  bufferptr bp = buffer::create(data_size);
+  bp.zero();
+  bufferlist front, data;
+  data.append(bp);
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (tid_t tid = 1; tid <= num; ++tid) {
+    client.start(tid);
+    cmsgr->send_message(new_ping(tid, front, data), con);
+  }
+  client.wait_for(num);
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+  con->put();
+
+  cmsgr->shutdown();
+  smsgr->shutdown();
+  cmsgr->wait();
+  smsgr->wait();
+  delete cmsgr;
+  delete smsgr;
+  delete server;
+  return (double)elapsed;
+}
+
+static void report(const char *name, uint64_t num, unsigned data_size, double secs)
+{
+  cout << name << ": " << num << " round trips in " << secs << " s, "
+       << (double)num / secs << " msgs/s, "
+       << ((double)num * data_size / secs) / (1024*1024) << " MB/s, "
+       << secs * 1000000.0 / num << " us per round trip" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("num-msgs", po::value<uint64_t>()->default_value(100000),
+     "number of messages to send")
+    ("depth", po::value<unsigned>()->default_value(1),
+     "messages in flight")
+    ("data-size", po::value<unsigned>()->default_value(4096),
+     "bytes of data per message")
+    ("mode", po::value<string>()->default_value("both"),
+     "tcp, inprocess or both")
+    ;
+
+  po::variables_map vm;
+  po::parsed_options parsed =
+    po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+  po::store(
+    parsed,
+    vm);
+  po::notify(vm);
+
+  vector<const char *> ceph_options, def_args;
+  vector<string> ceph_option_strings = po::collect_unrecognized(
+    parsed.options, po::include_positional);
+  ceph_options.reserve(ceph_option_strings.size());
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  uint64_t num = vm["num-msgs"].as<uint64_t>();
+  unsigned depth = vm["depth"].as<unsigned>();
+  if (depth < 1) {
+    cerr << "--depth must be at least 1" << std::endl;
+    return 1;
+  }
+  unsigned data_size = vm["data-size"].as<unsigned>();
+  string mode = vm["mode"].as<string>();
+
+  if (mode == "tcp" || mode == "both")
+    report("tcp loopback", num, data_size, run(false, num, depth, data_size));
+  if (mode == "inprocess" || mode == "both")
+    report("in-process", num, data_size, run(true, num, depth, data_size));
+  return 0;
+}
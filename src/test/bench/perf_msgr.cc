@@ -0,0 +1,224 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * ceph_perf_msgr: measure the messenger on its own, without an OSD.
+ *
+ * A server Messenger answers every MPing it gets with an empty MPing
+ * carrying the same tid.  N client Messengers each keep up to depth
+ * requests in flight, with front-size bytes of front payload and
+ * data-size bytes of data.  We report msgs/s, bandwidth, latency
+ * percentiles and CPU time per message.
+ *
+ * The server and clients run in one process by default; use
+ * --mode server / --mode client --server-addr to split them.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
+#include "msg/Messenger.h"
+#include "messages/MPing.h"
+#include "msgr_bench.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+class ClientThread : public Thread {
+  Messenger *msgr;
+  entity_inst_t server;
+  uint64_t num;
+  bufferlist front, data;
+
+public:
+  PingClient client;
+
+  ClientThread(const entity_inst_t& server, uint64_t num, unsigned depth,
+	       unsigned front_size, unsigned data_size, uint64_t nonce)
+    : server(server), num(num), client(g_ceph_context, depth, num) {
+    bufferptr fp = buffer::create(front_size);
+    fp.zero();
+    front.append(fp);
+    bufferptr dp = buffer::create_page_aligned(data_size);
+    dp.zero();
+    data.append(dp);
+    msgr = start_ping_client(g_ceph_context, &client, nonce);
+  }
+  ~ClientThread() {
+    msgr->shutdown();
+    msgr->wait();
+    delete msgr;
+  }
+
+  void *entry() {
+    Connection *con = msgr->get_connection(server);
+    for (tid_t tid = 1; tid <= num; ++tid) {
+      client.start(tid);
+      msgr->send_message(new_ping(tid, front, data), con);
+    }
+    client.wait_for(num);
+    con->put();
+    return 0;
+  }
+};
+
+static double cpu_seconds()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+static void run_clients(const entity_inst_t& server, unsigned num_clients,
+			uint64_t num, unsigned depth, unsigned front_size,
+			unsigned data_size)
+{
+  vector<ClientThread*> clients;
+  for (unsigned i = 0; i < num_clients; ++i)
+    clients.push_back(new ClientThread(server, num, depth, front_size,
+				       data_size, getpid() + 1 + i));
+
+  double cpu_start = cpu_seconds();
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (unsigned i = 0; i < num_clients; ++i)
+    clients[i]->create();
+  for (unsigned i = 0; i < num_clients; ++i)
+    clients[i]->join();
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  double cpu = cpu_seconds() - cpu_start;
+
+  vector<double> lat;
+  for (unsigned i = 0; i < num_clients; ++i)
+    lat.insert(lat.end(), clients[i]->client.latencies.begin(),
+	       clients[i]->client.latencies.end());
+  sort(lat.begin(), lat.end());
+
+  uint64_t total = num * num_clients;
+  double bytes = (double)total * (front_size + data_size);
+  cout << num_clients << " clients x " << num << " msgs, depth " << depth
+       << ", front " << front_size << " data " << data_size << std::endl;
+  cout << "  elapsed " << elapsed << " s, " << total / elapsed << " msgs/s, "
+       << bytes / elapsed / (1024*1024) << " MB/s" << std::endl;
+  cout << "  latency (us): avg " << (total ? accumulate(lat.begin(), lat.end(), 0.0) / total * 1000000.0 : 0);
+  static const double pct[] = { 50, 90, 99, 99.9 };
+  for (unsigned i = 0; i < sizeof(pct)/sizeof(pct[0]) && total; ++i)
+    cout << " p" << pct[i] << " " << lat[(size_t)((total - 1) * pct[i] / 100.0)] * 1000000.0;
+  if (total)
+    cout << " max " << lat.back() * 1000000.0;
+  cout << std::endl;
+  cout << "  cpu " << cpu << " s, " << cpu * 1000000.0 / total
+       << " us per msg (whole process)" << std::endl;
+
+  for (unsigned i = 0; i < num_clients; ++i)
+    delete clients[i];
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("mode", po::value<string>()->default_value("both"),
+     "both (one process), server, or client")
+    ("server-addr", po::value<string>()->default_value("127.0.0.1:0"),
+     "address for the server to bind to, or for clients to connect to "
+     "(ip:port/nonce, as printed by --mode server)")
+    ("clients", po::value<unsigned>()->default_value(1),
+     "number of client messengers")
+    ("num-msgs", po::value<uint64_t>()->default_value(100000),
+     "messages sent by each client")
+    ("depth", po::value<unsigned>()->default_value(1),
+     "messages in flight per client")
+    ("front-size", po::value<unsigned>()->default_value(0),
+     "bytes of front payload per message")
+    ("data-size", po::value<unsigned>()->default_value(4096),
+     "bytes of data per message")
+    ;
+
+  po::variables_map vm;
+  po::parsed_options parsed =
+    po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+  po::store(
+    parsed,
+    vm);
+  po::notify(vm);
+
+  vector<const char *> ceph_options, def_args;
+  vector<string> ceph_option_strings = po::collect_unrecognized(
+    parsed.options, po::include_positional);
+  ceph_options.reserve(ceph_option_strings.size());
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  if (vm["depth"].as<unsigned>() < 1) {
+    cerr << "--depth must be at least 1" << std::endl;
+    return 1;
+  }
+
+  string mode = vm["mode"].as<string>();
+  entity_addr_t addr;
+  if (!addr.parse(vm["server-addr"].as<string>().c_str())) {
+    cerr << "unable to parse address " << vm["server-addr"].as<string>() << std::endl;
+    return 1;
+  }
+
+  if (mode == "server") {
+    PingServer *server;
+    Messenger *msgr = start_ping_server(g_ceph_context, addr, getpid(), &server);
+    cout << "server listening on " << msgr->get_myaddr() << std::endl;
+    msgr->wait();
+    return 0;
+  }
+
+  Messenger *smsgr = NULL;
+  PingServer *server = NULL;
+  entity_inst_t server_inst;
+  if (mode == "both") {
+    smsgr = start_ping_server(g_ceph_context, addr, getpid(), &server);
+    server_inst = smsgr->get_myinst();
+  } else if (mode == "client") {
+    server_inst = entity_inst_t(entity_name_t::OSD(0), addr);
+  } else {
+    cerr << "unknown mode " << mode << std::endl;
+    return 1;
+  }
+
+  run_clients(server_inst, vm["clients"].as<unsigned>(),
+	      vm["num-msgs"].as<uint64_t>(), vm["depth"].as<unsigned>(),
+	      vm["front-size"].as<unsigned>(), vm["data-size"].as<unsigned>());
+
+  if (smsgr) {
+    smsgr->shutdown();
+    smsgr->wait();
+    delete smsgr;
+    delete server;
+  }
+  return 0;
+}
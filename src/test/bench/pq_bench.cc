@@ -0,0 +1,146 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Measure PrioritizedQueue under a skewed client mix.
+ *
+ * Client i keeps a share of depth items queued proportional to
+ * 1/(i+1)^skew, and every big-every'th client sends big-cost items
+ * instead of small-cost ones.  A few priorities are in use, as on an
+ * OSD (client ops, recovery, scrub).  We time dequeue+enqueue pairs
+ * and report, with and without cost fairness, the service (by cost)
+ * the first few clients got.
+ */
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/PrioritizedQueue.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+static const unsigned priorities[] = { 63, 63, 63, 63, 10, 5 };
+
+struct Op {
+  unsigned client;
+  unsigned priority;
+  unsigned cost;
+};
+
+static void run(bool cost_fair, unsigned num_clients, double skew,
+		unsigned big_every, unsigned small_cost, unsigned big_cost,
+		unsigned depth, uint64_t num)
+{
+  PrioritizedQueue<Op*, unsigned> pq(g_conf->osd_op_pq_max_tokens_per_priority,
+				     g_conf->osd_op_pq_min_cost, cost_fair);
+
+  // each client keeps a share of depth ops queued, and sends another
+  // as soon as one is dequeued
+  double total = 0;
+  for (unsigned i = 0; i < num_clients; ++i)
+    total += 1.0 / pow(i + 1, skew);
+  const unsigned np = sizeof(priorities) / sizeof(priorities[0]);
+  vector<Op> ops;
+  for (unsigned i = 0; i < num_clients; ++i) {
+    Op op;
+    op.client = i;
+    op.priority = priorities[i % np];
+    op.cost = big_every && i % big_every == 0 ? big_cost : small_cost;
+    unsigned n = MAX(1, (unsigned)(depth / pow(i + 1, skew) / total));
+    ops.insert(ops.end(), n, op);
+  }
+  for (unsigned i = 0; i < ops.size(); ++i)
+    pq.enqueue(ops[i].client, ops[i].priority, ops[i].cost, &ops[i]);
+
+  vector<uint64_t> served_cost(num_clients), served(num_clients);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (uint64_t i = 0; i < num; ++i) {
+    Op *op = pq.dequeue();
+    // as charged: the queue counts anything cheaper as min_cost
+    served_cost[op->client] += MAX(op->cost, g_conf->osd_op_pq_min_cost);
+    served[op->client]++;
+    pq.enqueue(op->client, op->priority, op->cost, op);
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  uint64_t total_cost = 0;
+  for (unsigned i = 0; i < num_clients; ++i)
+    total_cost += served_cost[i];
+  cout << (cost_fair ? "cost fair:  " : "item fair:  ")
+       << elapsed * 1000000000.0 / num << " ns per dequeue+enqueue" << std::endl;
+  for (unsigned i = 0; i < num_clients && i < 4; ++i)
+    cout << "  client " << i << " prio " << priorities[i % np]
+	 << (big_every && i % big_every == 0 ? " (big)  " : " (small)")
+	 << " items " << served[i] << ", "
+	 << 100.0 * served_cost[i] / total_cost << "% of cost charged" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("clients", po::value<unsigned>()->default_value(100),
+     "number of clients")
+    ("skew", po::value<double>()->default_value(1.0),
+     "zipf exponent of the client arrival mix")
+    ("big-every", po::value<unsigned>()->default_value(2),
+     "every n'th client sends big items (0 for none)")
+    ("small-cost", po::value<unsigned>()->default_value(4096),
+     "cost of a small item")
+    ("big-cost", po::value<unsigned>()->default_value(4 << 20),
+     "cost of a big item")
+    ("depth", po::value<unsigned>()->default_value(1000),
+     "items kept queued")
+    ("num", po::value<uint64_t>()->default_value(2000000),
+     "items to dequeue")
+    ;
+
+  po::variables_map vm;
+  po::parsed_options parsed =
+    po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+  po::store(
+    parsed,
+    vm);
+  po::notify(vm);
+
+  vector<const char *> ceph_options, def_args;
+  vector<string> ceph_option_strings = po::collect_unrecognized(
+    parsed.options, po::include_positional);
+  ceph_options.reserve(ceph_option_strings.size());
+  for (vector<string>::iterator i = ceph_option_strings.begin();
+       i != ceph_option_strings.end();
+       ++i) {
+    ceph_options.push_back(i->c_str());
+  }
+
+  global_init(
+    &def_args, ceph_options, CEPH_ENTITY_TYPE_CLIENT,
+    CODE_ENVIRONMENT_UTILITY,
+    CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  for (int fair = 0; fair < 2; ++fair)
+    run(fair, vm["clients"].as<unsigned>(), vm["skew"].as<double>(),
+	vm["big-every"].as<unsigned>(), vm["small-cost"].as<unsigned>(),
+	vm["big-cost"].as<unsigned>(), vm["depth"].as<unsigned>(),
+	vm["num"].as<uint64_t>());
+  return 0;
+}
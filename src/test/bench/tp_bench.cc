@@ -23,6 +23,7 @@
 #include "common/WorkQueue.h"
 #include "common/Semaphore.h"
 #include "common/Finisher.h"
+#include "common/Clock.h"
 
 namespace po = boost::program_options;
 using namespace std;
@@ -102,6 +103,100 @@ public:
   PassAlong(ThreadPool *tp, Queueable *next) :
     ThreadPool::WorkQueue<unsigned>("TestQueue", 100, 100, tp), next(next) {}
 };
+class StealingPassAlong : public WorkStealingThreadPool::WorkQueue<unsigned> {
+  Queueable *next;
+  void _process(unsigned *item, ThreadPool::TPHandle &) {
+    next->queue(item);
+  }
+public:
+  StealingPassAlong(WorkStealingThreadPool *tp, Queueable *next) :
+    WorkStealingThreadPool::WorkQueue<unsigned>("TestQueue", 100, 100, tp),
+    next(next) {}
+};
+class StealingWQWrapper : public Queueable {
+  boost::scoped_ptr<WorkStealingThreadPool::WorkQueue<unsigned> > wq;
+  boost::scoped_ptr<WorkStealingThreadPool> tp;
+public:
+  StealingWQWrapper(WorkStealingThreadPool::WorkQueue<unsigned> *wq,
+		    WorkStealingThreadPool *tp):
+    wq(wq), tp(tp) {}
+  void queue(unsigned *item) { wq->queue(item); }
+  void start() { tp->start(); }
+  void stop() { tp->stop(); }
+};
+
+/// push num_items through layers, return the elapsed seconds
+static double run(const string &layers, unsigned num_threads,
+		  unsigned queue_size, unsigned num_items,
+		  DetailedStatCollector *col)
+{
+  Semaphore sem;
+  for (unsigned i = 0; i < queue_size; ++i)
+    sem.Put();
+
+  typedef list<Queueable*> QQ;
+  QQ wqs;
+  wqs.push_back(
+    new Base(col, &sem));
+  unsigned num = 0;
+  for (string::const_reverse_iterator i = layers.rbegin();
+       i != layers.rend(); ++i) {
+    stringstream ss;
+    ss << "Test " << num;
+    if (*i == 'q') {
+      ThreadPool *tp =
+	new ThreadPool(
+	  g_ceph_context, ss.str(), num_threads, 0);
+      wqs.push_back(
+	new WQWrapper(
+	  new PassAlong(tp, wqs.back()),
+	  tp
+	  ));
+    } else if (*i == 's') {
+      WorkStealingThreadPool *tp =
+	new WorkStealingThreadPool(
+	  g_ceph_context, ss.str(), num_threads);
+      wqs.push_back(
+	new StealingWQWrapper(
+	  new StealingPassAlong(tp, wqs.back()),
+	  tp
+	  ));
+    } else if (*i == 'f') {
+      wqs.push_back(
+	new FinisherWrapper(
+	  g_ceph_context, wqs.back()));
+    }
+    ++num;
+  }
+
+  for (QQ::iterator i = wqs.begin();
+       i != wqs.end();
+       ++i) {
+    (*i)->start();
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (uint64_t i = 0; i < num_items; ++i) {
+    sem.Get();
+    unsigned *item = new unsigned(col->next_seq());
+    col->start_read(*item, 1);
+    wqs.back()->queue(item);
+  }
+  // wait for the last items to come out the bottom
+  for (unsigned i = 0; i < queue_size; ++i)
+    sem.Get();
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  for (QQ::iterator i = wqs.begin();
+       i != wqs.end();
+       ++i) {
+    (*i)->stop();
+  }
+  for (QQ::iterator i = wqs.begin(); i != wqs.end(); wqs.erase(i++)) {
+    delete *i;
+  }
+  return elapsed;
+}
 
 int main(int argc, char **argv)
 {
@@ -115,7 +210,10 @@ int main(int argc, char **argv)
     ("num-items", po::value<unsigned>()->default_value(3000000),
      "num items")
     ("layers", po::value<string>()->default_value(""),
-     "layer desc")
+     "layer desc: q for a ThreadPool, s for a WorkStealingThreadPool, "
+     "f for a Finisher")
+    ("sweep", "run the layers, and the layers with each q replaced by s, "
+     "at 2 to 32 threads and report items/s")
     ;
 
   po::variables_map vm;
@@ -148,58 +246,27 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  DetailedStatCollector col(1, new JSONFormatter, 0, &cout);
-  Semaphore sem;
-  for (unsigned i = 0; i < vm["queue-size"].as<unsigned>(); ++i)
-    sem.Put();
-
-  typedef list<Queueable*> QQ;
-  QQ wqs;
-  wqs.push_back(
-    new Base(&col, &sem));
   string layers(vm["layers"].as<string>());
-  unsigned num = 0;
-  for (string::reverse_iterator i = layers.rbegin();
-       i != layers.rend(); ++i) {
-    stringstream ss;
-    ss << "Test " << num;
-    if (*i == 'q') {
-      ThreadPool *tp =
-	new ThreadPool(
-	  g_ceph_context, ss.str(), vm["num-threads"].as<unsigned>(), 0);
-      wqs.push_back(
-	new WQWrapper(
-	  new PassAlong(tp, wqs.back()),
-	  tp
-	  ));
-    } else if (*i == 'f') {
-      wqs.push_back(
-	new FinisherWrapper(
-	  g_ceph_context, wqs.back()));
-    }
-    ++num;
-  }
-
-  for (QQ::iterator i = wqs.begin();
-       i != wqs.end();
-       ++i) {
-    (*i)->start();
-  }
+  unsigned queue_size = vm["queue-size"].as<unsigned>();
+  unsigned num_items = vm["num-items"].as<unsigned>();
 
-  for (uint64_t i = 0; i < vm["num-items"].as<unsigned>(); ++i) {
-    sem.Get();
-    unsigned *item = new unsigned(col.next_seq());
-    col.start_read(*item, 1);
-    wqs.back()->queue(item);
+  if (vm.count("sweep")) {
+    string stealing(layers);
+    for (string::iterator i = stealing.begin(); i != stealing.end(); ++i)
+      if (*i == 'q')
+	*i = 's';
+    DetailedStatCollector col(1, new JSONFormatter, 0, 0);
+    for (unsigned threads = 2; threads <= 32; threads *= 2) {
+      double t = run(layers, threads, queue_size, num_items, &col);
+      double st = run(stealing, threads, queue_size, num_items, &col);
+      cout << threads << " threads: " << layers << " " << num_items / t
+	   << " items/s, " << stealing << " " << num_items / st
+	   << " items/s" << std::endl;
+    }
+    return 0;
   }
 
-  for (QQ::iterator i = wqs.begin();
-       i != wqs.end();
-       ++i) {
-    (*i)->stop();
-  }
-  for (QQ::iterator i = wqs.begin(); i != wqs.end(); wqs.erase(i++)) {
-    delete *i;
-  }
+  DetailedStatCollector col(1, new JSONFormatter, 0, &cout);
+  run(layers, vm["num-threads"].as<unsigned>(), queue_size, num_items, &col);
   return 0;
 }
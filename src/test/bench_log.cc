@@ -28,19 +28,9 @@ struct T : public Thread {
   }
 };
 
-int main(int argc, const char **argv)
+// run nthreads loggers and return entries/sec, including the final flush
+static double run(int threads, int num)
 {
-  int threads = atoi(argv[1]);
-  int num = atoi(argv[2]);
-
-  cout << threads << " threads, " << num << " lines per thread" << std::endl;
-
-  vector<const char*> args;
-  argv_to_vec(argc, argv, args);
-  env_to_vec(args);
-
-  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
-
   utime_t start = ceph_clock_now(NULL);
 
   list<T*> ls;
@@ -67,5 +57,33 @@ int main(int argc, const char **argv)
   utime_t dur = end - start;
 
   cout << dur << std::endl;
+  return (double)threads * num / (double)dur;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 3) {
+    cerr << "usage: " << argv[0] << " <max threads> <lines per thread>" << std::endl;
+    return 1;
+  }
+  int max_threads = atoi(argv[1]);
+  int num = atoi(argv[2]);
+
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
+
+  // scale from 1 thread up to max_threads, doubling each time
+  map<int,double> rates;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    cout << threads << " threads, " << num << " lines per thread" << std::endl;
+    rates[threads] = run(threads, num);
+  }
+
+  cout << "threads\tentries/sec" << std::endl;
+  for (map<int,double>::iterator p = rates.begin(); p != rates.end(); ++p)
+    cout << p->first << "\t" << p->second << std::endl;
   return 0;
 }
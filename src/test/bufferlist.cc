@@ -2,13 +2,31 @@
 
 #include "include/buffer.h"
 #include "include/encoding.h"
+#include "common/mempool.h"
 
 #include "gtest/gtest.h"
 #include "stdlib.h"
 
+#include <new>
+
 
 #define MAX_TEST 1000000
 
+// count heap allocations, so we can see what a bufferlist costs
+static int num_allocs = 0;
+
+void *operator new(size_t size) throw (std::bad_alloc) {
+  num_allocs++;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw () {
+  free(p);
+}
+
 
 TEST(BufferList, EmptyAppend) {
   bufferlist bl;
@@ -75,3 +93,91 @@ TEST(BufferList, TestCopyAll) {
   bl2.copy(0, BIG_SZ, (char*)big2);
   ASSERT_EQ(memcmp(big.get(), big2, BIG_SZ), 0);
 }
+
+TEST(BufferList, Mempool) {
+  mempool::pool_t &anon = mempool::pools[mempool::buffer_anon];
+  mempool::pool_t &aligned = mempool::pools[mempool::buffer_aligned];
+  mempool::pool_t &meta = mempool::pools[mempool::buffer_meta];
+  int64_t anon_bytes = anon.allocated_bytes();
+  int64_t aligned_bytes = aligned.allocated_bytes();
+  int64_t meta_items = meta.allocated_items();
+  {
+    bufferptr a = buffer::create(1000);
+    bufferptr b = buffer::create_page_aligned(8192);
+    ASSERT_EQ(anon_bytes + 1000, anon.allocated_bytes());
+    ASSERT_EQ(aligned_bytes + 8192, aligned.allocated_bytes());
+    ASSERT_EQ(meta_items + 2, meta.allocated_items());
+  }
+  ASSERT_EQ(anon_bytes, anon.allocated_bytes());
+  ASSERT_EQ(aligned_bytes, aligned.allocated_bytes());
+  ASSERT_EQ(meta_items, meta.allocated_items());
+}
+
+TEST(BufferList, Buffers) {
+  bufferlist a, b;
+  a.append(bufferptr("a", 1));
+  a.append(bufferptr("b", 1));
+  a.push_front(buffer::copy("c", 1));
+  ASSERT_EQ(3u, a.buffers().size());
+  ASSERT_EQ(0, memcmp(a.c_str(), "cab", 3));
+  ASSERT_EQ(1u, a.buffers().size());
+  ASSERT_TRUE(a.is_contiguous());
+
+  b.append(bufferptr("d", 1));
+  b.append(bufferptr("e", 1));
+  a.claim_append(b);
+  ASSERT_EQ(0u, b.length());
+  ASSERT_TRUE(b.buffers().empty());
+  ASSERT_EQ(3u, a.buffers().size());
+
+  // b's inline node is free again
+  b.append(bufferptr("f", 1));
+  a.claim_prepend(b);
+  ASSERT_EQ(4u, a.buffers().size());
+  ASSERT_EQ(0, memcmp(a.c_str(), "fcabde", 6));
+
+  bufferlist c;
+  c.append(bufferptr("g", 1));
+  c.append(bufferptr("h", 1));
+  a.append(bufferptr("i", 1));
+  a.swap(c);
+  ASSERT_EQ(2u, a.length());
+  ASSERT_EQ(2u, a.buffers().size());
+  ASSERT_EQ(7u, c.length());
+  ASSERT_EQ(2u, c.buffers().size());
+  ASSERT_EQ(0, memcmp(a.c_str(), "gh", 2));
+  ASSERT_EQ(0, memcmp(c.c_str(), "fcabdei", 7));
+
+  bufferlist d(c);
+  d.splice(1, 5);
+  ASSERT_EQ(0, memcmp(d.c_str(), "fi", 2));
+  ASSERT_EQ(0, memcmp(c.c_str(), "fcabdei", 7));
+  d = a;
+  ASSERT_EQ(0, memcmp(d.c_str(), "gh", 2));
+
+  bufferlist::buffers_t::const_iterator p = a.buffers().end();
+  --p;
+  ASSERT_TRUE(a.buffers().begin() == p);
+}
+
+TEST(BufferList, SmallEncodeAllocations) {
+  int before = num_allocs;
+  {
+    bufferlist bl;
+    ::encode((__u32)1, bl);
+    ::encode((uint64_t)2, bl);
+    ASSERT_EQ(1u, bl.buffers().size());
+  }
+  // one buffer, raw and data together, and no list node
+  ASSERT_EQ(1, num_allocs - before);
+
+  before = num_allocs;
+  {
+    bufferlist bl;
+    bl.append(buffer::create(10));
+    bl.append(buffer::create(10));
+  }
+  // a second ptr takes a node
+  ASSERT_EQ(3, num_allocs - before);
+}
+
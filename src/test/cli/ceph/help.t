@@ -51,6 +51,7 @@
     ceph osd rm <osd-id> [<osd-id>...]
     ceph osd lost [--yes-i-really-mean-it]
     ceph osd reweight <osd-id> <weight>
+    ceph osd reweight-by-pg [<max-deviation>] [<pool>]
     ceph osd blacklist add <address>[:source_port] [time]
     ceph osd blacklist rm <address>[:source_port]
     ceph osd pool mksnap <pool> <snapname>
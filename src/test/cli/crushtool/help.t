@@ -6,17 +6,23 @@
                            specify output for for (de)compilation
      --build --num_osds N layer1 ...
                            build a new map, where each 'layer' is
-                             'name (uniform|straw|list|tree) size'
+                             'name (uniform|straw|straw2|list|tree) size'
      -i mapfn --test       test a range of inputs on the map
         [--min-x x] [--max-x x] [--x x]
         [--min-rule r] [--max-rule r] [--rule r]
         [--num-rep n]
         [--batches b]      split the CRUSH mapping into b > 1 rounds
+        [--num-threads t]  map inputs with t threads (default: one
+                           per cpu)
         [--weight|-w devno weight]
                            where weight is 0 to 1.0
         [--simulate]       simulate placements using a random
                            number generator in place of the CRUSH
                            algorithm
+     -i mapfn --compare other_mapfn
+                           map the same inputs through both maps and
+                           report how many mappings change and the
+                           mapping rate of each
      -i mapfn --add-item id weight name [--loc type name ...]
                            insert an item into the hierarchy at the
                            given location
@@ -35,6 +41,8 @@
      --show-statistics     show chi squared statistics
      --show-bad-mappings   show bad mappings
      --show-choose-tries   show choose tries histogram
+     --show-mapping-rate   show the time spent mapping and the
+                           mappings per second
      --set-choose-local-tries N
                            set choose local retries before re-descent
      --set-choose-local-fallback-tries N
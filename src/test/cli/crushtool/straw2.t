@@ -0,0 +1,14 @@
+  $ crushtool -c "$TESTDIR/straw2.crush" -o straw2
+  $ crushtool -d straw2 -o final
+  $ cmp final "$TESTDIR/straw2.crush"
+  $ crushtool -i straw2 --reweight-item osd.0 0.5 -o straw2.reweighted > /dev/null
+  $ crushtool -i straw2 --compare straw2.reweighted --num-rep 3 --min-x 0 --max-x 9999
+  rule 0 (data) num_rep 3: 1176/10000 mappings changed (11.76%), 1402/30000 replicas moved (4.67333%)
+  mapped 10000 inputs: \d+ mappings/s, compared map \d+ mappings/s (re)
+  $ sed -e 's/alg straw2/alg straw/' "$TESTDIR/straw2.crush" > straw.crush
+  $ crushtool -c straw.crush -o straw
+  $ crushtool -i straw --reweight-item osd.0 0.5 -o straw.reweighted > /dev/null
+  $ crushtool -i straw --compare straw.reweighted --num-rep 3 --min-x 0 --max-x 9999
+  rule 0 (data) num_rep 3: 1662/10000 mappings changed (16.62%), 1942/30000 replicas moved (6.47333%)
+  mapped 10000 inputs: \d+ mappings/s, compared map \d+ mappings/s (re)
+  $ rm straw2 straw2.reweighted straw.crush straw straw.reweighted final
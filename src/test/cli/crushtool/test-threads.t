@@ -0,0 +1,7 @@
+  $ crushtool -c "$TESTDIR/straw2.crush" -o map
+  $ crushtool -i map --test --show-statistics --show-choose-tries --num-rep 3 --min-x 0 --max-x 9999 --num-threads 1 > one 2>&1
+  $ crushtool -i map --test --show-statistics --show-choose-tries --num-rep 3 --min-x 0 --max-x 9999 --num-threads 4 > four 2>&1
+  $ cmp one four
+  $ crushtool -i map --test --show-mapping-rate --num-rep 3 --min-x 0 --max-x 9999 --num-threads 2
+  rule 0 \(data\) num_rep 3: 10000 mappings in [0-9.e-]+ s, \d+ mappings/s, 2 threads (re)
+  $ rm map one four
@@ -0,0 +1,28 @@
+  $ osdmaptool --createsimple 8 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 1 to myosdmap
+
+  $ osdmaptool --mark-up-in --reweight-by-pg --rounds 3 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  round 1
+  osd.7 pgs 228 expected 192.0 (+18.8%) reweight 1.0000 -> 0.9500
+  osd.0 pgs 214 expected 192.0 (+11.5%) reweight 1.0000 -> 0.9500
+  osd.3 pgs 210 expected 192.0 (+9.4%) reweight 1.0000 -> 0.9500
+  reweighted 3/3 osds off by more than 5%, moving 21 pgs
+  round 2
+  osd.7 pgs 222 expected 192.0 (+15.6%) reweight 0.9500 -> 0.9025
+  osd.0 pgs 211 expected 192.0 (+9.9%) reweight 0.9500 -> 0.9025
+  reweighted 2/2 osds off by more than 5%, moving 18 pgs
+  round 3
+  osd.7 pgs 213 expected 192.0 (+10.9%) reweight 0.9025 -> 0.8574
+  osd.0 pgs 205 expected 192.0 (+6.8%) reweight 0.9025 -> 0.8574
+  osd.3 pgs 204 expected 192.0 (+6.2%) reweight 0.9500 -> 0.9025
+  osd.6 pgs 204 expected 192.0 (+6.2%) reweight 1.0000 -> 0.9500
+  reweighted 4/4 osds off by more than 5%, moving 45 pgs
+  osdmaptool: writing epoch 2 to myosdmap
+
+  $ osdmaptool --reweight-by-pg --pool 9 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  round 1
+  osdmaptool: reweight-by-pg failed: (2) No such file or directory
+  [1]
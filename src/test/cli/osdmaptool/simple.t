@@ -5,4 +5,17 @@
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pg <pgid>    map a pgid to osds
      --test-map-object <objectname> [--pool <poolid>] map an object to osds
+     --bench-pg-mapping <passes> time mapping every pg, with and without
+                             the pg mapping cache
+     --test-map-pgs [--pool <poolid>] map all pgs, report the distribution
+                             over osds and mapping speed
+     --test-map-pgs-compare <mapfile> [--pool <poolid>] map all pgs with
+                             both maps, report how many move
+     --mark-up-in            mark all osds up and in, for testing
+     --reweight-by-pg [--pool <poolid>] reweight osds that hold too many or
+                             too few pgs for their crush weight
+       --max-deviation <f>   reweight osds off by more than this fraction
+       --max-change <f>      change no weight by more than this fraction
+       --max-pgs <n>         move no more than n pgs a round (0 = no limit)
+       --rounds <n>          run n rounds
   [1]
@@ -0,0 +1,83 @@
+  $ osdmaptool --createsimple 3 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 1 to myosdmap
+
+# all osds are out, so nothing maps
+  $ osdmaptool --test-map-pgs myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pool 0 pg_num 192
+  pool 1 pg_num 192
+  pool 2 pg_num 192
+  #osd	count	first	expected	crush wt	reweight
+   in 0
+  size 0	576
+   mapped 576 pgs in .* s, .* mappings/s (re)
+
+  $ osdmaptool --createsimple 8 --pg_bits 4 myosdmap --clobber
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 1 to myosdmap
+  $ osdmaptool --mark-up-in myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: writing epoch 2 to myosdmap
+  $ osdmaptool --test-map-pgs --pool 1 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pool 1 pg_num 128
+  #osd	count	first	expected	crush wt	reweight
+  osd.0	20	20	16	1	1
+  osd.1	9	9	16	1	1
+  osd.2	11	11	16	1	1
+  osd.3	24	24	16	1	1
+  osd.4	17	17	16	1	1
+  osd.5	11	11	16	1	1
+  osd.6	18	18	16	1	1
+  osd.7	18	18	16	1	1
+   in 8
+   avg 16 stddev 4.84768 (0.30298x) (expected 3.74166 0.233854x)
+   min osd.1 9
+   max osd.3 24
+  size 0	0
+  size 1	128
+   mapped 128 pgs in .* s, .* mappings/s (re)
+
+# halve osd.0's crush weight in a copy: it should get about half the pgs,
+# and only pgs that involve osd.0 should move
+  $ osdmaptool --export-crush crush myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  osdmaptool: exported crush map to crush
+  $ crushtool -i crush --reweight-item osd.0 0.5 -o crush.reweighted
+  crushtool reweighting item osd.0 to 0.5
+  $ cp myosdmap reweighted
+  $ osdmaptool --import-crush crush.reweighted reweighted
+  osdmaptool: osdmap file 'reweighted'
+  osdmaptool: imported 668 byte crush map from crush.reweighted
+  osdmaptool: writing epoch 4 to reweighted
+  $ osdmaptool --test-map-pgs --pool 1 reweighted
+  osdmaptool: osdmap file 'reweighted'
+  pool 1 pg_num 128
+  #osd	count	first	expected	crush wt	reweight
+  osd.0	9	9	8.53333	0.5	1
+  osd.1	10	10	17.0667	1	1
+  osd.2	11	11	17.0667	1	1
+  osd.3	25	25	17.0667	1	1
+  osd.4	19	19	17.0667	1	1
+  osd.5	14	14	17.0667	1	1
+  osd.6	20	20	17.0667	1	1
+  osd.7	20	20	17.0667	1	1
+   in 8
+   avg 16 stddev 4.74669 (0.296668x) (expected 3.73333 0.233333x)
+   min osd.0 9
+   max osd.3 25
+  size 0	0
+  size 1	128
+   mapped 128 pgs in .* s, .* mappings/s (re)
+  $ osdmaptool --test-map-pgs-compare reweighted myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pool 0: 12/128 pgs changed, 12 replicas moved
+  pool 1: 11/128 pgs changed, 11 replicas moved
+  pool 2: 11/128 pgs changed, 11 replicas moved
+   34/384 pgs (8.85417%) changed, 34/384 replicas (8.85417%) moved, 34 primaries changed
+  $ osdmaptool --test-map-pgs-compare reweighted --pool 1 myosdmap
+  osdmaptool: osdmap file 'myosdmap'
+  pool 1: 11/128 pgs changed, 11 replicas moved
+   11/128 pgs (8.59375%) changed, 11/128 replicas (8.59375%) moved, 11 primaries changed
+  $ rm myosdmap reweighted crush crush.reweighted
@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <deque>
+#include "include/atomic.h"
+#include "include/Context.h"
+#include "common/Finisher.h"
+#include "common/Thread.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include <gtest/gtest.h>
+
+class C_Count : public Context {
+  atomic_t *count;
+public:
+  C_Count(atomic_t *c) : count(c) {}
+  void finish(int r) {
+    count->inc();
+  }
+};
+
+class Queuer : public Thread {
+  Finisher &finisher;
+  atomic_t *count;
+  unsigned num;
+public:
+  Queuer(Finisher &f, atomic_t *c, unsigned n)
+    : finisher(f), count(c), num(n) {}
+  void *entry() {
+    for (unsigned i = 0; i < num; i++) {
+      switch (i % 4) {
+      case 0:
+	finisher.queue(new C_Count(count));
+	break;
+      case 1:
+	finisher.queue(new C_Count(count), -1);
+	break;
+      case 2:
+	{
+	  vector<Context*> ls;
+	  ls.push_back(new C_Count(count));
+	  finisher.queue(ls);
+	}
+	break;
+      default:
+	{
+	  deque<Context*> ls;
+	  ls.push_back(new C_Count(count));
+	  finisher.queue(ls);
+	}
+      }
+    }
+    return NULL;
+  }
+};
+
+static uint64_t queue_len(const string& name)
+{
+  bufferlist bl;
+  g_ceph_context->get_perfcounters_collection()->write_json_to_buf(bl, false);
+  string s(bl.c_str(), bl.length());
+  string key = "\"finisher-" + name + "\":{\"queue_len\":";
+  size_t p = s.find(key);
+  assert(p != string::npos);
+  return strtoull(s.c_str() + p + key.length(), NULL, 10);
+}
+
+// the queue_len counter must never go below zero while the finisher
+// thread drains completions that other threads are still queueing
+TEST(Finisher, QueueWhileDraining) {
+  Finisher finisher(g_ceph_context, "test");
+  finisher.start();
+
+  const unsigned threads = 8, per_thread = 20000;
+  atomic_t count;
+  vector<Queuer*> queuers;
+  for (unsigned i = 0; i < threads; i++) {
+    queuers.push_back(new Queuer(finisher, &count, per_thread));
+    queuers.back()->create();
+  }
+  for (unsigned i = 0; i < threads; i++) {
+    queuers[i]->join();
+    delete queuers[i];
+  }
+  finisher.wait_for_empty();
+
+  ASSERT_EQ(threads * per_thread, count.read());
+  ASSERT_EQ(0u, queue_len("test"));
+  finisher.stop();
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
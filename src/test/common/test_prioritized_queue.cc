@@ -0,0 +1,132 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "common/PrioritizedQueue.h"
+#include "gtest/gtest.h"
+
+typedef PrioritizedQueue<unsigned, uint64_t> PQ;
+
+TEST(PrioritizedQueue, StrictFirst)
+{
+  PQ pq(4096, 1);
+  pq.enqueue(1, 200, 1, 1);
+  pq.enqueue_strict(1, 10, 2);
+  pq.enqueue_strict(2, 100, 3);
+  pq.enqueue_strict(1, 100, 4);
+  pq.enqueue_strict_front(1, 100, 5);
+  ASSERT_EQ(5u, pq.length());
+
+  // strict priorities highest first, round robin across classes
+  ASSERT_EQ(3u, pq.dequeue());
+  ASSERT_EQ(5u, pq.dequeue());
+  ASSERT_EQ(4u, pq.dequeue());
+  ASSERT_EQ(2u, pq.dequeue());
+  ASSERT_EQ(1u, pq.dequeue());
+  ASSERT_TRUE(pq.empty());
+}
+
+TEST(PrioritizedQueue, FifoPerClass)
+{
+  PQ pq(4096, 1);
+  for (unsigned i = 0; i < 100; ++i)
+    pq.enqueue(i % 3, 63, 100 + i * 7, i);
+  pq.enqueue_front(0, 63, 1, 1000);
+
+  unsigned last[3] = { 0, 0, 0 };
+  bool seen_front = false;
+  while (!pq.empty()) {
+    unsigned v = pq.dequeue();
+    if (v == 1000) {
+      ASSERT_EQ(0u, last[0]);
+      seen_front = true;
+      continue;
+    }
+    if (v % 3 == 0)
+      ASSERT_TRUE(seen_front);
+    if (last[v % 3])
+      ASSERT_LT(last[v % 3], v);
+    last[v % 3] = v;
+  }
+  ASSERT_TRUE(seen_front);
+  ASSERT_EQ(0u, pq.length());
+}
+
+TEST(PrioritizedQueue, ShareByPriority)
+{
+  // equal costs: priority 30 should get about 3x the service of 10
+  PQ pq(4096, 100);
+  for (unsigned i = 0; i < 4000; ++i) {
+    pq.enqueue(1, 10, 100, 10);
+    pq.enqueue(2, 30, 100, 30);
+  }
+  unsigned count[2] = { 0, 0 };
+  for (unsigned i = 0; i < 4000; ++i)
+    count[pq.dequeue() == 30]++;
+  ASSERT_NEAR(3.0, (double)count[1] / count[0], 0.1);
+}
+
+TEST(PrioritizedQueue, CostFair)
+{
+  // one client with 64x larger items than the other
+  for (int fair = 0; fair < 2; ++fair) {
+    PQ pq(1 << 20, 1, fair);
+    for (unsigned i = 0; i < 1000; ++i) {
+      pq.enqueue(1, 63, 1 << 16, 1);
+      for (unsigned j = 0; j < 64; ++j)
+	pq.enqueue(2, 63, 1 << 10, 2);
+    }
+    uint64_t cost[3] = { 0, 0, 0 };
+    unsigned count[3] = { 0, 0, 0 };
+    for (unsigned i = 0; i < 2000; ++i) {
+      unsigned c = pq.dequeue();
+      cost[c] += c == 1 ? 1 << 16 : 1 << 10;
+      count[c]++;
+    }
+    if (fair)
+      ASSERT_NEAR(1.0, (double)cost[1] / cost[2], 0.1);
+    else
+      ASSERT_EQ(count[1], count[2]);
+  }
+}
+
+struct IsOdd {
+  bool operator()(unsigned v) const { return v % 2; }
+};
+
+TEST(PrioritizedQueue, Remove)
+{
+  PQ pq(4096, 1);
+  for (unsigned i = 0; i < 100; ++i)
+    pq.enqueue(i % 4, i < 50 ? 10 : 20, 1, i);
+  pq.enqueue_strict(3, 1000, 1000);
+
+  list<unsigned> out;
+  pq.remove_by_filter(IsOdd(), &out);
+  ASSERT_EQ(50u, out.size());
+  ASSERT_EQ(51u, pq.length());
+  // each class's items at a priority stay in order
+  for (unsigned k = 0; k < 8; ++k) {
+    unsigned last = 0;
+    for (list<unsigned>::iterator p = out.begin(); p != out.end(); ++p) {
+      if (*p % 4 != k % 4 || (*p < 50) != (k < 4))
+	continue;
+      ASSERT_LE(last, *p);
+      last = *p;
+    }
+  }
+
+  out.clear();
+  pq.remove_by_class(0, &out);
+  ASSERT_EQ(25u, out.size());
+  pq.remove_by_class(2);
+  pq.remove_by_class(3, &out);
+  ASSERT_EQ(26u, out.size());
+  ASSERT_EQ(1000u, out.front());
+  ASSERT_TRUE(pq.empty());
+
+  // still usable afterwards
+  pq.enqueue(5, 10, 1, 7);
+  ASSERT_EQ(7u, pq.dequeue());
+  ASSERT_TRUE(pq.empty());
+}
@@ -0,0 +1,166 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/ceph_argparse.h"
+#include "crush/CrushWrapper.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include <gtest/gtest.h>
+
+/*
+ * 4 hosts of 4 osds each under one root, every bucket of type alg.
+ * Uniform buckets need equal weights, so only the others get uneven
+ * ones.
+ */
+static void build_map(CrushWrapper& c, int alg)
+{
+  c.create();
+  c.set_type_name(0, "osd");
+  c.set_type_name(1, "host");
+  c.set_type_name(2, "root");
+
+  int hosts[4], host_weights[4];
+  for (int h = 0; h < 4; h++) {
+    int items[4], weights[4];
+    host_weights[h] = 0;
+    for (int i = 0; i < 4; i++) {
+      items[i] = h * 4 + i;
+      if (alg == CRUSH_BUCKET_UNIFORM)
+	weights[i] = 0x10000;
+      else
+	weights[i] = 0x10000 * (1 + (h + i) % 3);
+      host_weights[h] += weights[i];
+    }
+    hosts[h] = c.add_bucket(0, alg, CRUSH_HASH_DEFAULT, 1, 4, items, weights);
+    ASSERT_LT(hosts[h], 0);
+  }
+  int root = c.add_bucket(0, alg, CRUSH_HASH_DEFAULT, 2, 4, hosts, host_weights);
+  ASSERT_LT(root, 0);
+  c.set_max_devices(16);
+
+  int r = c.add_rule(3, 0, 1, 1, 10, -1);
+  c.set_rule_step_take(r, 0, root);
+  c.set_rule_step_choose_leaf_firstn(r, 1, 0, 1);
+  c.set_rule_step_emit(r, 2);
+
+  r = c.add_rule(3, 1, 1, 1, 10, -1);
+  c.set_rule_step_take(r, 0, root);
+  c.set_rule_step_choose_indep(r, 1, 0, 0);
+  c.set_rule_step_emit(r, 2);
+
+  r = c.add_rule(4, 2, 1, 1, 10, -1);
+  c.set_rule_step_take(r, 0, root);
+  c.set_rule_step_choose_firstn(r, 1, 2, 1);
+  c.set_rule_step_choose_firstn(r, 2, 2, 0);
+  c.set_rule_step_emit(r, 3);
+
+  c.finalize();
+}
+
+static void check_many_matches_one(int alg)
+{
+  CrushWrapper c;
+  build_map(c, alg);
+
+  // some devices out, some partially weighted
+  vector<__u32> weight(16, 0x10000);
+  weight[1] = 0;
+  weight[6] = 0;
+  weight[11] = 0;
+  weight[2] = 0x8000;
+  weight[9] = 0x4000;
+  weight[14] = 0xc000;
+
+  const int nx = 10000, maxout = 4;
+  vector<int> x(nx);
+  for (int i = 0; i < nx; i++)
+    x[i] = i;
+
+  for (int tunables = 0; tunables < 2; tunables++) {
+    if (tunables)
+      c.set_tunables_optimal();
+    else
+      c.set_tunables_legacy();
+
+    for (int rule = 0; rule < c.get_max_rules(); rule++) {
+      for (unsigned threads = 1; threads <= 4; threads += 3) {
+	vector<int> out(nx * maxout), outlen(nx);
+	c.do_rule_many(rule, &x[0], nx, &out[0], &outlen[0], maxout, weight,
+		       threads);
+	for (int i = 0; i < nx; i++) {
+	  vector<int> one;
+	  c.do_rule(rule, x[i], one, maxout, weight);
+	  ASSERT_EQ((int)one.size(), outlen[i])
+	    << "alg " << alg << " rule " << rule << " x " << i;
+	  for (unsigned j = 0; j < one.size(); j++)
+	    ASSERT_EQ(one[j], out[i * maxout + j])
+	      << "alg " << alg << " rule " << rule << " x " << i;
+	}
+      }
+    }
+  }
+}
+
+TEST(CrushWrapper, DoRuleManyUniform) {
+  check_many_matches_one(CRUSH_BUCKET_UNIFORM);
+}
+
+TEST(CrushWrapper, DoRuleManyList) {
+  check_many_matches_one(CRUSH_BUCKET_LIST);
+}
+
+TEST(CrushWrapper, DoRuleManyTree) {
+  check_many_matches_one(CRUSH_BUCKET_TREE);
+}
+
+TEST(CrushWrapper, DoRuleManyStraw) {
+  check_many_matches_one(CRUSH_BUCKET_STRAW);
+}
+
+TEST(CrushWrapper, DoRuleManyStraw2) {
+  check_many_matches_one(CRUSH_BUCKET_STRAW2);
+}
+
+TEST(CrushWrapper, Straw2RemoveItem) {
+  int items[3] = { 0, 1, 2 };
+  int weights[3] = { 0x10000, 0x20000, 0x30000 };
+  crush_bucket *b = crush_make_bucket(CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT,
+				      1, 3, items, weights);
+  ASSERT_TRUE(b != NULL);
+
+  ASSERT_EQ(-ENOENT, crush_bucket_remove_item(b, 7));
+  ASSERT_EQ(3u, b->size);
+
+  // the last item
+  ASSERT_EQ(0, crush_bucket_remove_item(b, 2));
+  ASSERT_EQ(2u, b->size);
+  ASSERT_EQ(0x30000u, b->weight);
+
+  ASSERT_EQ(0, crush_bucket_remove_item(b, 0));
+  ASSERT_EQ(1u, b->size);
+  ASSERT_EQ(1, b->items[0]);
+  ASSERT_EQ(0x20000u, b->weight);
+  ASSERT_EQ(-ENOENT, crush_bucket_remove_item(b, 0));
+
+  crush_destroy_bucket(b);
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
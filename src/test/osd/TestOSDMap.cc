@@ -0,0 +1,266 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "osd/OSDMap.h"
+#include <gtest/gtest.h>
+
+static const int num_osds = 12;
+
+/// a map of num_osds osds, all up and in, and its three pools
+static void build_map(OSDMap& m)
+{
+  uuid_d fsid;
+  m.build_simple(g_ceph_context, 0, fsid, num_osds, 4, 4);
+  OSDMap::Incremental inc(m.get_epoch() + 1);
+  inc.fsid = m.get_fsid();
+  for (int o = 0; o < num_osds; o++) {
+    entity_addr_t a;
+    a.set_nonce(o);
+    inc.new_up_client[o] = a;
+    inc.new_weight[o] = CEPH_OSD_IN;
+  }
+  m.apply_incremental(inc);
+}
+
+/// check every pg of every pool maps the same with and without the cache
+static void check_cached_matches_uncached(const OSDMap& m)
+{
+  ASSERT_TRUE(m.get_pg_mapping_cache());
+  OSDMap u = m;
+  u.set_pg_mapping_cache(false);
+
+  unsigned nonempty = 0;
+  const map<int64_t,pg_pool_t>& pools = m.get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps) {
+      pg_t pg(ps, p->first, -1);
+      vector<int> raw, uraw, up, uup, acting, uacting;
+      m.pg_to_osds(pg, raw);
+      u.pg_to_osds(pg, uraw);
+      ASSERT_EQ(uraw, raw) << pg;
+      m.pg_to_up_acting_osds(pg, up, acting);
+      u.pg_to_up_acting_osds(pg, uup, uacting);
+      ASSERT_EQ(uup, up) << pg;
+      ASSERT_EQ(uacting, acting) << pg;
+      if (!raw.empty())
+	nonempty++;
+    }
+  }
+  ASSERT_LT(0u, nonempty);
+}
+
+static OSDMap::Incremental next_inc(const OSDMap& m)
+{
+  OSDMap::Incremental inc(m.get_epoch() + 1);
+  inc.fsid = m.get_fsid();
+  return inc;
+}
+
+class OSDMapTest : public ::testing::Test {
+protected:
+  OSDMap osdmap;
+
+  virtual void SetUp() {
+    build_map(osdmap);
+    // fill the cache, so each test changes a map whose mappings are cached
+    check_cached_matches_uncached(osdmap);
+  }
+};
+
+TEST_F(OSDMapTest, PGMappingCache) {
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCacheCrushChange) {
+  CrushWrapper crush;
+  bufferlist bl;
+  osdmap.crush->encode(bl);
+  bufferlist::iterator p = bl.begin();
+  crush.decode(p);
+  crush.adjust_item_weightf(g_ceph_context, 0, 0.25);
+  crush.adjust_item_weightf(g_ceph_context, 5, 3.0);
+
+  OSDMap::Incremental inc = next_inc(osdmap);
+  crush.encode(inc.crush);
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCacheWeightChange) {
+  OSDMap::Incremental inc = next_inc(osdmap);
+  inc.new_weight[1] = CEPH_OSD_OUT;
+  inc.new_weight[2] = CEPH_OSD_IN / 2;
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+
+  osdmap.set_weight(3, CEPH_OSD_IN / 4);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCacheExistsChange) {
+  // mark osd.4 down and destroy it
+  OSDMap::Incremental inc = next_inc(osdmap);
+  inc.new_state[4] = CEPH_OSD_EXISTS | CEPH_OSD_UP;
+  osdmap.apply_incremental(inc);
+  ASSERT_FALSE(osdmap.exists(4));
+  check_cached_matches_uncached(osdmap);
+
+  // and bring it back
+  inc = next_inc(osdmap);
+  entity_addr_t a;
+  inc.new_up_client[4] = a;
+  osdmap.apply_incremental(inc);
+  ASSERT_TRUE(osdmap.exists(4));
+  check_cached_matches_uncached(osdmap);
+
+  osdmap.set_state(6, 0);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCacheMaxOsdChange) {
+  OSDMap::Incremental inc = next_inc(osdmap);
+  inc.new_max_osd = num_osds - 3;
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+
+  osdmap.set_max_osd(num_osds);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCachePoolChange) {
+  OSDMap::Incremental inc = next_inc(osdmap);
+  const map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
+  map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+  // a bigger pool, a pool with fewer replicas, and a new pool
+  pg_pool_t bigger = p->second;
+  bigger.set_pg_num(p->second.get_pg_num() * 2);
+  bigger.set_pgp_num(p->second.get_pgp_num() * 2);
+  inc.new_pools[p->first] = bigger;
+  ++p;
+  pg_pool_t smaller = p->second;
+  smaller.size = p->second.size - 1;
+  inc.new_pools[p->first] = smaller;
+  int64_t newpool = osdmap.get_pool_max() + 1;
+  inc.new_pool_max = newpool;
+  inc.new_pools[newpool] = p->second;
+  inc.new_pool_names[newpool] = "new";
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+
+  // remove a pool, and make another with its id
+  inc = next_inc(osdmap);
+  inc.old_pools.insert(newpool);
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+
+  inc = next_inc(osdmap);
+  pg_pool_t again = bigger;
+  again.crush_ruleset = smaller.crush_ruleset;
+  inc.new_pools[newpool] = again;
+  inc.new_pool_names[newpool] = "again";
+  osdmap.apply_incremental(inc);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, PGMappingCacheCopies) {
+  // a copy shares the cache until one of them changes
+  OSDMap copy = osdmap;
+  OSDMap::Incremental inc = next_inc(copy);
+  inc.new_weight[0] = CEPH_OSD_OUT;
+  copy.apply_incremental(inc);
+  check_cached_matches_uncached(copy);
+  check_cached_matches_uncached(osdmap);
+}
+
+TEST_F(OSDMapTest, CopyOnWrite) {
+  // give the map pg_temp entries and uuids for the copy to share
+  OSDMap::Incremental inc = next_inc(osdmap);
+  pg_t pg0(0, 0, -1), pg1(1, 0, -1), pg2(2, 0, -1);
+  inc.new_pg_temp[pg0].push_back(1);
+  inc.new_pg_temp[pg0].push_back(2);
+  inc.new_pg_temp[pg1].push_back(3);
+  for (int o = 0; o < num_osds; o++)
+    inc.new_uuid[o].uuid[0] = o + 1;
+  osdmap.apply_incremental(inc);
+
+  bufferlist before;
+  osdmap.encode(before);
+
+  // change every shared component of a copy
+  OSDMap copy = osdmap;
+  inc = next_inc(copy);
+  entity_addr_t a;
+  a.set_nonce(100);
+  inc.new_up_client[2] = a;
+  inc.new_hb_up[2] = a;
+  inc.new_state[7] = CEPH_OSD_UP;
+  inc.new_uuid[3].uuid[1] = 1;
+  inc.new_pg_temp[pg0].clear();
+  inc.new_pg_temp[pg1].push_back(4);
+  inc.new_pg_temp[pg2].push_back(5);
+  CrushWrapper crush;
+  bufferlist cbl;
+  osdmap.crush->encode(cbl);
+  bufferlist::iterator p = cbl.begin();
+  crush.decode(p);
+  crush.adjust_item_weightf(g_ceph_context, 0, 0.5);
+  crush.encode(inc.crush);
+  copy.apply_incremental(inc);
+
+  bufferlist after;
+  osdmap.encode(after);
+  ASSERT_TRUE(before.contents_equal(after));
+
+  // set_max_osd copies on its own, so check it separately
+  OSDMap copy1 = osdmap;
+  copy1.set_max_osd(num_osds + 4);
+  copy1.set_state(8, 0);
+  after.clear();
+  osdmap.encode(after);
+  ASSERT_TRUE(before.contents_equal(after));
+
+  // and the copy ends up as if the incremental went to a decoded map
+  OSDMap decoded;
+  decoded.decode(before);
+  decoded.apply_incremental(inc);
+  bufferlist copybl, dbl;
+  copy.encode(copybl);
+  decoded.encode(dbl);
+  ASSERT_TRUE(copybl.contents_equal(dbl));
+
+  // decoding over a copy leaves the original alone too
+  OSDMap copy2 = osdmap;
+  copy2.decode(copybl);
+  after.clear();
+  osdmap.encode(after);
+  ASSERT_TRUE(before.contents_equal(after));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  // spread replicas over osds, since all of build_simple's are on one host
+  g_ceph_context->_conf->set_val("osd_crush_chooseleaf_type", "0");
+  g_ceph_context->_conf->set_val("osd_pool_default_size", "3");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -16,8 +16,11 @@
 #include "common/admin_socket_client.h"
 #include "common/ceph_context.h"
 #include "common/config.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "include/atomic.h"
 
 #include "include/types.h" // FIXME: ordering shouldn't be important, but right 
                            // now, this include has to come before the others.
@@ -31,6 +34,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <iostream>
 #include <map>
 #include <poll.h>
 #include <sstream>
@@ -163,3 +167,154 @@ TEST(PerfCounters, MultiplePerfCounters) {
   ASSERT_EQ("", client.do_request("perfcounters_dump", &msg));
   ASSERT_EQ("{}", msg);
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_COUNT,
+  TEST_PERFCOUNTERS3_ELEMENT_AVG,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+class PerfCountersIncThread : public Thread {
+  PerfCounters *pc;
+  uint64_t n;
+public:
+  PerfCountersIncThread(PerfCounters *pc, uint64_t n) : pc(pc), n(n) {}
+  void *entry() {
+    for (uint64_t i = 0; i < n; ++i) {
+      pc->inc(TEST_PERFCOUNTERS3_ELEMENT_COUNT);
+      pc->tinc(TEST_PERFCOUNTERS3_ELEMENT_AVG, utime_t(0, 1));
+    }
+    return NULL;
+  }
+};
+
+// Updates from many threads must not be lost, and (being lock-free)
+// throughput should not collapse as threads are added.
+TEST(PerfCounters, ConcurrentUpdates) {
+  const uint64_t per_thread = 1000000;
+  for (unsigned nthreads = 1; nthreads <= 8; nthreads *= 2) {
+    PerfCountersBuilder bld(g_ceph_context, "test_perfcounter_3",
+	    TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+    bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_COUNT, "count");
+    bld.add_time_avg(TEST_PERFCOUNTERS3_ELEMENT_AVG, "avg");
+    PerfCounters *pc = bld.create_perf_counters();
+
+    std::vector<PerfCountersIncThread*> threads;
+    for (unsigned i = 0; i < nthreads; ++i)
+      threads.push_back(new PerfCountersIncThread(pc, per_thread));
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (unsigned i = 0; i < nthreads; ++i)
+      threads[i]->create();
+    for (unsigned i = 0; i < nthreads; ++i) {
+      threads[i]->join();
+      delete threads[i];
+    }
+    double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+    uint64_t total = per_thread * nthreads;
+    ASSERT_EQ(total, pc->get(TEST_PERFCOUNTERS3_ELEMENT_COUNT));
+    ASSERT_EQ(utime_t(total / 1000000000ull, total % 1000000000ull),
+	      pc->tget(TEST_PERFCOUNTERS3_ELEMENT_AVG));
+    std::cout << nthreads << " threads: " << (2 * total) / elapsed
+	      << " updates/sec" << std::endl;
+    delete pc;
+  }
+}
+
+class PerfCountersAvgThread : public Thread {
+  PerfCounters *pc;
+  atomic_t *stop;
+public:
+  uint64_t n;
+  PerfCountersAvgThread(PerfCounters *pc, atomic_t *stop)
+    : pc(pc), stop(stop), n(0) {}
+  void *entry() {
+    while (!stop->read()) {
+      pc->inc(TEST_PERFCOUNTERS3_ELEMENT_AVG);
+      ++n;
+    }
+    return NULL;
+  }
+};
+
+// A dump must finish even while an average is updated nonstop.
+TEST(PerfCounters, DumpWhileUpdating) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  PerfCountersBuilder bld(g_ceph_context, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_COUNT, "count");
+  bld.add_u64_avg(TEST_PERFCOUNTERS3_ELEMENT_AVG, "avg");
+  PerfCounters *pc = bld.create_perf_counters();
+  coll->add(pc);
+
+  atomic_t stop;
+  std::vector<PerfCountersAvgThread*> threads;
+  for (unsigned i = 0; i < 4; ++i) {
+    threads.push_back(new PerfCountersAvgThread(pc, &stop));
+    threads.back()->create();
+  }
+  for (unsigned i = 0; i < 1000; ++i) {
+    bufferlist bl;
+    coll->write_json_to_buf(bl, false);
+    ASSERT_NE(std::string::npos,
+	      std::string(bl.c_str(), bl.length()).find("\"avgcount\":"));
+  }
+  stop.set(1);
+  uint64_t total = 0;
+  for (unsigned i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+    total += threads[i]->n;
+    delete threads[i];
+  }
+
+  bufferlist bl;
+  coll->write_json_to_buf(bl, false);
+  std::ostringstream expected;
+  expected << "\"avg\":{\"avgcount\":" << total << ",\"sum\":" << total << "}";
+  ASSERT_NE(std::string::npos,
+	    std::string(bl.c_str(), bl.length()).find(expected.str()));
+  coll->remove(pc);
+  delete pc;
+}
+
+enum {
+  TEST_PERFCOUNTERS4_ELEMENT_FIRST = 800,
+  TEST_PERFCOUNTERS4_ELEMENT_HIST,
+  TEST_PERFCOUNTERS4_ELEMENT_HIST2D,
+  TEST_PERFCOUNTERS4_ELEMENT_LAST,
+};
+
+TEST(PerfCounters, Histogram) {
+  PerfCountersBuilder bld(g_ceph_context, "test_perfcounter_4",
+	  TEST_PERFCOUNTERS4_ELEMENT_FIRST, TEST_PERFCOUNTERS4_ELEMENT_LAST);
+  bld.add_u64_histogram(TEST_PERFCOUNTERS4_ELEMENT_HIST, "hist", "value", 4);
+  bld.add_time_histogram(TEST_PERFCOUNTERS4_ELEMENT_HIST2D, "hist2d",
+			 "latency_usec", 3, "size", 2);
+  PerfCounters *pc = bld.create_perf_counters();
+
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 0);
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 1);
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 2);
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 3);
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 4);
+  pc->hinc(TEST_PERFCOUNTERS4_ELEMENT_HIST, 1000000);  // last bucket is open
+  pc->htinc(TEST_PERFCOUNTERS4_ELEMENT_HIST2D, utime_t(0, 1000), 0);
+  pc->htinc(TEST_PERFCOUNTERS4_ELEMENT_HIST2D, utime_t(1, 0), 4096);
+
+  bufferlist bl;
+  pc->write_json_to_buf(bl, false);
+  ASSERT_EQ(sd("'test_perfcounter_4':{'hist':{'buckets':[1,1,2,2]},"
+	       "'hist2d':{'buckets':[[0,0],[1,0],[0,1]]}}"),
+	    std::string(bl.c_str(), bl.length()));
+
+  bl.clear();
+  pc->write_json_to_buf(bl, true);
+  ASSERT_EQ(sd("'test_perfcounter_4':{'hist':{'type':18,"
+	       "'x_axis':{'name':'value','scale':'log2','buckets':4}},"
+	       "'hist2d':{'type':17,"
+	       "'x_axis':{'name':'latency_usec','scale':'log2','buckets':3},"
+	       "'y_axis':{'name':'size','scale':'log2','buckets':2}}}"),
+	    std::string(bl.c_str(), bl.length()));
+  delete pc;
+}
@@ -56,6 +56,24 @@ restart_osd() {
         ./ceph-osd -i $osd_index -c ceph.conf &
 }
 
+# Stop a monitor started by vstart
+stop_mon() {
+        mon_id=$1
+        pidfile="out/mon.$mon_id.pid"
+        if [ -e $pidfile ]; then
+                kill `cat $pidfile` && return 0
+        else
+                echo "ceph-mon process $mon_id is not running"
+        fi
+        return 1
+}
+
+# Restart a monitor started by vstart
+restart_mon() {
+        mon_id=$1
+        ./ceph-mon -i $mon_id -c ceph.conf
+}
+
 # Ask the user a yes/no question and get the response
 yes_or_no_choice() {
         while true; do
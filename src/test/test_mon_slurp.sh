@@ -0,0 +1,83 @@
+#!/bin/bash -x
+
+#
+# Test that a monitor that fell behind can slurp the osdmap from its
+# peers when full maps are only stored every mon_osdmap_full_interval
+# epochs
+#
+
+# Includes
+source "`dirname $0`/test_common.sh"
+
+interval=5
+
+# Functions
+setup() {
+        export CEPH_NUM_MON=3
+        export CEPH_NUM_OSD=1
+        export CEPH_NUM_MDS=0
+        vstart_config=$1
+
+        # Start ceph
+        ./stop.sh
+
+        ./vstart.sh -d -n -o "$vstart_config" || die "vstart failed"
+}
+
+# Make some new osdmap epochs
+new_osdmap_epochs() {
+        for i in `seq 1 $1`; do
+                ./ceph osd set noout || die "failed to set noout"
+                ./ceph osd unset noout || die "failed to unset noout"
+        done
+}
+
+mon_addr() {
+        grep -A3 "^\[mon\.$1\]" ceph.conf | sed -n 's/.*mon addr = //p'
+}
+
+slurp1_impl() {
+        poll_cmd "./ceph osd stat -o -" '1 up' 3 120
+        [ $? -eq 1 ] || die "osd.0 didn't come up"
+
+        # Leave mon.c more than paxos_max_join_drift epochs behind, and
+        # let the others trim past the last epoch it has
+        stop_mon c
+        new_osdmap_epochs 20
+
+        > out/mon.c.log
+        restart_mon c
+        poll_cmd "./ceph --admin-daemon out/mon.c.asok mon_status" \
+                '"state": "\(peon\|leader\)"' 3 120
+        [ $? -eq 1 ] || die "mon.c didn't rejoin the quorum"
+        grep -q "done slurping" out/mon.c.log || die "mon.c didn't slurp"
+
+        # Epochs without a full map must not get one, not even an empty one
+        empty=`find dev/mon.c/osdmap_full -type f -size 0`
+        [ -z "$empty" ] || die "mon.c stored empty full maps: $empty"
+
+        # mon.c can still serve the maps, and they match mon.a's
+        new_osdmap_epochs 2
+        epoch=`./ceph osd stat -o - | sed -n 's/.*e\([0-9]*\): .*/\1/p'`
+        [ -n "$epoch" ] || die "couldn't get the osdmap epoch"
+        for e in `seq $(($epoch - 10)) $epoch`; do
+                ./ceph -m `mon_addr a` osd getmap $e -o $TEMPDIR/a.$e ||
+                        die "mon.a couldn't get osdmap $e"
+                ./ceph -m `mon_addr c` osd getmap $e -o $TEMPDIR/c.$e ||
+                        die "mon.c couldn't get osdmap $e"
+                cmp $TEMPDIR/a.$e $TEMPDIR/c.$e || die "osdmap $e differs"
+        done
+}
+
+slurp1() {
+        setup "mon osdmap full interval = $interval
+        mon min osdmap epochs = 12"
+
+        slurp1_impl
+}
+
+run() {
+        slurp1 || die "test failed"
+}
+
+$@
@@ -0,0 +1,189 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/ceph_argparse.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "msg/Messenger.h"
+#include "messages/MOSDMap.h"
+#include "messages/MPing.h"
+#include "osd/OSDMap.h"
+#include <gtest/gtest.h>
+
+/*
+ * Send one MOSDMap with send_message_multi() to a peer with all
+ * features, a peer that looks like an old client, and ourselves, and
+ * check that each gets the encoding meant for it: the old peer's
+ * downgrade must not leak into the others.
+ */
+
+class Receiver : public Dispatcher {
+  Mutex lock;
+  Cond cond;
+public:
+  int pings;
+  MOSDMap *map;
+
+  Receiver(CephContext *cct)
+    : Dispatcher(cct), lock("Receiver::lock"), pings(0), map(NULL) {}
+  ~Receiver() {
+    if (map)
+      map->put();
+  }
+
+  bool ms_dispatch(Message *m) {
+    Mutex::Locker l(lock);
+    if (m->get_type() == CEPH_MSG_PING) {
+      pings++;
+      m->put();
+    } else if (m->get_type() == CEPH_MSG_OSD_MAP) {
+      assert(!map);
+      map = (MOSDMap*)m;
+    } else {
+      return false;
+    }
+    cond.Signal();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+  bool ms_verify_authorizer(Connection *con, int peer_type,
+			    int protocol, bufferlist& authorizer,
+			    bufferlist& authorizer_reply,
+			    bool& isvalid, CryptoKey& session_key) {
+    isvalid = true;
+    return true;
+  }
+
+  void wait_for_ping() {
+    Mutex::Locker l(lock);
+    while (!pings)
+      cond.Wait(lock);
+  }
+  void wait_for_map() {
+    Mutex::Locker l(lock);
+    while (!map)
+      cond.Wait(lock);
+  }
+};
+
+static Messenger *start_messenger(entity_name_t name, Receiver *r, uint64_t nonce)
+{
+  Messenger *msgr = Messenger::create(g_ceph_context, name, "test", nonce);
+  if (name.is_mon()) {
+    msgr->set_default_policy(Messenger::Policy::lossless_peer(0, 0));
+  } else {
+    msgr->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  }
+  entity_addr_t addr;
+  addr.parse("127.0.0.1:0");
+  int ret = msgr->bind(addr);
+  assert(ret == 0);
+  msgr->add_dispatcher_head(r);
+  msgr->start();
+  return msgr;
+}
+
+static void send_to_mixed_peers(bool inprocess)
+{
+  g_ceph_context->_conf->set_val("ms_inprocess_delivery",
+				 inprocess ? "true" : "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  Receiver mon_r(g_ceph_context), new_r(g_ceph_context), old_r(g_ceph_context);
+  Messenger *mon = start_messenger(entity_name_t::MON(0), &mon_r, getpid());
+  Messenger *new_peer = start_messenger(entity_name_t::OSD(0), &new_r, getpid() + 1);
+  Messenger *old_peer = start_messenger(entity_name_t::OSD(1), &old_r, getpid() + 2);
+
+  Connection *new_con = mon->get_connection(new_peer->get_myinst());
+  Connection *old_con = mon->get_connection(old_peer->get_myinst());
+  Connection *local_con = mon->get_loopback_connection();
+
+  // make sure the features are negotiated before we look at them
+  mon->send_message(new MPing, new_con);
+  mon->send_message(new MPing, old_con);
+  new_r.wait_for_ping();
+  old_r.wait_for_ping();
+  // a client from before pg_pool_t v3 wants MOSDMap v1
+  old_con->set_features(CEPH_FEATURES_ALL & ~CEPH_FEATURE_PGPOOL3);
+
+  uuid_d fsid;
+  OSDMap osdmap;
+  osdmap.build_simple(g_ceph_context, 1, fsid, 3, 4, 4);
+  bufferlist full;
+  osdmap.encode(full, CEPH_FEATURES_ALL);
+
+  MOSDMap *m = new MOSDMap(fsid);
+  m->maps[1] = full;
+  m->oldest_map = 1;
+  m->newest_map = 1;
+  list<Connection*> cons;
+  cons.push_back(old_con);
+  cons.push_back(new_con);
+  cons.push_back(local_con);
+  ASSERT_EQ(0, mon->send_message_multi(m, cons));
+
+  new_r.wait_for_map();
+  old_r.wait_for_map();
+  mon_r.wait_for_map();
+
+  ASSERT_EQ(1u, old_r.map->get_header().version);
+  ASSERT_EQ(1u, old_r.map->maps.size());
+
+  ASSERT_EQ(3u, new_r.map->get_header().version);
+  ASSERT_EQ(1u, new_r.map->maps.size());
+  ASSERT_TRUE(new_r.map->maps[1].contents_equal(full));
+  ASSERT_EQ(1u, new_r.map->oldest_map);
+
+  ASSERT_EQ(3u, mon_r.map->get_header().version);
+  ASSERT_TRUE(mon_r.map->maps[1].contents_equal(full));
+
+  // and the old peer's copy is still a map
+  OSDMap old_map;
+  old_map.decode(old_r.map->maps[1]);
+  ASSERT_EQ(osdmap.get_epoch(), old_map.get_epoch());
+  ASSERT_EQ(osdmap.get_max_osd(), old_map.get_max_osd());
+
+  new_con->put();
+  old_con->put();
+  local_con->put();
+  mon->shutdown();
+  new_peer->shutdown();
+  old_peer->shutdown();
+  mon->wait();
+  new_peer->wait();
+  old_peer->wait();
+  delete mon;
+  delete new_peer;
+  delete old_peer;
+}
+
+TEST(SendMessageMulti, MixedFeatures) {
+  send_to_mixed_peers(false);
+}
+
+TEST(SendMessageMulti, MixedFeaturesInProcess) {
+  send_to_mixed_peers(true);
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -58,6 +58,83 @@ TEST(WorkQueue, Resize)
 }
 
 
+class CountWQ : public WorkStealingThreadPool::WorkQueue<unsigned> {
+  void _process(unsigned *item, ThreadPool::TPHandle &) {
+    // fan out from inside the pool too, so that items land on the
+    // workers' own deques and have to be stolen
+    if (*item >= fanout_base && *item < fanout_base + fanout) {
+      for (unsigned i = 0; i < fanout; ++i)
+	queue(new unsigned(*item * fanout + i));
+    }
+    __sync_fetch_and_add(&seen[*item], 1);
+    delete item;
+  }
+  void _discard(unsigned *item) {
+    delete item;
+  }
+public:
+  unsigned fanout_base, fanout;
+  vector<int> seen;
+  CountWQ(WorkStealingThreadPool *tp, unsigned n, unsigned base, unsigned f)
+    : WorkStealingThreadPool::WorkQueue<unsigned>("CountWQ", 100, 100, tp),
+      fanout_base(base), fanout(f), seen(n) {}
+};
+
+TEST(WorkQueue, StealingStartStop)
+{
+  WorkStealingThreadPool tp(g_ceph_context, "foo", 10);
+
+  tp.start();
+  tp.pause();
+  tp.pause_new();
+  tp.unpause();
+  tp.unpause();
+  tp.drain();
+  tp.stop();
+}
+
+TEST(WorkQueue, StealingProcessesAll)
+{
+  // items 0..99 are queued from here; each of items 10..19 queues
+  // ten more, 100..199, from a worker
+  for (unsigned threads = 1; threads <= 16; threads *= 2) {
+    WorkStealingThreadPool tp(g_ceph_context, "foo", threads);
+    CountWQ wq(&tp, 200, 10, 10);
+    tp.start();
+    for (unsigned i = 0; i < 100; ++i)
+      wq.queue(new unsigned(i));
+    wq.drain();
+    for (unsigned i = 0; i < 200; ++i)
+      ASSERT_EQ(1, wq.seen[i]) << "item " << i << " with " << threads << " threads";
+    tp.stop();
+  }
+}
+
+TEST(WorkQueue, StealingPause)
+{
+  WorkStealingThreadPool tp(g_ceph_context, "foo", 4);
+  CountWQ wq(&tp, 100, 0, 0);
+  tp.start();
+  tp.pause();
+  for (unsigned i = 0; i < 100; ++i)
+    wq.queue(new unsigned(i));
+  usleep(100000);
+  for (unsigned i = 0; i < 100; ++i)
+    ASSERT_EQ(0, wq.seen[i]);
+  tp.unpause();
+  tp.drain();
+  for (unsigned i = 0; i < 100; ++i)
+    ASSERT_EQ(1, wq.seen[i]);
+
+  // anything left at stop is discarded
+  tp.pause_new();
+  for (unsigned i = 0; i < 100; ++i)
+    wq.queue(new unsigned(i));
+  tp.stop();
+  ASSERT_EQ(0, (int)wq.queued.read());
+}
+
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -94,6 +94,7 @@ static void usage()
   cout << "  ceph osd rm <osd-id> [<osd-id>...]\n";
   cout << "  ceph osd lost [--yes-i-really-mean-it]\n";
   cout << "  ceph osd reweight <osd-id> <weight>\n";
+  cout << "  ceph osd reweight-by-pg [<max-deviation>] [<pool>]\n";
   cout << "  ceph osd blacklist add <address>[:source_port] [time]\n";
   cout << "  ceph osd blacklist rm <address>[:source_port]\n";
   cout << "  ceph osd pool mksnap <pool> <snapname>\n";